@@ -0,0 +1,170 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "arena.h"
+
+#define ARENA_ALIGNMENT 16
+#define ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1))
+
+typedef struct Arena_s Arena;
+typedef struct Block_s Block;
+
+// Field references counts the live buffers in the block, plus one while its owner still
+// allocates from it. Field nextReturned links the block into its owner's returned or free blocks.
+struct Block_s {
+    Arena* owner;
+    atomic_int references;
+    Block* nextReturned;
+    Block* nextOwned;
+};
+
+// Fields current, used, free and owned are only touched by the owning thread.
+// Other threads push blocks they finished onto returned.
+struct Arena_s {
+    Block* current;
+    size_t used;
+    Block* free;
+    _Atomic(Block*) returned;
+    Block* owned;
+    Arena* nextArena;
+};
+
+// Every buffer is preceded by a header holding its block, or NULL if it was too large for one
+#define BLOCK_HEADER_SIZE ALIGN(sizeof(Block))
+#define BUFFER_HEADER_SIZE ALIGN(sizeof(Block*))
+
+static _Thread_local Arena* pThreadArena = NULL;
+static Arena* pArenas = NULL;
+static pthread_mutex_t arenasMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns the arena of the calling thread, creating it on first use
+static Arena* threadArena()
+{
+    if (pThreadArena == NULL) {
+        Arena* pArena = calloc(1, sizeof(Arena));
+        if (pArena == NULL) {
+            return NULL;
+        }
+        atomic_init(&pArena->returned, NULL);
+        pthread_mutex_lock(&arenasMutex);
+        {
+            pArena->nextArena = pArenas;
+            pArenas = pArena;
+        }
+        pthread_mutex_unlock(&arenasMutex);
+        pThreadArena = pArena;
+    }
+    return pThreadArena;
+}
+
+// Hands pBlock back to its owner. Lock-free; only ever pushes, and the owner takes the
+// whole stack at once, so a block cannot be popped and pushed back underneath a push.
+static void returnBlock(Block* pBlock)
+{
+    Arena* pOwner = pBlock->owner;
+    Block* pHead = atomic_load_explicit(&pOwner->returned, memory_order_relaxed);
+    do {
+        pBlock->nextReturned = pHead;
+    } while (!atomic_compare_exchange_weak_explicit(&pOwner->returned, &pHead, pBlock, memory_order_release, memory_order_relaxed));
+}
+
+// Retires the current block of pArena and replaces it with a recycled or new one
+// Returns 0 on success, -1 on failure
+static int nextBlock(Arena* pArena)
+{
+    Block* pRetired = pArena->current;
+    pArena->current = NULL;
+    if ((pRetired != NULL) && (atomic_fetch_sub_explicit(&pRetired->references, 1, memory_order_acq_rel) == 1)) {
+        pRetired->nextReturned = pArena->free;
+        pArena->free = pRetired;
+    }
+
+    if (pArena->free == NULL) {
+        pArena->free = atomic_exchange_explicit(&pArena->returned, NULL, memory_order_acquire);
+    }
+    Block* pBlock = pArena->free;
+    if (pBlock != NULL) {
+        pArena->free = pBlock->nextReturned;
+    }
+    else {
+        pBlock = malloc(ARENA_BLOCK_SIZE);
+        if (pBlock == NULL) {
+            return -1;
+        }
+        pBlock->owner = pArena;
+        pBlock->nextOwned = pArena->owned;
+        pArena->owned = pBlock;
+    }
+    atomic_init(&pBlock->references, 1);
+    pBlock->nextReturned = NULL;
+    pArena->current = pBlock;
+    pArena->used = BLOCK_HEADER_SIZE;
+    return 0;
+}
+
+// Allocate size bytes from the calling thread's arena
+// Buffers that do not fit in a block come from malloc
+void* Arena_alloc(size_t size)
+{
+    size_t needed = BUFFER_HEADER_SIZE + ALIGN(size);
+    if (needed > ARENA_BLOCK_SIZE - BLOCK_HEADER_SIZE) {
+        char* pBuffer = malloc(needed);
+        if (pBuffer == NULL) {
+            return NULL;
+        }
+        *(Block**)pBuffer = NULL;
+        return pBuffer + BUFFER_HEADER_SIZE;
+    }
+
+    Arena* pArena = threadArena();
+    if (pArena == NULL) {
+        return NULL;
+    }
+    if ((pArena->current == NULL) || (pArena->used + needed > ARENA_BLOCK_SIZE)) {
+        if (nextBlock(pArena) != 0) {
+            return NULL;
+        }
+    }
+    char* pBuffer = (char*)pArena->current + pArena->used;
+    pArena->used += needed;
+    atomic_fetch_add_explicit(&pArena->current->references, 1, memory_order_relaxed);
+    *(Block**)pBuffer = pArena->current;
+    return pBuffer + BUFFER_HEADER_SIZE;
+}
+
+// Free memory returned by Arena_alloc, from any thread
+void Arena_free(void* pMemory)
+{
+    if (pMemory == NULL) {
+        return;
+    }
+    char* pBuffer = (char*)pMemory - BUFFER_HEADER_SIZE;
+    Block* pBlock = *(Block**)pBuffer;
+    if (pBlock == NULL) {
+        free(pBuffer);
+    }
+    else if (atomic_fetch_sub_explicit(&pBlock->references, 1, memory_order_acq_rel) == 1) {
+        returnBlock(pBlock);
+    }
+}
+
+// Release the memory of every arena, once no thread allocates or frees anymore
+void Arena_cleanup()
+{
+    pthread_mutex_lock(&arenasMutex);
+    {
+        while (pArenas != NULL) {
+            Arena* pArena = pArenas;
+            pArenas = pArena->nextArena;
+            while (pArena->owned != NULL) {
+                Block* pBlock = pArena->owned;
+                pArena->owned = pBlock->nextOwned;
+                free(pBlock);
+            }
+            free(pArena);
+        }
+    }
+    pthread_mutex_unlock(&arenasMutex);
+    pThreadArena = NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+#include <stddef.h>
+
+// Message buffers are carved out of blocks owned by the allocating thread, so producer threads
+// never contend on malloc. Buffers may be freed from any thread; a block goes back to its
+// owner once every buffer in it has been freed.
+
+// Size of the blocks each thread allocates from
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+// Allocate size bytes from the calling thread's arena
+// Returns NULL on failure
+void* Arena_alloc(size_t size);
+
+// Free memory returned by Arena_alloc, from any thread
+void Arena_free(void* pMemory);
+
+// Release the memory of every arena, once no thread allocates or frees anymore
+void Arena_cleanup();
+
+#endif
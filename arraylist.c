@@ -0,0 +1,811 @@
+#include "list.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static List lists[LIST_MAX_NUM_HEADS];
+static Chunk chunks[LIST_MAX_NUM_CHUNKS];
+
+// Variables to keep track of the available chunk and list,
+// and of the number of items stored across all lists.
+static Chunk* pAvailableChunk;
+static List* pAvailableList;
+static int numItemsInUse = 0;
+
+// Returns the index of pItem among the count pointers of pItems, or -1 if it is not there.
+// Chosen in setup() according to the instruction sets of the CPU.
+typedef int (*FIND_POINTER_FN)(void** pItems, int count, void* pItem);
+static FIND_POINTER_FN findPointer;
+
+static int findPointerScalar(void** pItems, int count, void* pItem)
+{
+    for (int i = 0; i < count; i++) {
+        if (pItems[i] == pItem) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#if defined(__x86_64__)
+// SSE2 has no 64-bit compare: a pointer matches when both of its 32-bit halves do.
+static int findPointerSse2(void** pItems, int count, void* pItem)
+{
+    __m128i needle = _mm_set1_epi64x((long long)(intptr_t)pItem);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i halves = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&pItems[i]), needle);
+        __m128i matches = _mm_and_si128(halves, _mm_shuffle_epi32(halves, _MM_SHUFFLE(2, 3, 0, 1)));
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(matches));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    int found = findPointerScalar(&pItems[i], count - i, pItem);
+    return (found < 0) ? -1 : i + found;
+}
+
+__attribute__((target("avx2")))
+static int findPointerAvx2(void** pItems, int count, void* pItem)
+{
+    __m256i needle = _mm256_set1_epi64x((long long)(intptr_t)pItem);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i matches = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&pItems[i]), needle);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(matches));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    int found = findPointerScalar(&pItems[i], count - i, pItem);
+    return (found < 0) ? -1 : i + found;
+}
+#endif
+
+// Picks the fastest findPointer the CPU supports
+static void setupFindPointer()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        findPointer = &findPointerAvx2;
+    }
+    else {
+        findPointer = &findPointerSse2;
+    }
+#else
+    findPointer = &findPointerScalar;
+#endif
+}
+
+// Initializes pAvailableList and pAvailableChunk.
+// For each list in lists[], stores pointers to its adjacent lists and
+// for each chunk in chunks[], stores pointers to its adjacent chunks.
+static bool notSetup = true;
+static void setup()
+{
+    pAvailableList = &lists[0];
+    pAvailableChunk = &chunks[0];
+
+    for (int i = 0; i < LIST_MAX_NUM_HEADS - 1; i++) {
+        lists[i].nextAvailableList = &lists[i+1];
+    }
+    lists[LIST_MAX_NUM_HEADS-1].nextAvailableList = NULL;
+
+    for (int i = 0; i < LIST_MAX_NUM_CHUNKS - 1; i++) {
+        chunks[i].next = &chunks[i+1];
+    }
+    chunks[LIST_MAX_NUM_CHUNKS-1].next = NULL;
+
+    setupFindPointer();
+}
+
+// Resets the fields in pList
+static void resetList(List* pList) {
+    assert(pList != NULL);
+    pList->size = 0;
+    pList->head = NULL;
+    pList->tail = NULL;
+    pList->current = NULL;
+    pList->currentIndex = 0;
+    pList->state = before;
+    pList->nextAvailableList = NULL;
+    return;
+}
+
+// Resets the fields in pChunk
+static void resetChunk(Chunk* pChunk) {
+    assert(pChunk != NULL);
+    pChunk->count = 0;
+    pChunk->previous = NULL;
+    pChunk->next = NULL;
+    return;
+}
+
+// Returns a pointer to an available list in lists[].
+// Returns NULL if lists are exhausted.
+static List* nextAvailableList()
+{
+    if (pAvailableList == NULL)  {
+        return NULL;
+    }
+    else {
+        List* pList = pAvailableList;
+        pAvailableList = pAvailableList->nextAvailableList;
+        resetList(pList);
+        return pList;
+    }
+}
+
+// Returns a pointer to an available chunk in chunks[].
+// Returns NULL if chunks are exhausted.
+static Chunk* nextAvailableChunk()
+{
+    if (pAvailableChunk == NULL) {
+        return NULL;
+    }
+    else {
+        Chunk* pChunk = pAvailableChunk;
+        pAvailableChunk = pAvailableChunk->next;
+        resetChunk(pChunk);
+        return pChunk;
+    }
+}
+
+// Adds pList to the available lists pool
+static void markAsAvailableList(List* pList)
+{
+    pList->nextAvailableList = pAvailableList;
+    pAvailableList = pList;
+    return;
+}
+
+// Adds pChunk to the available chunks pool
+static void markAsAvailableChunk(Chunk* pChunk)
+{
+    pChunk->next = pAvailableChunk;
+    pAvailableChunk = pChunk;
+    return;
+}
+
+// Returns true if pList is empty, false if non-empty.
+static bool isEmptyList(List* pList)
+{
+    return (pList->size == 0) && (pList->head == NULL) && (pList->tail == NULL) && (pList->current == NULL) && (pList->state != within);
+}
+
+// Returns true if pList is non-empty, false if empty.
+static bool isNonEmptyList(List* pList)
+{
+    return (pList->size > 0) && (pList->head != NULL) && (pList->tail != NULL);
+}
+
+// Makes the item at index of pChunk the current item.
+static void setCurrent(List* pList, Chunk* pChunk, int index)
+{
+    assert((pChunk != NULL) && (index >= 0) && (index < pChunk->count));
+    pList->current = pChunk;
+    pList->currentIndex = index;
+    pList->state = within;
+}
+
+// Sets the current pointer to be before the start or beyond the end of pList.
+static void clearCurrent(List* pList, enum PointingState state)
+{
+    assert(state != within);
+    pList->current = NULL;
+    pList->currentIndex = 0;
+    pList->state = state;
+}
+
+// Takes pChunk out of pList and adds it to the available chunks pool
+static void unlinkChunk(List* pList, Chunk* pChunk)
+{
+    if (pChunk->previous == NULL) {
+        pList->head = pChunk->next;
+    }
+    else {
+        pChunk->previous->next = pChunk->next;
+    }
+    if (pChunk->next == NULL) {
+        pList->tail = pChunk->previous;
+    }
+    else {
+        pChunk->next->previous = pChunk->previous;
+    }
+    markAsAvailableChunk(pChunk);
+}
+
+// Spreads the items of two adjacent chunks evenly between them, or moves them all into pLeft
+// when they fit in one chunk. The current pointer stays on the same item.
+static void rebalance(List* pList, Chunk* pLeft, Chunk* pRight)
+{
+    assert(pLeft->next == pRight);
+    void* items[2 * LIST_CHUNK_CAPACITY];
+    int total = pLeft->count + pRight->count;
+    memcpy(items, pLeft->items, pLeft->count * sizeof(void*));
+    memcpy(&items[pLeft->count], pRight->items, pRight->count * sizeof(void*));
+
+    int currentPosition = -1;
+    if (pList->current == pLeft) {
+        currentPosition = pList->currentIndex;
+    }
+    else if (pList->current == pRight) {
+        currentPosition = pLeft->count + pList->currentIndex;
+    }
+
+    int leftCount = (total <= LIST_CHUNK_CAPACITY) ? total : total / 2;
+    pLeft->count = leftCount;
+    pRight->count = total - leftCount;
+    memcpy(pLeft->items, items, pLeft->count * sizeof(void*));
+    memcpy(pRight->items, &items[leftCount], pRight->count * sizeof(void*));
+    if (pRight->count == 0) {
+        unlinkChunk(pList, pRight);
+    }
+
+    if (currentPosition >= leftCount) {
+        setCurrent(pList, pRight, currentPosition - leftCount);
+    }
+    else if (currentPosition >= 0) {
+        setCurrent(pList, pLeft, currentPosition);
+    }
+}
+
+// Keeps pChunk at least half full after items were taken out of it, by borrowing from or
+// merging with a neighbouring chunk. Returns the chunk to the pool once it is empty.
+static void refill(List* pList, Chunk* pChunk)
+{
+    if (pChunk->count == 0) {
+        unlinkChunk(pList, pChunk);
+    }
+    else if (pChunk->count >= LIST_CHUNK_CAPACITY / 2) {
+        return;
+    }
+    else if (pChunk->next != NULL) {
+        rebalance(pList, pChunk, pChunk->next);
+    }
+    else if (pChunk->previous != NULL) {
+        rebalance(pList, pChunk->previous, pChunk);
+    }
+}
+
+// Adds pItem at index of pChunk, and makes the new item the current one. A full chunk is split
+// in two first. If pChunk is NULL, pList must be empty and gets its first chunk.
+// Returns 0 on success, -1 on failure.
+static int insertAt(List* pList, Chunk* pChunk, int index, void* pItem)
+{
+    assert(pList != NULL);
+    if (numItemsInUse == LIST_MAX_NUM_NODES) {
+        return -1;
+    }
+    if (pChunk == NULL) {
+        assert(isEmptyList(pList));
+        pChunk = nextAvailableChunk();
+        if (pChunk == NULL) {
+            return -1;
+        }
+        pList->head = pChunk;
+        pList->tail = pChunk;
+        index = 0;
+    }
+    else if (pChunk->count == LIST_CHUNK_CAPACITY) {
+        Chunk* pSplit = nextAvailableChunk();
+        if (pSplit == NULL) {
+            return -1;
+        }
+        int half = LIST_CHUNK_CAPACITY / 2;
+        memcpy(pSplit->items, &pChunk->items[half], (LIST_CHUNK_CAPACITY - half) * sizeof(void*));
+        pSplit->count = LIST_CHUNK_CAPACITY - half;
+        pChunk->count = half;
+        pSplit->previous = pChunk;
+        pSplit->next = pChunk->next;
+        if (pChunk->next == NULL) {
+            pList->tail = pSplit;
+        }
+        else {
+            pChunk->next->previous = pSplit;
+        }
+        pChunk->next = pSplit;
+        if (index > half) {
+            pChunk = pSplit;
+            index -= half;
+        }
+    }
+    memmove(&pChunk->items[index + 1], &pChunk->items[index], (pChunk->count - index) * sizeof(void*));
+    pChunk->items[index] = pItem;
+    pChunk->count++;
+    pList->size++;
+    numItemsInUse++;
+    setCurrent(pList, pChunk, index);
+    return 0;
+}
+
+// Takes the item at index of pChunk out of pList and returns it.
+// The item that followed it becomes the current one; if there is none,
+// the current pointer is set to be beyond the end of pList.
+static void* removeAt(List* pList, Chunk* pChunk, int index)
+{
+    assert(isNonEmptyList(pList) && (index >= 0) && (index < pChunk->count));
+    void* pItem = pChunk->items[index];
+    pChunk->count--;
+    memmove(&pChunk->items[index], &pChunk->items[index + 1], (pChunk->count - index) * sizeof(void*));
+    pList->size--;
+    numItemsInUse--;
+    if (index < pChunk->count) {
+        setCurrent(pList, pChunk, index);
+    }
+    else if (pChunk->next != NULL) {
+        setCurrent(pList, pChunk->next, 0);
+    }
+    else {
+        clearCurrent(pList, beyond);
+    }
+    refill(pList, pChunk);
+    return pItem;
+}
+
+// Makes a new, empty list, and returns its reference on success.
+// Returns a NULL pointer on failure.
+// Calls setup() to store the address of each chunk and list the first time it is called
+List* List_create()
+{
+    if (notSetup) {
+        setup();
+        notSetup = false;
+    }
+    List* pList = nextAvailableList();
+    if (pList != NULL) {
+        assert(isEmptyList(pList));
+    }
+    return pList;
+}
+
+// Returns the number of items in pList.
+int List_count(List* pList)
+{
+    assert(pList != NULL);
+    return pList->size;
+}
+
+// Returns a pointer to the first item in pList and makes the first item the current item.
+// Returns NULL and sets current item to NULL if list is empty.
+void* List_first(List* pList)
+{
+    assert(pList != NULL);
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        return NULL;
+    }
+    assert(isNonEmptyList(pList));
+    setCurrent(pList, pList->head, 0);
+    return pList->head->items[0];
+}
+
+// Returns a pointer to the last item in pList and makes the last item the current item.
+// Returns NULL and sets current item to NULL if list is empty.
+void* List_last(List* pList)
+{
+    assert(pList != NULL);
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        return NULL;
+    }
+    assert(isNonEmptyList(pList));
+    setCurrent(pList, pList->tail, pList->tail->count - 1);
+    return pList->tail->items[pList->currentIndex];
+}
+
+// Advances pList's current item by one, and returns a pointer to the new current item.
+// If this operation advances the current item beyond the end of the pList, a NULL pointer
+// is returned and the current item is set to be beyond end of pList.
+void* List_next(List* pList)
+{
+    assert(pList != NULL);
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        pList->state = beyond;
+        return NULL;
+    }
+    assert(isNonEmptyList(pList));
+    if (pList->state == before) {
+        setCurrent(pList, pList->head, 0);
+    }
+    else if (pList->state == beyond) {
+        return NULL;
+    }
+    else if (pList->currentIndex + 1 < pList->current->count) {
+        pList->currentIndex++;
+    }
+    else if (pList->current->next != NULL) {
+        setCurrent(pList, pList->current->next, 0);
+    }
+    else {
+        clearCurrent(pList, beyond);
+        return NULL;
+    }
+    return pList->current->items[pList->currentIndex];
+}
+
+// Backs up pList's current item by one, and returns a pointer to the new current item.
+// If this operation backs up the current item beyond the start of the pList, a NULL pointer
+// is returned and the current item is set to be before the start of pList.
+void* List_prev(List* pList)
+{
+    assert(pList != NULL);
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        pList->state = before;
+        return NULL;
+    }
+    assert(isNonEmptyList(pList));
+    if (pList->state == before) {
+        return NULL;
+    }
+    else if (pList->state == beyond) {
+        setCurrent(pList, pList->tail, pList->tail->count - 1);
+    }
+    else if (pList->currentIndex > 0) {
+        pList->currentIndex--;
+    }
+    else if (pList->current->previous != NULL) {
+        setCurrent(pList, pList->current->previous, pList->current->previous->count - 1);
+    }
+    else {
+        clearCurrent(pList, before);
+        return NULL;
+    }
+    return pList->current->items[pList->currentIndex];
+}
+
+// Returns a pointer to the current item in pList.
+void* List_curr(List* pList)
+{
+    assert(pList != NULL);
+    if (pList->current == NULL) {
+        return NULL;
+    }
+    assert(isNonEmptyList(pList));
+    return pList->current->items[pList->currentIndex];
+}
+
+// Adds the new item to pList directly after the current item, and makes item the current item.
+// If the current pointer is before the start of the pList, the item is added at the start. If
+// the current pointer is beyond the end of the pList, the item is added at the end.
+// Returns 0 on success, -1 on failure.
+int List_add(List* pList, void* pItem)
+{
+    assert(pList != NULL);
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        return insertAt(pList, NULL, 0, pItem);
+    }
+    else if (pList->state == before) {
+        return List_prepend(pList, pItem);
+    }
+    else if (pList->state == beyond) {
+        return List_append(pList, pItem);
+    }
+    return insertAt(pList, pList->current, pList->currentIndex + 1, pItem);
+}
+
+// Adds item to pList directly before the current item, and makes the new item the current one.
+// If the current pointer is before the start of the pList, the item is added at the start.
+// If the current pointer is beyond the end of the pList, the item is added at the end.
+// Returns 0 on success, -1 on failure.
+int List_insert(List* pList, void* pItem)
+{
+    assert(pList != NULL);
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        return insertAt(pList, NULL, 0, pItem);
+    }
+    else if (pList->state == beyond) {
+        return List_append(pList, pItem);
+    }
+    else if (pList->state == before) {
+        return List_prepend(pList, pItem);
+    }
+    return insertAt(pList, pList->current, pList->currentIndex, pItem);
+}
+
+// Adds item to the end of pList, and makes the new item the current one.
+// Returns 0 on success, -1 on failure.
+int List_append(List* pList, void* pItem)
+{
+    assert(pList != NULL);
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        return insertAt(pList, NULL, 0, pItem);
+    }
+    assert(isNonEmptyList(pList));
+    return insertAt(pList, pList->tail, pList->tail->count, pItem);
+}
+
+// Adds item to the front of pList, and makes the new item the current one.
+// Returns 0 on success, -1 on failure.
+int List_prepend(List* pList, void* pItem)
+{
+    assert(pList != NULL);
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        return insertAt(pList, NULL, 0, pItem);
+    }
+    assert(isNonEmptyList(pList));
+    return insertAt(pList, pList->head, 0, pItem);
+}
+
+// Return current item and take it out of pList. Make the next item the current one.
+// If the current pointer is before the start of the pList, or beyond the end of the pList,
+// then do not change the pList and return NULL.
+void* List_remove(List* pList)
+{
+    assert(pList != NULL);
+    if ((pList->state == before) || (pList->state == beyond)) {
+        return NULL;
+    }
+    assert(isNonEmptyList(pList) && (pList->current != NULL));
+    return removeAt(pList, pList->current, pList->currentIndex);
+}
+
+// Adds pList2 to the end of pList1. The current pointer is set to the current pointer of pList1.
+// pList2 no longer exists after the operation; its head is available for future operations.
+void List_concat(List* pList1, List* pList2)
+{
+    assert((pList1 != NULL) && (pList2 != NULL));
+    if (pList1->size == 0) {
+        pList1->size = pList2->size;
+        pList1->head = pList2->head;
+        pList1->tail = pList2->tail;
+        clearCurrent(pList1, before);
+    }
+    else if (pList2->size != 0) {
+        Chunk* pJunction = pList1->tail;
+        pList1->size = pList1->size + pList2->size;
+        pJunction->next = pList2->head;
+        pList2->head->previous = pJunction;
+        pList1->tail = pList2->tail;
+        if (pList1->current == NULL) {
+            pList1->state = before;
+        }
+        // Either list may have contributed a single, partly filled chunk
+        if ((pJunction->count < LIST_CHUNK_CAPACITY / 2) || (pJunction->next->count < LIST_CHUNK_CAPACITY / 2)) {
+            rebalance(pList1, pJunction, pJunction->next);
+        }
+    }
+    resetList(pList2);
+    markAsAvailableList(pList2);
+    return;
+}
+
+// Delete pList. pItemFreeFn is a pointer to a routine that frees an item.
+// It should be invoked (within List_free) as: (*pItemFreeFn)(itemToBeFreedFromNode);
+// pList and all its nodes no longer exists after the operation; its head and nodes are available for future operations.
+// pItemFreeFn may be NULL when the items are owned elsewhere; the chunks are then
+// returned to the pool in one step.
+void List_free(List* pList, FREE_FN pItemFreeFn)
+{
+    assert(pList != NULL);
+    if (pItemFreeFn != NULL) {
+        for (Chunk* pCurrent = pList->head; pCurrent != NULL; pCurrent = pCurrent->next) {
+            for (int i = 0; i < pCurrent->count; i++) {
+                (*pItemFreeFn)(pCurrent->items[i]);
+            }
+        }
+    }
+    if (pList->head != NULL) {
+        pList->tail->next = pAvailableChunk;
+        pAvailableChunk = pList->head;
+    }
+    numItemsInUse -= pList->size;
+    resetList(pList);
+    markAsAvailableList(pList);
+    return;
+}
+
+// Return last item and take it out of pList. Make the new last item the current one.
+// Return NULL if pList is initially empty.
+void* List_trim(List* pList)
+{
+    assert(pList != NULL);
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        return NULL;
+    }
+    assert(isNonEmptyList(pList));
+    void* pItem = removeAt(pList, pList->tail, pList->tail->count - 1);
+    if (pList->size == 0) {
+        clearCurrent(pList, before);
+    }
+    else {
+        setCurrent(pList, pList->tail, pList->tail->count - 1);
+    }
+    return pItem;
+}
+
+// Adds the count items of pItems to the front of pList as if each were passed to List_prepend
+// in order, and makes the new first item the current one. Either all items are added or none are.
+// Returns 0 on success, -1 on failure.
+int List_prependMany(List* pList, void** pItems, int count)
+{
+    assert((pList != NULL) && (count >= 0));
+    if (numItemsInUse + count > LIST_MAX_NUM_NODES) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        int result = insertAt(pList, pList->head, 0, pItems[i]);
+        assert(result == 0);
+        (void)result;
+    }
+    return 0;
+}
+
+// Takes up to maxItems items off the end of pList and stores them in pItems, in the order
+// repeated calls to List_trim would return them. Makes the new last item the current one.
+// Returns the number of items taken.
+int List_drain(List* pList, void** pItems, int maxItems)
+{
+    assert((pList != NULL) && (maxItems >= 0));
+    int count = (pList->size < maxItems) ? pList->size : maxItems;
+    if (count == 0) {
+        return 0;
+    }
+    assert(isNonEmptyList(pList));
+    clearCurrent(pList, before);
+    for (int i = 0; i < count; i++) {
+        Chunk* pTail = pList->tail;
+        pTail->count--;
+        pItems[i] = pTail->items[pTail->count];
+        if (pTail->count == 0) {
+            unlinkChunk(pList, pTail);
+        }
+    }
+    pList->size -= count;
+    numItemsInUse -= count;
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+    }
+    else {
+        refill(pList, pList->tail);
+        setCurrent(pList, pList->tail, pList->tail->count - 1);
+    }
+    return count;
+}
+
+// Positions the current pointer on the item a search starts from.
+// Returns false if there is no item left to search.
+static bool startSearch(List* pList)
+{
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        pList->state = beyond;
+        return false;
+    }
+    else if (pList->state == before) {
+        assert(isNonEmptyList(pList));
+        setCurrent(pList, pList->head, 0);
+    }
+    else if (pList->state == beyond) {
+        assert(isNonEmptyList(pList));
+        return false;
+    }
+    return true;
+}
+
+// Returns true if the string pItem is equal to (or starts with) the length characters of pString
+static bool matchesString(const char* pItem, const char* pString, size_t length, bool prefix)
+{
+    if ((pItem == NULL) || ((length > 0) && (pItem[0] != pString[0]))) {
+        return false;
+    }
+    return prefix ? (strncmp(pItem, pString, length) == 0) : (strcmp(pItem, pString) == 0);
+}
+
+// Search pList, starting at the current item, until the end is reached or a match is found.
+// In this context, a match is determined by the comparator parameter. This parameter is a
+// pointer to a routine that takes as its first argument an item pointer, and as its second
+// argument pComparisonArg. Comparator returns 0 if the item and comparisonArg don't match,
+// or 1 if they do. Exactly what constitutes a match is up to the implementor of comparator.
+//
+// If a match is found, the current pointer is left at the matched item and the pointer to
+// that item is returned. If no match is found, the current pointer is left beyond the end of
+// the list and a NULL pointer is returned.
+//
+// If the current pointer is before the start of the pList, then start searching from
+// the first node in the list (if any).
+void* List_search(List* pList, COMPARATOR_FN pComparator, void* pComparisonArg)
+{
+    assert((pList != NULL) && (pComparisonArg != NULL));
+    if (!startSearch(pList)) {
+        return NULL;
+    }
+    Chunk* pChunk = pList->current;
+    int index = pList->currentIndex;
+    while (pChunk != NULL) {
+        for (; index < pChunk->count; index++) {
+            if ((*pComparator)(pChunk->items[index], pComparisonArg)) {
+                setCurrent(pList, pChunk, index);
+                return pChunk->items[index];
+            }
+        }
+        pChunk = pChunk->next;
+        index = 0;
+    }
+    clearCurrent(pList, beyond);
+    return NULL;
+}
+
+// Search pList for the item pointer pItem.
+void* List_searchPointer(List* pList, void* pItem)
+{
+    assert((pList != NULL) && (pItem != NULL));
+    if (!startSearch(pList)) {
+        return NULL;
+    }
+    Chunk* pChunk = pList->current;
+    int index = pList->currentIndex;
+    while (pChunk != NULL) {
+        int found = (*findPointer)(&pChunk->items[index], pChunk->count - index, pItem);
+        if (found >= 0) {
+            setCurrent(pList, pChunk, index + found);
+            return pItem;
+        }
+        pChunk = pChunk->next;
+        index = 0;
+    }
+    clearCurrent(pList, beyond);
+    return NULL;
+}
+
+// Search pList, whose items are strings, for an item equal to pString.
+// If prefix is true, an item matches when it starts with pString.
+void* List_searchString(List* pList, const char* pString, bool prefix)
+{
+    assert((pList != NULL) && (pString != NULL));
+    if (!startSearch(pList)) {
+        return NULL;
+    }
+    size_t length = strlen(pString);
+    Chunk* pChunk = pList->current;
+    int index = pList->currentIndex;
+    while (pChunk != NULL) {
+        for (; index < pChunk->count; index++) {
+            if (matchesString(pChunk->items[index], pString, length, prefix)) {
+                setCurrent(pList, pChunk, index);
+                return pChunk->items[index];
+            }
+        }
+        pChunk = pChunk->next;
+        index = 0;
+    }
+    clearCurrent(pList, beyond);
+    return NULL;
+}
+
+// Search pList with a comparator that takes a run of count consecutive items at a time.
+// Each run is the remainder of a chunk, passed in place.
+void* List_searchBatch(List* pList, BATCH_COMPARATOR_FN pComparator, void* pComparisonArg)
+{
+    assert((pList != NULL) && (pComparisonArg != NULL));
+    if (!startSearch(pList)) {
+        return NULL;
+    }
+    Chunk* pChunk = pList->current;
+    int index = pList->currentIndex;
+    while (pChunk != NULL) {
+        int found = (*pComparator)(&pChunk->items[index], pChunk->count - index, pComparisonArg);
+        if (found >= 0) {
+            assert(index + found < pChunk->count);
+            setCurrent(pList, pChunk, index + found);
+            return pChunk->items[index + found];
+        }
+        pChunk = pChunk->next;
+        index = 0;
+    }
+    clearCurrent(pList, beyond);
+    return NULL;
+}
@@ -0,0 +1,197 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "../arena.h"
+
+// Times message buffer allocation with malloc against the arenas, the way the program uses
+// them: BENCH_PRODUCERS threads allocate buffers of BENCH_MIN_SIZE to BENCH_MAX_SIZE bytes and
+// hand them through a bounded queue to one thread that frees them. Reports the latency
+// percentiles of the allocations and the peak resident memory. Each allocator runs in its own
+// process, so neither inherits the other's heap. Run with the number of allocations per
+// producer, default BENCH_DEFAULT_ALLOCATIONS.
+
+#define BENCH_DEFAULT_ALLOCATIONS 1000000
+#define BENCH_PRODUCERS 4
+#define BENCH_QUEUE_SLOTS 1024
+
+// Sizes of the buffers, those of a chat message up to about a line of text
+#define BENCH_MIN_SIZE 16
+#define BENCH_MAX_SIZE 1040
+
+#define BENCH_CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: Property failed: %s\n", __FILE__, __LINE__, #condition); \
+            abort(); \
+        } \
+    } while (0)
+
+enum Allocator {ALLOCATOR_MALLOC, ALLOCATOR_ARENA, ALLOCATOR_COUNT};
+
+static const char* allocatorNames[ALLOCATOR_COUNT] = {"malloc", "Arena_alloc"};
+
+static enum Allocator allocator;
+static long allocations;
+
+// Nanoseconds each allocation took, per producer
+static uint32_t* latencies[BENCH_PRODUCERS];
+
+// Buffers on their way from the producers to the consumer
+static void* queue[BENCH_QUEUE_SLOTS];
+static int queueHead = 0;
+static int queueCount = 0;
+static bool producing = true;
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t notEmptyCondVar = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t notFullCondVar = PTHREAD_COND_INITIALIZER;
+
+// Returns the current monotonic time in nanoseconds
+static uint64_t nowNanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Allocates buffers of random sizes, timing each allocation, and queues them for freeing
+static void* producerThread(void* pArg)
+{
+    uint32_t* pLatencies = pArg;
+    uint64_t randomState = (uintptr_t)pArg | 1;
+    for (long i = 0; i < allocations; i++) {
+        randomState ^= randomState << 13;
+        randomState ^= randomState >> 7;
+        randomState ^= randomState << 17;
+        size_t size = BENCH_MIN_SIZE + randomState % (BENCH_MAX_SIZE - BENCH_MIN_SIZE + 1);
+
+        uint64_t start = nowNanos();
+        void* pBuffer = (allocator == ALLOCATOR_MALLOC) ? malloc(size) : Arena_alloc(size);
+        pLatencies[i] = nowNanos() - start;
+        BENCH_CHECK(pBuffer != NULL);
+        memset(pBuffer, 1, size);
+
+        pthread_mutex_lock(&queueMutex);
+        {
+            while (queueCount == BENCH_QUEUE_SLOTS) {
+                pthread_cond_wait(&notFullCondVar, &queueMutex);
+            }
+            queue[(queueHead + queueCount) % BENCH_QUEUE_SLOTS] = pBuffer;
+            queueCount++;
+            pthread_cond_signal(&notEmptyCondVar);
+        }
+        pthread_mutex_unlock(&queueMutex);
+    }
+    return NULL;
+}
+
+// Frees queued buffers until the producers are done and the queue is empty
+static void* consumerThread()
+{
+    while (true) {
+        void* pBuffer = NULL;
+        pthread_mutex_lock(&queueMutex);
+        {
+            while ((queueCount == 0) && producing) {
+                pthread_cond_wait(&notEmptyCondVar, &queueMutex);
+            }
+            if (queueCount > 0) {
+                pBuffer = queue[queueHead];
+                queueHead = (queueHead + 1) % BENCH_QUEUE_SLOTS;
+                queueCount--;
+                pthread_cond_signal(&notFullCondVar);
+            }
+        }
+        pthread_mutex_unlock(&queueMutex);
+        if (pBuffer == NULL) {
+            return NULL;
+        }
+        if (allocator == ALLOCATOR_MALLOC) {
+            free(pBuffer);
+        }
+        else {
+            Arena_free(pBuffer);
+        }
+    }
+}
+
+static int compareLatencies(const void* pFirst, const void* pSecond)
+{
+    uint32_t first = *(const uint32_t*)pFirst;
+    uint32_t second = *(const uint32_t*)pSecond;
+    return (first > second) - (first < second);
+}
+
+// Run the producers and the consumer with allocator, then report
+static void run()
+{
+    // Allocated and touched before the run, so their pages are counted the same for both
+    uint32_t* samples = malloc(BENCH_PRODUCERS * allocations * sizeof(uint32_t));
+    BENCH_CHECK(samples != NULL);
+    memset(samples, 0, BENCH_PRODUCERS * allocations * sizeof(uint32_t));
+    for (int i = 0; i < BENCH_PRODUCERS; i++) {
+        latencies[i] = &samples[i * allocations];
+    }
+
+    pthread_t consumer;
+    pthread_t producers[BENCH_PRODUCERS];
+    uint64_t start = nowNanos();
+    BENCH_CHECK(pthread_create(&consumer, NULL, consumerThread, NULL) == 0);
+    for (int i = 0; i < BENCH_PRODUCERS; i++) {
+        BENCH_CHECK(pthread_create(&producers[i], NULL, producerThread, latencies[i]) == 0);
+    }
+    for (int i = 0; i < BENCH_PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    pthread_mutex_lock(&queueMutex);
+    {
+        producing = false;
+        pthread_cond_broadcast(&notEmptyCondVar);
+    }
+    pthread_mutex_unlock(&queueMutex);
+    pthread_join(consumer, NULL);
+    uint64_t elapsed = nowNanos() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long count = BENCH_PRODUCERS * allocations;
+    qsort(samples, count, sizeof(uint32_t), compareLatencies);
+    printf("  %-12s p50 %5u ns, p99 %6u ns, p99.9 %7u ns, max %8u ns; %.2f s; peak RSS %.1f MB\n",
+        allocatorNames[allocator], samples[count / 2], samples[count * 99 / 100], samples[count * 999 / 1000],
+        samples[count - 1], elapsed / 1e9, (usage.ru_maxrss - (long)(count * sizeof(uint32_t) / 1024)) / 1024.0);
+    free(samples);
+}
+
+int main(int argc, char** args)
+{
+    allocations = (argc > 1) ? atol(args[1]) : BENCH_DEFAULT_ALLOCATIONS;
+    if (allocations <= 0) {
+        fprintf(stderr, "Usage: %s [allocations per producer]\n", args[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d producers, 1 consumer, %ld allocations each of %d to %d bytes; peak RSS without the samples\n",
+        BENCH_PRODUCERS, allocations, BENCH_MIN_SIZE, BENCH_MAX_SIZE);
+    fflush(stdout);
+    for (int i = 0; i < ALLOCATOR_COUNT; i++) {
+        pid_t child = fork();
+        BENCH_CHECK(child >= 0);
+        if (child == 0) {
+            allocator = i;
+            run();
+            return EXIT_SUCCESS;
+        }
+        int status;
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../list.h"
+
+// Times the specialized searches against List_search with the equivalent comparator. A list
+// of LIST_MAX_NUM_NODES items is searched for its last item, so every search walks the whole
+// list; results are reported per item walked. Run with the number of searches per
+// measurement, default BENCH_DEFAULT_ROUNDS.
+
+#define BENCH_DEFAULT_ROUNDS 20000
+
+// Each measurement is repeated, and the fastest repetition reported, to ignore interference
+#define BENCH_REPEATS 5
+
+static char strings[LIST_MAX_NUM_NODES][16];
+
+// Keeps the compiler from dropping searches whose result is unused
+static volatile uintptr_t sink;
+
+// Returns the current monotonic time in nanoseconds
+static uint64_t nowNanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Comparators equivalent to the specialized searches
+static bool samePointer(void* pItem, void* pComparisonArg)
+{
+    return pItem == pComparisonArg;
+}
+
+static bool sameString(void* pItem, void* pComparisonArg)
+{
+    return strcmp(pItem, pComparisonArg) == 0;
+}
+
+static int samePointerBatch(void** pItems, int count, void* pComparisonArg)
+{
+    for (int i = 0; i < count; i++) {
+        if (pItems[i] == pComparisonArg) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+enum Search {SEARCH_POINTER_GENERIC, SEARCH_POINTER, SEARCH_STRING_GENERIC, SEARCH_STRING, SEARCH_BATCH, SEARCH_COUNT};
+
+static const char* searchNames[SEARCH_COUNT] = {
+    "List_search, pointer comparator",
+    "List_searchPointer",
+    "List_search, string comparator",
+    "List_searchString",
+    "List_searchBatch, pointer comparator",
+};
+
+// Run rounds searches of pList for pTarget, its last item
+// Returns the nanoseconds taken
+static uint64_t timeSearches(List* pList, enum Search search, void* pTarget, long rounds)
+{
+    uint64_t start = nowNanos();
+    for (long round = 0; round < rounds; round++) {
+        List_first(pList);
+        void* pFound = NULL;
+        if (search == SEARCH_POINTER_GENERIC) {
+            pFound = List_search(pList, samePointer, pTarget);
+        }
+        else if (search == SEARCH_POINTER) {
+            pFound = List_searchPointer(pList, pTarget);
+        }
+        else if (search == SEARCH_STRING_GENERIC) {
+            pFound = List_search(pList, sameString, pTarget);
+        }
+        else if (search == SEARCH_STRING) {
+            pFound = List_searchString(pList, pTarget, false);
+        }
+        else {
+            pFound = List_searchBatch(pList, samePointerBatch, pTarget);
+        }
+        sink += (uintptr_t)pFound;
+    }
+    return nowNanos() - start;
+}
+
+int main(int argc, char** args)
+{
+    long rounds = (argc > 1) ? atol(args[1]) : BENCH_DEFAULT_ROUNDS;
+    if (rounds <= 0) {
+        fprintf(stderr, "Usage: %s [searches per measurement]\n", args[0]);
+        return EXIT_FAILURE;
+    }
+
+    List* pList = List_create();
+    for (int i = 0; i < LIST_MAX_NUM_NODES; i++) {
+        snprintf(strings[i], sizeof(strings[i]), "item%d", i);
+        if ((pList == NULL) || (List_append(pList, strings[i]) != 0)) {
+            fprintf(stderr, "Failed to build the list\n");
+            return EXIT_FAILURE;
+        }
+    }
+    void* pTarget = strings[LIST_MAX_NUM_NODES - 1];
+
+#ifdef LIST_ARRAY_BACKEND
+    printf("Array backend, %d items, %ld searches per measurement\n", LIST_MAX_NUM_NODES, rounds);
+#else
+    printf("Linked backend, %d items, %ld searches per measurement\n", LIST_MAX_NUM_NODES, rounds);
+#endif
+    // Each specialized search is compared with List_search using the same kind of comparator
+    static const enum Search baselines[SEARCH_COUNT] = {
+        SEARCH_POINTER_GENERIC, SEARCH_POINTER_GENERIC, SEARCH_STRING_GENERIC, SEARCH_STRING_GENERIC, SEARCH_POINTER_GENERIC
+    };
+    double perItem[SEARCH_COUNT];
+    for (int search = 0; search < SEARCH_COUNT; search++) {
+        uint64_t best = UINT64_MAX;
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+            uint64_t elapsed = timeSearches(pList, search, pTarget, rounds);
+            if (elapsed < best) {
+                best = elapsed;
+            }
+        }
+        perItem[search] = (double)best / rounds / LIST_MAX_NUM_NODES;
+        printf("  %-38s %6.3f ns/item", searchNames[search], perItem[search]);
+        if (baselines[search] != search) {
+            printf(", %.1fx List_search", perItem[baselines[search]] / perItem[search]);
+        }
+        printf("\n");
+    }
+    List_free(pList, NULL);
+    return EXIT_SUCCESS;
+}
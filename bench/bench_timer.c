@@ -0,0 +1,227 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+// Built together with the wheel, so ticks can be driven here instead of by the tick thread
+#include "../timer.c"
+
+// Checks the timer wheel against a model, then times its operations. The model check runs
+// random schedule, reschedule, cancel and tick steps over BENCH_TIMERS timers, some of which
+// schedule themselves again from their callback, and checks that every timer fires exactly
+// on the tick it is due and never after being cancelled. Delays cover every level of the
+// wheel, and the clamp beyond it. Run with the number of model steps, default
+// BENCH_DEFAULT_STEPS.
+
+#define BENCH_DEFAULT_STEPS 3000000
+#define BENCH_TIMERS 4096
+
+// Timers scheduled for the timing runs
+#define BENCH_TIMED_TIMERS 1000000
+
+#define BENCH_CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: Property failed: %s\n", __FILE__, __LINE__, #condition); \
+            abort(); \
+        } \
+    } while (0)
+
+// What a timer should do: whether it is scheduled, on which tick it fires, and whether its
+// callback schedules it again
+typedef struct Model_s Model;
+struct Model_s {
+    bool scheduled;
+    uint64_t expiry;
+    bool repeats;
+};
+
+static Timer timers[BENCH_TIMERS];
+static Model models[BENCH_TIMERS];
+static uint64_t randomState = 1;
+static long fired = 0;
+
+// Returns the next number of the xorshift generator
+static uint64_t nextRandom()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+// Returns the current monotonic time in nanoseconds
+static uint64_t nowNanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Returns a delay in milliseconds due on a random level of the wheel, or past its range
+static uint32_t randomDelay()
+{
+    int bits = nextRandom() % (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS + 2);
+    return nextRandom() % ((uint64_t)TIMER_TICK_MS << bits);
+}
+
+// Returns the tick a timer scheduled now with delayMs is due on, as Timer_schedule() files it
+static uint64_t dueTick(uint32_t delayMs)
+{
+    uint64_t ticks = (delayMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    if (ticks > TIMER_MAX_TICKS) {
+        ticks = TIMER_MAX_TICKS;
+    }
+    return currentTick + ticks - 1;
+}
+
+static void fire(Timer* pTimer, void* pArg);
+
+// Schedule the index'th timer with a random delay, in the wheel and in the model
+static void scheduleRandom(int index)
+{
+    uint32_t delay = randomDelay();
+    models[index].scheduled = true;
+    models[index].expiry = dueTick(delay);
+    models[index].repeats = (nextRandom() % 4) == 0;
+    Timer_schedule(&timers[index], delay, fire, &models[index]);
+}
+
+// Callback of the model check: the timer must be due on the tick just run
+static void fire(Timer* pTimer, void* pArg)
+{
+    Model* pModel = pArg;
+    BENCH_CHECK(pModel == &models[pTimer - timers]);
+    BENCH_CHECK(pModel->scheduled);
+    BENCH_CHECK(pModel->expiry == currentTick - 1);
+    BENCH_CHECK(!pTimer->scheduled);
+    pModel->scheduled = false;
+    fired++;
+    if (pModel->repeats) {
+        scheduleRandom(pTimer - timers);
+    }
+}
+
+// Tick until every timer fired, checking none is left scheduled
+static void drain()
+{
+    for (int i = 0; i < BENCH_TIMERS; i++) {
+        models[i].repeats = false;
+    }
+    for (uint64_t i = 0; i <= TIMER_MAX_TICKS + TIMER_WHEEL_SLOTS; i++) {
+        tick();
+    }
+    for (int i = 0; i < BENCH_TIMERS; i++) {
+        BENCH_CHECK(!models[i].scheduled);
+        BENCH_CHECK(!timers[i].scheduled);
+    }
+}
+
+// Run steps random steps against the model, then drain the wheel
+static void checkModel(long steps)
+{
+    long scheduled = 0;
+    long cancelled = 0;
+    long ticks = 0;
+    for (long step = 0; step < steps; step++) {
+        int index = nextRandom() % BENCH_TIMERS;
+        int operation = nextRandom() % 8;
+        if (operation < 4) {
+            scheduleRandom(index);
+            scheduled++;
+        }
+        else if (operation < 6) {
+            Timer_cancel(&timers[index]);
+            models[index].scheduled = false;
+            cancelled++;
+        }
+        else {
+            // Mostly single ticks, sometimes a jump across several slots of level 1
+            int count = (nextRandom() % 16 == 0) ? (int)(nextRandom() % (4 * TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS)) : 1;
+            for (int i = 0; i < count; i++) {
+                tick();
+            }
+            ticks += count;
+        }
+        BENCH_CHECK(timers[index].scheduled == models[index].scheduled);
+    }
+    drain();
+    printf("Model check: %ld schedules, %ld cancels, %ld ticks, %ld timers fired on time\n", scheduled, cancelled, ticks, fired);
+}
+
+// Callback of the timing runs
+static void countFiring(Timer* pTimer, void* pArg)
+{
+    fired++;
+}
+
+// Time scheduling, rescheduling, cancelling and ticking BENCH_TIMED_TIMERS timers
+static void timeOperations()
+{
+    Timer* pTimers = calloc(BENCH_TIMED_TIMERS, sizeof(Timer));
+    uint32_t* delays = malloc(BENCH_TIMED_TIMERS * sizeof(uint32_t));
+    BENCH_CHECK((pTimers != NULL) && (delays != NULL));
+    for (int i = 0; i < BENCH_TIMED_TIMERS; i++) {
+        delays[i] = randomDelay();
+    }
+
+    uint64_t start = nowNanos();
+    for (int i = 0; i < BENCH_TIMED_TIMERS; i++) {
+        Timer_schedule(&pTimers[i], delays[i], countFiring, NULL);
+    }
+    uint64_t scheduleNanos = nowNanos() - start;
+
+    start = nowNanos();
+    for (int i = 0; i < BENCH_TIMED_TIMERS; i++) {
+        Timer_schedule(&pTimers[i], delays[BENCH_TIMED_TIMERS - 1 - i], countFiring, NULL);
+    }
+    uint64_t rescheduleNanos = nowNanos() - start;
+
+    // A second of ticks with every timer pending
+    fired = 0;
+    int tickCount = 1000 / TIMER_TICK_MS;
+    start = nowNanos();
+    for (int i = 0; i < tickCount; i++) {
+        tick();
+    }
+    uint64_t tickNanos = nowNanos() - start;
+
+    // The same with every timer an hour or more away, so a tick only cascades
+    for (int i = 0; i < BENCH_TIMED_TIMERS; i++) {
+        Timer_schedule(&pTimers[i], 3600000 + delays[i] % 3600000, countFiring, NULL);
+    }
+    start = nowNanos();
+    for (int i = 0; i < tickCount; i++) {
+        tick();
+    }
+    uint64_t idleTickNanos = nowNanos() - start;
+
+    start = nowNanos();
+    for (int i = 0; i < BENCH_TIMED_TIMERS; i++) {
+        Timer_cancel(&pTimers[i]);
+    }
+    uint64_t cancelNanos = nowNanos() - start;
+
+    printf("%d timers: schedule %.1f ns, reschedule %.1f ns, cancel %.1f ns each\n", BENCH_TIMED_TIMERS,
+        (double)scheduleNanos / BENCH_TIMED_TIMERS, (double)rescheduleNanos / BENCH_TIMED_TIMERS,
+        (double)cancelNanos / BENCH_TIMED_TIMERS);
+    printf("Tick with all of them pending: %.1f us firing %ld in %d ticks, %.0f ns with none due\n",
+        tickNanos / 1000.0 / tickCount, fired, tickCount, (double)idleTickNanos / tickCount);
+    free(delays);
+    free(pTimers);
+}
+
+int main(int argc, char** args)
+{
+    long steps = (argc > 1) ? atol(args[1]) : BENCH_DEFAULT_STEPS;
+    if (steps < 0) {
+        fprintf(stderr, "Usage: %s [model steps]\n", args[0]);
+        return EXIT_FAILURE;
+    }
+    checkModel(steps);
+    timeOperations();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# Measures message latency through an s-talk relay. Starts ./s-talk with the given options
+# in relay mode, has loadgen send it LATENCY_PEERS x LATENCY_RATE messages per second for
+# LATENCY_SECONDS seconds, and prints the latency distribution of the relayed messages.
+# Run from the repository root after make, e.g.
+#   bench/latency.sh --pin receiver=2 --fifo receiver=50
+PORT=${LATENCY_PORT:-7000}
+PEERS=${LATENCY_PEERS:-4}
+RATE=${LATENCY_RATE:-250}
+SECONDS_SENT=${LATENCY_SECONDS:-10}
+
+(sleep $((SECONDS_SENT + 4)); echo '!') | ./s-talk "$@" --relay "$PORT" localhost $((PORT + 1)) >/dev/null 2>&1 &
+sleep 1
+./loadgen --peers "$PEERS" --rate "$RATE" --size 64-256 --duration "$SECONDS_SENT" --seed "${LATENCY_SEED:-1}" localhost "$PORT" | grep -E "^(Received|Latency)"
+wait
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Measures one-way latency between two s-talk instances on this host with --trace. The
+# receiving instance runs with the given options; the sending one types TRACE_MESSAGES lines,
+# TRACE_GAP seconds apart. Prints the receiver's span histogram summary; the wire span
+# compares the two ends' clocks, which is sound on one host.
+# Run from the repository root after make, e.g.
+#   bench/trace.sh --busy-poll
+PORT=${TRACE_PORT:-6101}
+MESSAGES=${TRACE_MESSAGES:-300}
+GAP=${TRACE_GAP:-0.02}
+DIRECTORY=$(mktemp -d)
+
+# The sender's closing "!" ends both
+./s-talk --no-shm --trace "$DIRECTORY/receiver.trace" "$@" $((PORT + 1)) localhost "$PORT" </dev/null >"$DIRECTORY/receiver.out" 2>&1 &
+sleep 0.3
+(sleep 0.5; i=0; while [ $i -lt "$MESSAGES" ]; do i=$((i + 1)); echo "message $i"; sleep "$GAP"; done; echo '!') \
+    | ./s-talk --no-shm --trace "$DIRECTORY/sender.trace" "$PORT" localhost $((PORT + 1)) >/dev/null 2>&1
+wait
+grep -E "^  (span|wire|receive|receive queue|stdout write) " "$DIRECTORY/receiver.out"
+rm -rf "$DIRECTORY"
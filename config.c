@@ -0,0 +1,184 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "config.h"
+#include "general.h"
+#include "list.h"
+#include "log.h"
+
+Settings Config_settings = {
+    .receiveBufferBytes = 0,
+    .sendBufferBytes = 0,
+    .batchSize = MSG_BATCH_SIZE,
+    .sendRate = 0,
+    .sendQueueCapacity = LIST_MAX_NUM_NODES,
+    .receiveQueueCapacity = LIST_MAX_NUM_NODES,
+    .peerRate = 0,
+    .peerShare = 100,
+    .maxFileMegabytes = 1024,
+    .reportSeconds = 0
+};
+
+static atomic_bool socketReady = false;
+
+// Parses a whole decimal number between min and max
+// Returns 0 on success, -1 if value is not one
+static int parseInteger(const char* value, int min, int max, int* pInteger)
+{
+    if (value == NULL) {
+        return -1;
+    }
+    char* pEnd;
+    long integer = strtol(value, &pEnd, 10);
+    if ((pEnd == value) || (*pEnd != 0) || (integer < min) || (integer > max)) {
+        return -1;
+    }
+    *pInteger = integer;
+    return 0;
+}
+
+// Set the socket buffer given by option to bytes, unless it is 0
+static void applySocketBuffer(int option, int bytes)
+{
+    if ((bytes > 0) && socketReady) {
+        // The kernel caps this at net.core.rmem_max or net.core.wmem_max
+        setsockopt(socketDescriptor, SOL_SOCKET, option, &bytes, sizeof(bytes));
+    }
+}
+
+// Set the tunable called name to value
+int Config_set(const char* name, const char* value)
+{
+    int integer;
+    if (strcmp(name, "rcvbuf") == 0) {
+        if (parseInteger(value, 0, 1 << 30, &integer) != 0) {
+            return -1;
+        }
+        Config_settings.receiveBufferBytes = integer;
+        applySocketBuffer(SO_RCVBUF, integer);
+    }
+    else if (strcmp(name, "sndbuf") == 0) {
+        if (parseInteger(value, 0, 1 << 30, &integer) != 0) {
+            return -1;
+        }
+        Config_settings.sendBufferBytes = integer;
+        applySocketBuffer(SO_SNDBUF, integer);
+    }
+    else if (strcmp(name, "batch") == 0) {
+        if (parseInteger(value, 1, MSG_BATCH_SIZE, &integer) != 0) {
+            return -1;
+        }
+        Config_settings.batchSize = integer;
+    }
+    else if (strcmp(name, "rate") == 0) {
+        if (parseInteger(value, 0, 1000000, &integer) != 0) {
+            return -1;
+        }
+        Config_settings.sendRate = integer;
+    }
+    else if (strcmp(name, "send-queue") == 0) {
+        if (parseInteger(value, 1, LIST_MAX_NUM_NODES, &integer) != 0) {
+            return -1;
+        }
+        Config_settings.sendQueueCapacity = integer;
+    }
+    else if (strcmp(name, "receive-queue") == 0) {
+        if (parseInteger(value, 1, LIST_MAX_NUM_NODES, &integer) != 0) {
+            return -1;
+        }
+        Config_settings.receiveQueueCapacity = integer;
+    }
+    else if (strcmp(name, "peer-rate") == 0) {
+        if (parseInteger(value, 0, 1000000, &integer) != 0) {
+            return -1;
+        }
+        Config_settings.peerRate = integer;
+    }
+    else if (strcmp(name, "peer-share") == 0) {
+        if (parseInteger(value, 1, 100, &integer) != 0) {
+            return -1;
+        }
+        Config_settings.peerShare = integer;
+    }
+    else if (strcmp(name, "max-file") == 0) {
+        if (parseInteger(value, 0, 1 << 20, &integer) != 0) {
+            return -1;
+        }
+        Config_settings.maxFileMegabytes = integer;
+    }
+    else if (strcmp(name, "report") == 0) {
+        if (parseInteger(value, 0, 86400, &integer) != 0) {
+            return -1;
+        }
+        Config_settings.reportSeconds = integer;
+    }
+    else {
+        return 1;
+    }
+    return 0;
+}
+
+// Write "name value" lines for every tunable to buffer
+void Config_describe(char* buffer, int size)
+{
+    int receiveBuffer = 0;
+    int sendBuffer = 0;
+    socklen_t optionLength = sizeof(int);
+    getsockopt(socketDescriptor, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, &optionLength);
+    optionLength = sizeof(int);
+    getsockopt(socketDescriptor, SOL_SOCKET, SO_SNDBUF, &sendBuffer, &optionLength);
+    snprintf(buffer, size, "rcvbuf %d\nsndbuf %d\nbatch %d\nrate %d\nsend-queue %d\nreceive-queue %d\npeer-rate %d\npeer-share %d\nmax-file %d\nreport %d\n",
+        receiveBuffer, sendBuffer, Config_settings.batchSize, Config_settings.sendRate,
+        Config_settings.sendQueueCapacity, Config_settings.receiveQueueCapacity,
+        Config_settings.peerRate, Config_settings.peerShare,
+        Config_settings.maxFileMegabytes, Config_settings.reportSeconds);
+}
+
+// Read the configuration file at path, passing every option to apply()
+int Config_load(const char* path, int (*apply)(const char* name, const char* value))
+{
+    FILE* pFile = fopen(path, "r");
+    if (pFile == NULL) {
+        Log_write(LOG_ERROR, "Config Error: Failed to open the configuration file\n");
+        return -1;
+    }
+    char line[256];
+    int lineNumber = 0;
+    int result = 0;
+    while ((result == 0) && (fgets(line, sizeof(line), pFile) != NULL)) {
+        lineNumber++;
+        char* name = line + strspn(line, " \t");
+        name[strcspn(name, "\r\n")] = 0;
+        if ((*name == 0) || (*name == '#')) {
+            continue;
+        }
+        // The name ends at a space or '='; the value follows, trimmed
+        char* value = name + strcspn(name, " \t=");
+        if (*value != 0) {
+            *value++ = 0;
+            value += strspn(value, " \t=");
+            size_t length = strlen(value);
+            while ((length > 0) && ((value[length - 1] == ' ') || (value[length - 1] == '\t'))) {
+                value[--length] = 0;
+            }
+        }
+        result = apply(name, (*value != 0) ? value : NULL);
+        if (result != 0) {
+            char error[64];
+            snprintf(error, sizeof(error), "Config Error: Invalid option on line %d\n", lineNumber);
+            Log_write(LOG_ERROR, error);
+        }
+    }
+    fclose(pFile);
+    return result;
+}
+
+// Apply the configured socket buffer sizes
+void Config_applySocketBuffers()
+{
+    socketReady = true;
+    applySocketBuffer(SO_RCVBUF, Config_settings.receiveBufferBytes);
+    applySocketBuffer(SO_SNDBUF, Config_settings.sendBufferBytes);
+}
@@ -0,0 +1,61 @@
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+#include <stdatomic.h>
+
+// Tunables that used to be fixed at compile time. They start at their defaults, are set by
+// the configuration file, then by the command line, and the ones marked runtime can be
+// changed through the control socket (see control.h) while messages flow.
+//
+// The configuration file holds one option per line, named as on the command line without
+// the leading "--": "name value" or "name = value", or just "name" for options without a
+// value. Blank lines and lines starting with '#' are ignored, e.g.
+//   rcvbuf = 8388608
+//   pin sender=2
+//   busy-poll
+//
+// The list backend is still chosen at build time (make LIST_BACKEND=array), since both
+// backends provide the same functions.
+
+typedef struct Settings_s Settings;
+struct Settings_s {
+    // Socket receive and send buffer sizes in bytes; 0 keeps the system default (runtime).
+    // An explicit receive buffer replaces the one Transfer_init() sizes for file transfers.
+    atomic_int receiveBufferBytes;
+    atomic_int sendBufferBytes;
+    // Messages taken off a list at once, up to MSG_BATCH_SIZE (runtime)
+    atomic_int batchSize;
+    // Most messages sent per second, 0 for no limit (runtime)
+    atomic_int sendRate;
+    // Most messages waiting on the send and receive lists, up to LIST_MAX_NUM_NODES (runtime);
+    // more are dropped
+    atomic_int sendQueueCapacity;
+    atomic_int receiveQueueCapacity;
+    // Most chat messages received per second from one source, 0 for no limit, and the
+    // percentage of the receive queue one source may fill (runtime); see flow.h
+    atomic_int peerRate;
+    atomic_int peerShare;
+    // Largest file accepted from the remote user, in megabytes (runtime)
+    atomic_int maxFileMegabytes;
+    // Seconds between logs of the sources that sent the most, 0 for none (runtime)
+    atomic_int reportSeconds;
+};
+extern Settings Config_settings;
+
+// Set the tunable called name to value, checking it is in range; socket buffers are applied
+// at once if the socket exists
+// Returns 0 on success, -1 if value is out of range, 1 if name is not a tunable
+int Config_set(const char* name, const char* value);
+
+// Write "name value" lines for every tunable to buffer, reading the socket buffers back from
+// the kernel, which may have capped or doubled them
+void Config_describe(char* buffer, int size);
+
+// Read the configuration file at path, passing every option to apply(name, value), with
+// value NULL for options without one
+// Returns 0 on success, -1 if the file cannot be read or apply() fails on a line
+int Config_load(const char* path, int (*apply)(const char* name, const char* value));
+
+// Apply the configured socket buffer sizes, once the socket exists and after Transfer_init()
+void Config_applySocketBuffers();
+
+#endif
@@ -0,0 +1,138 @@
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "config.h"
+#include "control.h"
+#include "flow.h"
+#include "general.h"
+#include "log.h"
+
+// Milliseconds a connection gets to send its command
+#define CONTROL_READ_TIMEOUT_MS 1000
+
+static pthread_t threadPID;
+static bool started = false;
+static int listenDescriptor = -1;
+static struct sockaddr_un address;
+
+// Read one command line from connection into line
+// Returns 0 on success, -1 if none arrived in time
+static int readCommand(int connection, char* line, int size)
+{
+    int length = 0;
+    struct pollfd fd = {.fd = connection, .events = POLLIN};
+    while ((length < size - 1) && (poll(&fd, 1, CONTROL_READ_TIMEOUT_MS) > 0)) {
+        int bytesRead = read(connection, &line[length], size - 1 - length);
+        if (bytesRead <= 0) {
+            break;
+        }
+        length += bytesRead;
+        if (memchr(line, '\n', length) != NULL) {
+            break;
+        }
+    }
+    line[length] = 0;
+    line[strcspn(line, "\r\n")] = 0;
+    return (length > 0) ? 0 : -1;
+}
+
+// Run command and write its reply to reply
+static void runCommand(char* command, char* reply, int size)
+{
+    char* pSave;
+    char* verb = strtok_r(command, " \t", &pSave);
+    char* name = strtok_r(NULL, " \t", &pSave);
+    char* value = strtok_r(NULL, " \t", &pSave);
+    if ((verb != NULL) && (strcmp(verb, "get") == 0) && (name == NULL)) {
+        Config_describe(reply, size);
+        return;
+    }
+    if ((verb != NULL) && (strcmp(verb, "top") == 0) && (name == NULL)) {
+        Flow_describe(reply, size);
+        return;
+    }
+    if ((verb == NULL) || (strcmp(verb, "set") != 0) || (name == NULL) || (value == NULL)) {
+        snprintf(reply, size, "error: expected \"get\", \"set NAME VALUE\" or \"top\"\n");
+        return;
+    }
+    int result = Config_set(name, value);
+    if (result == 0) {
+        snprintf(reply, size, "ok\n");
+    }
+    else if (result > 0) {
+        snprintf(reply, size, "error: %s is not a runtime tunable\n", name);
+    }
+    else {
+        snprintf(reply, size, "error: %s is out of range\n", value);
+    }
+}
+
+// Answers one command per connection until shutdown begins
+void* controlThread()
+{
+    while (General_waitForInput(listenDescriptor)) {
+        int connection = accept(listenDescriptor, NULL, NULL);
+        if (connection < 0) {
+            continue;
+        }
+        char command[CONTROL_LINE_LEN];
+        if (readCommand(connection, command, sizeof(command)) == 0) {
+            char reply[FLOW_TOP_N * FLOW_LINE_LEN];
+            runCommand(command, reply, sizeof(reply));
+            if (write(connection, reply, strlen(reply)) < 0) {
+                Log_write(LOG_ERROR, "Control Thread Error: Failed to reply to a command\n");
+            }
+        }
+        close(connection);
+    }
+    return NULL;
+}
+
+// Listen on a Unix socket at path and start background thread answering commands on it
+void Control_start(const char* path)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        Log_write(LOG_ERROR, "Control Thread Error: The control socket path is too long\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, path);
+    // A socket left by an earlier run would make bind() fail; anything else at path is kept
+    struct stat status;
+    if ((lstat(path, &status) == 0) && S_ISSOCK(status.st_mode)) {
+        unlink(path);
+    }
+    // Commands change how the program runs, so only this user may connect
+    listenDescriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t previousMask = umask(077);
+    int bound = (listenDescriptor == -1) ? -1 : bind(listenDescriptor, (struct sockaddr*)&address, sizeof(address));
+    umask(previousMask);
+    if ((bound != 0) || (chmod(path, 0600) != 0) || (listen(listenDescriptor, 8) != 0)) {
+        Log_write(LOG_ERROR, "Control Thread Error: Failed to listen on the control socket\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_create(&threadPID, NULL, controlThread, NULL) != 0) {
+        Log_write(LOG_ERROR, "Control Thread Error: Failed to create the control thread\n");
+        exit(EXIT_FAILURE);
+    }
+    started = true;
+}
+
+// Stop background thread and remove the socket
+void Control_shutdown()
+{
+    if (!started) {
+        return;
+    }
+    pthread_join(threadPID, NULL);
+    close(listenDescriptor);
+    unlink(address.sun_path);
+}
@@ -0,0 +1,22 @@
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+// Local control socket for tuning under load. Each connection to the Unix socket sends one
+// command line and reads the reply:
+//   get                 every tunable, one "name value" line each
+//   set NAME VALUE      change a runtime tunable of config.h; replies "ok" or "error ..."
+//   top                 the sources that sent the most bytes so far, one line each (see flow.h)
+// e.g. echo "set rate 500" | nc -U /tmp/s-talk.sock
+// The socket is only accessible to the user running s-talk. A socket left at its path by an
+// earlier run is replaced; any other file there is left alone and the program exits.
+
+// Longest command line
+#define CONTROL_LINE_LEN 256
+
+// Listen on a Unix socket at path and start background thread answering commands on it
+void Control_start(const char* path);
+
+// Stop background thread and remove the socket
+void Control_shutdown();
+
+#endif
@@ -0,0 +1,306 @@
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "flow.h"
+#include "general.h"
+#include "log.h"
+#include "peer.h"
+#include "timer.h"
+
+// Sources are kept in a table at most half full, as in peer.c
+#define FLOW_TABLE_SIZE (2 * FLOW_MAX_FLOWS)
+
+// Milliseconds between checks of the report interval, which may change at runtime
+#define FLOW_TICK_MS 1000
+
+// One message's worth of tokens
+#define FLOW_TOKEN 1000000
+
+typedef struct Counts_s Counts;
+struct Counts_s {
+    long datagrams;
+    long bytes;
+    long dropped;
+    long retransmits;
+};
+
+typedef struct Flow_s Flow;
+struct Flow_s {
+    bool used;
+    int index;
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+    Counts total;
+    // The totals when the last report was logged
+    Counts reported;
+    // Token bucket, in millionths of a message, and when it was last filled
+    uint64_t tokens;
+    uint64_t filledAt;
+    // Messages from the source on the receive list
+    int queued;
+};
+
+static Flow flows[FLOW_TABLE_SIZE];
+static int flowCount = 0;
+
+// Known sources in the order they first sent, and the entry counting the sources beyond them
+static Flow* known[FLOW_MAX_FLOWS];
+static Flow others = {.index = FLOW_MAX_FLOWS, .tokens = UINT64_MAX};
+static pthread_mutex_t flowMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static Timer reportTimer;
+static int secondsSinceReport = 0;
+
+// Returns the entry counting pSource, adding it if there is room
+// Must be called with flowMutex held
+static Flow* findFlow(const struct sockaddr* pSource, socklen_t sourceLength)
+{
+    uint32_t index = Peer_hashAddress(pSource) % FLOW_TABLE_SIZE;
+    while (flows[index].used && !Peer_sameAddress((struct sockaddr*)&flows[index].address, pSource)) {
+        index = (index + 1) % FLOW_TABLE_SIZE;
+    }
+    Flow* pFlow = &flows[index];
+    if (pFlow->used) {
+        return pFlow;
+    }
+    if (flowCount == FLOW_MAX_FLOWS) {
+        return &others;
+    }
+    pFlow->used = true;
+    memcpy(&pFlow->address, pSource, sourceLength);
+    pFlow->addressLength = sourceLength;
+    pFlow->tokens = UINT64_MAX;
+    pFlow->index = flowCount;
+    known[flowCount++] = pFlow;
+    return pFlow;
+}
+
+// Returns the entry with the given index
+// Must be called with flowMutex held
+static Flow* flowAt(int index)
+{
+    return (index < flowCount) ? known[index] : &others;
+}
+
+// Count a receive from pSource
+void Flow_record(const struct sockaddr* pSource, socklen_t sourceLength, int datagrams, int bytes, int dropped, int retransmits)
+{
+    pthread_mutex_lock(&flowMutex);
+    {
+        Flow* pFlow = findFlow(pSource, sourceLength);
+        pFlow->total.datagrams += datagrams;
+        pFlow->total.bytes += bytes;
+        pFlow->total.dropped += dropped;
+        pFlow->total.retransmits += retransmits;
+    }
+    pthread_mutex_unlock(&flowMutex);
+}
+
+// Take a token from pSource's bucket and, if the message is to be queued, check the source's
+// share of the receive queue
+int Flow_admit(const struct sockaddr* pSource, socklen_t sourceLength, bool queue)
+{
+    int rate = Config_settings.peerRate;
+    int share = Config_settings.receiveQueueCapacity * Config_settings.peerShare / 100;
+    if (share < 1) {
+        share = 1;
+    }
+    uint64_t now = (rate > 0) ? General_monotonicMicros() : 0;
+    int index = -1;
+    pthread_mutex_lock(&flowMutex);
+    {
+        Flow* pFlow = findFlow(pSource, sourceLength);
+        bool admitted = true;
+        if (rate > 0) {
+            // A full bucket holds a second's worth of messages
+            uint64_t capacity = (uint64_t)rate * FLOW_TOKEN;
+            uint64_t elapsed = now - pFlow->filledAt;
+            pFlow->filledAt = now;
+            if ((pFlow->tokens >= capacity) || (elapsed >= (capacity - pFlow->tokens) / rate)) {
+                pFlow->tokens = capacity;
+            }
+            else {
+                pFlow->tokens += elapsed * rate;
+            }
+            admitted = pFlow->tokens >= FLOW_TOKEN;
+        }
+        if (admitted && queue) {
+            admitted = pFlow->queued < share;
+        }
+        if (admitted) {
+            if (rate > 0) {
+                pFlow->tokens -= FLOW_TOKEN;
+            }
+            if (queue) {
+                pFlow->queued++;
+            }
+            index = pFlow->index;
+        }
+    }
+    pthread_mutex_unlock(&flowMutex);
+    return index;
+}
+
+// Count a message queued by Flow_admit() as taken off the receive queue
+void Flow_dequeued(int index)
+{
+    pthread_mutex_lock(&flowMutex);
+    {
+        Flow* pFlow = flowAt(index);
+        if (pFlow->queued > 0) {
+            pFlow->queued--;
+        }
+    }
+    pthread_mutex_unlock(&flowMutex);
+}
+
+// Returns the bytes pFlow sent since the last report, or since the start
+static long bytesOf(const Flow* pFlow, bool sinceReport)
+{
+    return pFlow->total.bytes - (sinceReport ? pFlow->reported.bytes : 0);
+}
+
+// Move the entry at index of the min-heap of count entries down to its place
+static void siftDown(Flow** heap, int count, int index, bool sinceReport)
+{
+    while (1) {
+        int smallest = index;
+        for (int child = 2 * index + 1; (child <= 2 * index + 2) && (child < count); child++) {
+            if (bytesOf(heap[child], sinceReport) < bytesOf(heap[smallest], sinceReport)) {
+                smallest = child;
+            }
+        }
+        if (smallest == index) {
+            return;
+        }
+        Flow* pSwap = heap[index];
+        heap[index] = heap[smallest];
+        heap[smallest] = pSwap;
+        index = smallest;
+    }
+}
+
+// Copy the FLOW_TOP_N sources that sent the most bytes since the last report, or since the
+// start, to top, busiest first. Sources that sent nothing are left out.
+// Must be called with flowMutex held
+// Returns the number of sources copied
+static int pickTop(bool sinceReport, Flow* top)
+{
+    Flow* heap[FLOW_TOP_N];
+    int count = 0;
+    for (int i = 0; i <= flowCount; i++) {
+        Flow* pFlow = (i < flowCount) ? known[i] : &others;
+        long bytes = bytesOf(pFlow, sinceReport);
+        if (bytes == 0) {
+            continue;
+        }
+        if (count < FLOW_TOP_N) {
+            // Sift the new entry up
+            int index = count++;
+            heap[index] = pFlow;
+            while ((index > 0) && (bytesOf(heap[(index - 1) / 2], sinceReport) > bytes)) {
+                heap[index] = heap[(index - 1) / 2];
+                heap[(index - 1) / 2] = pFlow;
+                index = (index - 1) / 2;
+            }
+        }
+        else if (bytes > bytesOf(heap[0], sinceReport)) {
+            heap[0] = pFlow;
+            siftDown(heap, count, 0, sinceReport);
+        }
+    }
+    // Taking the smallest off the heap each time fills top from the end
+    for (int remaining = count; remaining > 0; remaining--) {
+        top[remaining - 1] = *heap[0];
+        heap[0] = heap[remaining - 1];
+        siftDown(heap, remaining - 1, 0, sinceReport);
+    }
+    return count;
+}
+
+// Write a line describing the rank'th busiest source to line
+static void describeFlow(int rank, const Flow* pFlow, const Counts* pCounts, char* line, int size)
+{
+    char source[INET6_ADDRSTRLEN + 16] = "other sources";
+    char host[INET6_ADDRSTRLEN];
+    char port[8];
+    char rtt[32] = "";
+    if (pFlow->used) {
+        if (getnameinfo((struct sockaddr*)&pFlow->address, pFlow->addressLength, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+            strcpy(host, "?");
+            strcpy(port, "?");
+        }
+        snprintf(source, sizeof(source), "%s port %s", host, port);
+        uint64_t smoothedRtt, rttVariation, timeout;
+        if (Peer_getRtt((struct sockaddr*)&pFlow->address, pFlow->addressLength, &smoothedRtt, &rttVariation, &timeout) == 0) {
+            snprintf(rtt, sizeof(rtt), ", rtt %.1f ms", smoothedRtt / 1000.0);
+        }
+    }
+    snprintf(line, size, "#%d %s: %ld datagrams, %ld bytes, %ld dropped, %ld retransmits%s\n", rank, source,
+        pCounts->datagrams, pCounts->bytes, pCounts->dropped, pCounts->retransmits, rtt);
+}
+
+// Write the busiest sources since the start to buffer
+void Flow_describe(char* buffer, int size)
+{
+    Flow top[FLOW_TOP_N];
+    int count;
+    pthread_mutex_lock(&flowMutex);
+    {
+        count = pickTop(false, top);
+    }
+    pthread_mutex_unlock(&flowMutex);
+
+    int length = snprintf(buffer, size, "%s", (count == 0) ? "nothing received\n" : "");
+    for (int i = 0; (i < count) && (length < size); i++) {
+        describeFlow(i + 1, &top[i], &top[i].total, &buffer[length], size - length);
+        length += strlen(&buffer[length]);
+    }
+}
+
+// Runs on the timer thread every second: logs the busiest sources since the last report once
+// the report interval has passed
+static void report(Timer* pTimer, void* pArg)
+{
+    Timer_schedule(pTimer, FLOW_TICK_MS, report, pArg);
+    int interval = Config_settings.reportSeconds;
+    if ((interval == 0) || (++secondsSinceReport < interval)) {
+        return;
+    }
+    secondsSinceReport = 0;
+    Flow top[FLOW_TOP_N];
+    int count;
+    pthread_mutex_lock(&flowMutex);
+    {
+        count = pickTop(true, top);
+        for (int i = 0; i < flowCount; i++) {
+            known[i]->reported = known[i]->total;
+        }
+        others.reported = others.total;
+    }
+    pthread_mutex_unlock(&flowMutex);
+
+    for (int i = 0; i < count; i++) {
+        Counts counts = {
+            .datagrams = top[i].total.datagrams - top[i].reported.datagrams,
+            .bytes = top[i].total.bytes - top[i].reported.bytes,
+            .dropped = top[i].total.dropped - top[i].reported.dropped,
+            .retransmits = top[i].total.retransmits - top[i].reported.retransmits,
+        };
+        char line[FLOW_LINE_LEN];
+        describeFlow(i + 1, &top[i], &counts, line, sizeof(line));
+        char entry[FLOW_LINE_LEN + 32];
+        snprintf(entry, sizeof(entry), "Top source %s", line);
+        Log_write(LOG_INFO, entry);
+    }
+}
+
+// Start logging the top sources every report interval
+void Flow_start()
+{
+    Timer_schedule(&reportTimer, FLOW_TICK_MS, report, NULL);
+}
@@ -0,0 +1,48 @@
+#ifndef _FLOW_H_
+#define _FLOW_H_
+#include <stdbool.h>
+#include <sys/socket.h>
+
+// Receive statistics per source address: datagrams, bytes, drops and retransmits, counted by
+// the receive thread in an open-addressing hash table. Sources are never removed; once
+// FLOW_MAX_FLOWS are known, the rest are counted together as "other sources". Every report
+// interval (Config_settings.reportSeconds) the FLOW_TOP_N sources that sent the most bytes
+// since the last report are logged, with their round-trip time if they are registered peers.
+// They are picked with a min-heap of FLOW_TOP_N entries, so a report takes one pass over the
+// sources and allocates nothing.
+//
+// The same entries limit what each source may put through. Every chat message takes a token
+// from its source's bucket, refilled at Config_settings.peerRate per second up to a second's
+// worth, and a source may hold at most Config_settings.peerShare percent of the receive queue.
+// The receive thread checks both before copying a message, and drops it if either is
+// exhausted, so one flooding source cannot crowd the others out of the queue.
+
+#define FLOW_MAX_FLOWS 4096
+#define FLOW_TOP_N 5
+
+// Longest line of a report
+#define FLOW_LINE_LEN 144
+
+// Count a receive of datagrams datagrams and bytes bytes from pSource, of which dropped were
+// discarded and retransmits had already been accepted
+// Called from the receive thread
+void Flow_record(const struct sockaddr* pSource, socklen_t sourceLength, int datagrams, int bytes, int dropped, int retransmits);
+
+// Take a token from pSource's bucket for a chat message and, if queue is true, check that the
+// source is within its share of the receive queue and count the message as queued
+// Called from the receive thread
+// Returns the source's index, to pass to Flow_dequeued() once a queued message is taken off
+// the receive queue or dropped, or -1 if the message must be dropped
+int Flow_admit(const struct sockaddr* pSource, socklen_t sourceLength, bool queue);
+
+// Count a message admitted with queue true as no longer on the receive queue
+void Flow_dequeued(int index);
+
+// Write the FLOW_TOP_N sources that sent the most bytes since the program started to buffer,
+// one line each, busiest first
+void Flow_describe(char* buffer, int size);
+
+// Start logging the top sources every report interval, once the timer thread runs
+void Flow_start();
+
+#endif
@@ -0,0 +1,85 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fuzz.h"
+
+// Longest input read from a file or stdin, or generated
+#define DRIVER_MAX_INPUT (1 << 20)
+#define DRIVER_MAX_RANDOM 4096
+
+// Read all of descriptor into buffer
+// Returns the number of bytes read
+static size_t readAll(int descriptor, uint8_t* buffer)
+{
+    size_t length = 0;
+    ssize_t bytesRead;
+    while ((length < DRIVER_MAX_INPUT) && ((bytesRead = read(descriptor, &buffer[length], DRIVER_MAX_INPUT - length)) > 0)) {
+        length += bytesRead;
+    }
+    return length;
+}
+
+// Returns the next number of the xorshift generator with state *pState
+static uint64_t nextRandom(uint64_t* pState)
+{
+    *pState ^= *pState << 13;
+    *pState ^= *pState >> 7;
+    *pState ^= *pState << 17;
+    return *pState;
+}
+
+// Run runs random inputs from seed, each written to lastPath first so a crash can be replayed
+static void runRandom(long runs, uint64_t seed, const char* lastPath, uint8_t* buffer)
+{
+    uint64_t state = seed | 1;
+    for (long run = 0; run < runs; run++) {
+        size_t length = nextRandom(&state) % DRIVER_MAX_RANDOM;
+        for (size_t i = 0; i < length; i++) {
+            buffer[i] = (uint8_t)(nextRandom(&state) >> 24);
+        }
+        int descriptor = open(lastPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if ((descriptor >= 0) && (write(descriptor, buffer, length) < 0)) {
+            fprintf(stderr, "Fuzz Driver Error: Failed to save the input\n");
+        }
+        close(descriptor);
+        LLVMFuzzerTestOneInput(buffer, length);
+    }
+    unlink(lastPath);
+    fprintf(stderr, "%s: %ld random inputs from seed %llu passed\n", lastPath, runs, (unsigned long long)seed);
+}
+
+// Without libFuzzer:
+//   HARNESS -n RUNS [-s SEED]   run random inputs
+//   HARNESS FILE...             run each file, e.g. a crash or corpus entry, or AFL's @@
+//   HARNESS                     run stdin, for AFL
+int main(int argc, char** args)
+{
+    uint8_t* buffer = malloc(DRIVER_MAX_INPUT);
+    if (buffer == NULL) {
+        return EXIT_FAILURE;
+    }
+    if ((argc >= 3) && (strcmp(args[1], "-n") == 0)) {
+        uint64_t seed = ((argc >= 5) && (strcmp(args[3], "-s") == 0)) ? strtoull(args[4], NULL, 10) : 1;
+        char lastPath[256];
+        snprintf(lastPath, sizeof(lastPath), "%s.last", args[0]);
+        runRandom(atol(args[2]), seed, lastPath, buffer);
+    }
+    else if (argc == 1) {
+        LLVMFuzzerTestOneInput(buffer, readAll(STDIN_FILENO, buffer));
+    }
+    for (int i = 1; (i < argc) && (strcmp(args[1], "-n") != 0); i++) {
+        int descriptor = open(args[i], O_RDONLY);
+        if (descriptor < 0) {
+            fprintf(stderr, "Fuzz Driver Error: Failed to open %s\n", args[i]);
+            continue;
+        }
+        size_t length = readAll(descriptor, buffer);
+        close(descriptor);
+        LLVMFuzzerTestOneInput(buffer, length);
+    }
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef _FUZZ_H_
+#define _FUZZ_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Fuzz harnesses. Each defines the libFuzzer entry point below, and is built either with
+// -fsanitize=fuzzer, or with driver.c, which feeds it files, stdin (for AFL) or random inputs.
+
+// Run one input; returns 0
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+// Report a property that does not hold and abort, so the fuzzer keeps the input
+#define FUZZ_CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: Property failed: %s\n", __FILE__, __LINE__, #condition); \
+            abort(); \
+        } \
+    } while (0)
+
+#endif
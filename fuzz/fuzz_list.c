@@ -0,0 +1,409 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "../list.h"
+#include "fuzz.h"
+
+// Runs the operation sequence an input encodes against the List API and a reference model,
+// checking after every operation that their counts and current items agree. Each operation
+// is three bytes: the operation, the list it applies to, and an argument. Walking a list to
+// compare every item is an operation of its own, so a wrong position is not hidden by walks
+// after every step. At the end every list is walked and freed, and the whole pool must be
+// available again.
+
+// Items are the strings of tokens, so string searches have prefixes to find
+#define TOKEN_COUNT 64
+static char tokens[TOKEN_COUNT][4];
+
+enum ModelState {MODEL_BEFORE, MODEL_WITHIN, MODEL_BEYOND};
+
+// What a list should hold: its items as token numbers, and where its current item is
+typedef struct Model_s Model;
+struct Model_s {
+    List* pList;
+    int size;
+    int items[LIST_MAX_NUM_NODES];
+    int current;
+    enum ModelState state;
+};
+
+enum Operation {
+    OP_CREATE, OP_FIRST, OP_LAST, OP_NEXT, OP_PREV, OP_ADD, OP_INSERT, OP_APPEND, OP_PREPEND,
+    OP_REMOVE, OP_CONCAT, OP_FREE, OP_TRIM, OP_PREPEND_MANY, OP_DRAIN,
+    OP_SEARCH, OP_SEARCH_POINTER, OP_SEARCH_STRING, OP_SEARCH_BATCH, OP_WALK, OP_COUNT
+};
+
+static Model models[LIST_MAX_NUM_HEADS];
+static int itemsInUse = 0;
+static bool tokensReady = false;
+
+// Returns the item of token number token
+static void* itemOf(int token)
+{
+    return tokens[token];
+}
+
+// Returns the item at index of pModel
+static void* modelItem(const Model* pModel, int index)
+{
+    return itemOf(pModel->items[index]);
+}
+
+// Returns the current item of pModel, or NULL if there is none
+static void* modelCurrent(const Model* pModel)
+{
+    return (pModel->state == MODEL_WITHIN) ? modelItem(pModel, pModel->current) : NULL;
+}
+
+// Insert token at index of pModel and make it the current item
+static void modelInsertAt(Model* pModel, int index, int token)
+{
+    memmove(&pModel->items[index + 1], &pModel->items[index], sizeof(int) * (pModel->size - index));
+    pModel->items[index] = token;
+    pModel->size++;
+    pModel->current = index;
+    pModel->state = MODEL_WITHIN;
+    itemsInUse++;
+}
+
+// Take the item at index out of pModel
+static void modelRemoveAt(Model* pModel, int index)
+{
+    memmove(&pModel->items[index], &pModel->items[index + 1], sizeof(int) * (pModel->size - index - 1));
+    pModel->size--;
+    itemsInUse--;
+}
+
+// Check the count and current item of pModel's list
+static void checkList(const Model* pModel)
+{
+    FUZZ_CHECK(List_count(pModel->pList) == pModel->size);
+    FUZZ_CHECK(List_curr(pModel->pList) == modelCurrent(pModel));
+}
+
+// Check that pModel's list holds the items of pModel, and walk it back to where it was
+static void walkList(const Model* pModel)
+{
+    List* pList = pModel->pList;
+    checkList(pModel);
+    if (pModel->size == 0) {
+        return;
+    }
+    FUZZ_CHECK(List_first(pList) == modelItem(pModel, 0));
+    for (int i = 1; i < pModel->size; i++) {
+        FUZZ_CHECK(List_next(pList) == modelItem(pModel, i));
+    }
+    FUZZ_CHECK(List_next(pList) == NULL);
+    // Walk back to where the list was
+    if (pModel->state == MODEL_BEFORE) {
+        List_first(pList);
+        FUZZ_CHECK(List_prev(pList) == NULL);
+    }
+    else if (pModel->state == MODEL_WITHIN) {
+        FUZZ_CHECK(List_prev(pList) == modelItem(pModel, pModel->size - 1));
+        for (int i = pModel->size - 2; i >= pModel->current; i--) {
+            FUZZ_CHECK(List_prev(pList) == modelItem(pModel, i));
+        }
+    }
+    FUZZ_CHECK(List_curr(pList) == modelCurrent(pModel));
+}
+
+// Add token to pModel as List_add, List_insert, List_append or List_prepend would
+static void addItem(Model* pModel, enum Operation operation, int token)
+{
+    int result;
+    switch (operation) {
+    case OP_ADD:
+        result = List_add(pModel->pList, itemOf(token));
+        break;
+    case OP_INSERT:
+        result = List_insert(pModel->pList, itemOf(token));
+        break;
+    case OP_APPEND:
+        result = List_append(pModel->pList, itemOf(token));
+        break;
+    default:
+        result = List_prepend(pModel->pList, itemOf(token));
+        break;
+    }
+    if (itemsInUse == LIST_MAX_NUM_NODES) {
+        FUZZ_CHECK(result == -1);
+        return;
+    }
+    FUZZ_CHECK(result == 0);
+    int index;
+    if (operation == OP_APPEND) {
+        index = pModel->size;
+    }
+    else if (operation == OP_PREPEND) {
+        index = 0;
+    }
+    else if (pModel->state == MODEL_BEFORE) {
+        index = 0;
+    }
+    else if (pModel->state == MODEL_BEYOND) {
+        index = pModel->size;
+    }
+    else {
+        index = (operation == OP_ADD) ? pModel->current + 1 : pModel->current;
+    }
+    modelInsertAt(pModel, index, token);
+}
+
+// Returns true if item is token number *pArg
+static bool matchesToken(void* pItem, void* pArg)
+{
+    return pItem == itemOf(*(int*)pArg);
+}
+
+// Returns the index of the first of count items that is token number *pArg, or -1
+static int matchesTokenBatch(void** pItems, int count, void* pArg)
+{
+    for (int i = 0; i < count; i++) {
+        if (pItems[i] == itemOf(*(int*)pArg)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Search pModel's list with the search operation for token, or for items starting with it
+static void searchItem(Model* pModel, enum Operation operation, int token, bool prefix)
+{
+    void* pFound;
+    switch (operation) {
+    case OP_SEARCH:
+        pFound = List_search(pModel->pList, matchesToken, &token);
+        break;
+    case OP_SEARCH_POINTER:
+        pFound = List_searchPointer(pModel->pList, itemOf(token));
+        break;
+    case OP_SEARCH_STRING:
+        pFound = List_searchString(pModel->pList, tokens[token], prefix);
+        break;
+    default:
+        pFound = List_searchBatch(pModel->pList, matchesTokenBatch, &token);
+        break;
+    }
+    if (pModel->size == 0) {
+        pModel->state = MODEL_BEYOND;
+        FUZZ_CHECK(pFound == NULL);
+        return;
+    }
+    if (pModel->state == MODEL_BEYOND) {
+        FUZZ_CHECK(pFound == NULL);
+        return;
+    }
+    int start = (pModel->state == MODEL_BEFORE) ? 0 : pModel->current;
+    prefix = prefix && (operation == OP_SEARCH_STRING);
+    size_t length = strlen(tokens[token]);
+    for (int i = start; i < pModel->size; i++) {
+        const char* pItem = modelItem(pModel, i);
+        if ((pModel->items[i] == token) || (prefix && (strncmp(pItem, tokens[token], length) == 0))) {
+            pModel->current = i;
+            pModel->state = MODEL_WITHIN;
+            FUZZ_CHECK(pFound == pItem);
+            return;
+        }
+    }
+    pModel->state = MODEL_BEYOND;
+    FUZZ_CHECK(pFound == NULL);
+}
+
+// Apply operation, with argument, to pModel and its list
+static void applyOperation(Model* pModel, enum Operation operation, uint8_t argument, Model* pOther)
+{
+    List* pList = pModel->pList;
+    int token = argument % TOKEN_COUNT;
+    void* items[LIST_MAX_NUM_NODES];
+    switch (operation) {
+    case OP_FIRST:
+    case OP_LAST:
+        FUZZ_CHECK(((operation == OP_FIRST) ? List_first(pList) : List_last(pList))
+            == ((pModel->size == 0) ? NULL : modelItem(pModel, (operation == OP_FIRST) ? 0 : pModel->size - 1)));
+        if (pModel->size > 0) {
+            pModel->current = (operation == OP_FIRST) ? 0 : pModel->size - 1;
+            pModel->state = MODEL_WITHIN;
+        }
+        break;
+    case OP_NEXT:
+        if (pModel->size == 0) {
+            pModel->state = MODEL_BEYOND;
+        }
+        else if (pModel->state == MODEL_BEFORE) {
+            pModel->current = 0;
+            pModel->state = MODEL_WITHIN;
+        }
+        else if ((pModel->state == MODEL_WITHIN) && (++pModel->current == pModel->size)) {
+            pModel->state = MODEL_BEYOND;
+        }
+        FUZZ_CHECK(List_next(pList) == modelCurrent(pModel));
+        break;
+    case OP_PREV:
+        if (pModel->size == 0) {
+            pModel->state = MODEL_BEFORE;
+        }
+        else if (pModel->state == MODEL_BEYOND) {
+            pModel->current = pModel->size - 1;
+            pModel->state = MODEL_WITHIN;
+        }
+        else if ((pModel->state == MODEL_WITHIN) && (--pModel->current < 0)) {
+            pModel->state = MODEL_BEFORE;
+        }
+        FUZZ_CHECK(List_prev(pList) == modelCurrent(pModel));
+        break;
+    case OP_ADD:
+    case OP_INSERT:
+    case OP_APPEND:
+    case OP_PREPEND:
+        addItem(pModel, operation, token);
+        break;
+    case OP_REMOVE:
+        FUZZ_CHECK(List_remove(pList) == modelCurrent(pModel));
+        if (pModel->state == MODEL_WITHIN) {
+            modelRemoveAt(pModel, pModel->current);
+            if (pModel->current == pModel->size) {
+                pModel->state = MODEL_BEYOND;
+            }
+        }
+        break;
+    case OP_TRIM:
+        FUZZ_CHECK(List_trim(pList) == ((pModel->size == 0) ? NULL : modelItem(pModel, pModel->size - 1)));
+        if (pModel->size > 0) {
+            modelRemoveAt(pModel, pModel->size - 1);
+            pModel->current = pModel->size - 1;
+            pModel->state = (pModel->size == 0) ? MODEL_BEFORE : MODEL_WITHIN;
+        }
+        break;
+    case OP_PREPEND_MANY: {
+        int count = argument % 48;
+        for (int i = 0; i < count; i++) {
+            items[i] = itemOf((token + i) % TOKEN_COUNT);
+        }
+        int result = List_prependMany(pList, items, count);
+        if (itemsInUse + count > LIST_MAX_NUM_NODES) {
+            FUZZ_CHECK(result == -1);
+            break;
+        }
+        FUZZ_CHECK(result == 0);
+        for (int i = 0; i < count; i++) {
+            modelInsertAt(pModel, 0, (token + i) % TOKEN_COUNT);
+        }
+        break;
+    }
+    case OP_DRAIN: {
+        int maxItems = argument % 40;
+        int count = List_drain(pList, items, maxItems);
+        FUZZ_CHECK(count == ((pModel->size < maxItems) ? pModel->size : maxItems));
+        for (int i = 0; i < count; i++) {
+            FUZZ_CHECK(items[i] == modelItem(pModel, pModel->size - 1));
+            modelRemoveAt(pModel, pModel->size - 1);
+        }
+        if (count > 0) {
+            pModel->current = pModel->size - 1;
+            pModel->state = (pModel->size == 0) ? MODEL_BEFORE : MODEL_WITHIN;
+        }
+        break;
+    }
+    case OP_CONCAT:
+        if ((pOther == NULL) || (pOther == pModel)) {
+            break;
+        }
+        List_concat(pList, pOther->pList);
+        if (pModel->size == 0) {
+            pModel->state = MODEL_BEFORE;
+        }
+        else if ((pOther->size > 0) && (pModel->state != MODEL_WITHIN)) {
+            pModel->state = MODEL_BEFORE;
+        }
+        memcpy(&pModel->items[pModel->size], pOther->items, sizeof(int) * pOther->size);
+        pModel->size += pOther->size;
+        pOther->pList = NULL;
+        break;
+    case OP_FREE:
+        List_free(pList, NULL);
+        itemsInUse -= pModel->size;
+        pModel->pList = NULL;
+        break;
+    case OP_SEARCH:
+    case OP_SEARCH_POINTER:
+    case OP_SEARCH_STRING:
+    case OP_SEARCH_BATCH:
+        searchItem(pModel, operation, token, (argument & 0x40) != 0);
+        break;
+    case OP_WALK:
+        walkList(pModel);
+        break;
+    default:
+        break;
+    }
+}
+
+// Set up the tokens: octal numbers, so "1" is a prefix of "10" to "17"
+static void setupTokens()
+{
+    for (int i = 0; i < TOKEN_COUNT; i++) {
+        snprintf(tokens[i], sizeof(tokens[i]), "%o", i);
+    }
+    tokensReady = true;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (!tokensReady) {
+        setupTokens();
+    }
+    for (size_t offset = 0; offset + 3 <= size; offset += 3) {
+        enum Operation operation = data[offset] % OP_COUNT;
+        Model* pModel = &models[data[offset + 1] % LIST_MAX_NUM_HEADS];
+        uint8_t argument = data[offset + 2];
+        if (operation == OP_CREATE) {
+            List* pList = List_create();
+            if (pModel->pList != NULL) {
+                // Every head is in use only if every model has a list
+                bool allLive = true;
+                for (int i = 0; i < LIST_MAX_NUM_HEADS; i++) {
+                    allLive = allLive && (models[i].pList != NULL);
+                }
+                FUZZ_CHECK((pList == NULL) == allLive);
+                if (pList != NULL) {
+                    List_free(pList, NULL);
+                }
+                continue;
+            }
+            FUZZ_CHECK(pList != NULL);
+            memset(pModel, 0, sizeof(*pModel));
+            pModel->pList = pList;
+            pModel->state = MODEL_BEFORE;
+            checkList(pModel);
+            continue;
+        }
+        if (pModel->pList == NULL) {
+            continue;
+        }
+        Model* pOther = &models[argument % LIST_MAX_NUM_HEADS];
+        applyOperation(pModel, operation, argument, (pOther->pList != NULL) ? pOther : NULL);
+        if (pModel->pList != NULL) {
+            checkList(pModel);
+        }
+    }
+
+    // Free everything, then the whole pool must fit in one list
+    for (int i = 0; i < LIST_MAX_NUM_HEADS; i++) {
+        if (models[i].pList != NULL) {
+            walkList(&models[i]);
+            List_free(models[i].pList, NULL);
+            models[i].pList = NULL;
+        }
+    }
+    itemsInUse = 0;
+    static void* fill[LIST_MAX_NUM_NODES];
+    List* pList = List_create();
+    FUZZ_CHECK(pList != NULL);
+    FUZZ_CHECK(List_prependMany(pList, fill, LIST_MAX_NUM_NODES) == 0);
+    FUZZ_CHECK(List_count(pList) == LIST_MAX_NUM_NODES);
+    FUZZ_CHECK(List_append(pList, fill) == -1);
+    List_free(pList, NULL);
+    return 0;
+}
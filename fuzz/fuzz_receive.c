@@ -0,0 +1,186 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "../arena.h"
+#include "../general.h"
+#include "../log.h"
+#include "../packet.h"
+#include "../receiver.h"
+#include "../relay.h"
+#include "../resolver.h"
+#include "../trace.h"
+#include "../transfer.h"
+#include "fuzz.h"
+
+// Feeds an input to the receive thread's datagram handling as one receive. The first byte
+// picks one of eight loopback sources, the first of which is the remote user and so may send
+// files; unless its bit 3 is set, every datagram also gets a
+// valid magic byte and a known type, so random inputs get past the header. The second byte
+// picks the segment length, as if receive offload had coalesced several datagrams. The rest
+// is the received bytes. Every message put on the receive list must be a string shorter than
+// MSG_MAX_LEN.
+//
+// FUZZ_RELAY=1 in the environment runs the hub's path instead, with one more peer joined to
+// forward to, and FUZZ_TRACE=1 keeps trace stamps. A "!" must never be forwarded; the inputs
+// in fuzz/cases replay ones that were. Received files are written to a temporary directory, emptied after every input,
+// and capped at FUZZ_MAX_FILE_BYTES.
+
+#define FUZZ_SOURCE_PORT 47000
+
+// Port of the peer joined in relay mode, outside the range of the sources
+#define FUZZ_PEER_PORT 47100
+#define FUZZ_MAX_FILE_BYTES (1 << 20)
+
+// Most datagrams one input is cut into, well below the receive list's capacity
+#define FUZZ_MAX_SEGMENTS 256
+
+static char remoteHost[] = "127.0.0.1";
+static char remotePort[] = "47000";
+static bool ready = false;
+static char directory[] = "/tmp/s-talk-fuzz-XXXXXX";
+
+// Delete the files received for the last input
+static void removeReceivedFiles()
+{
+    DIR* pDirectory = opendir(".");
+    if (pDirectory == NULL) {
+        return;
+    }
+    struct dirent* pEntry;
+    while ((pEntry = readdir(pDirectory)) != NULL) {
+        if (pEntry->d_name[0] != '.') {
+            unlink(pEntry->d_name);
+        }
+    }
+    closedir(pDirectory);
+}
+
+// Remove the temporary directory at exit
+static void removeDirectory()
+{
+    removeReceivedFiles();
+    rmdir(directory);
+}
+
+// Fill pAddress with loopback port in the socket's family, as recvfrom() would give it
+// Returns the length of the address
+static socklen_t loopbackAddress(uint16_t port, struct sockaddr_storage* pAddress)
+{
+    memset(pAddress, 0, sizeof(*pAddress));
+    if (socketFamily == AF_INET6) {
+        struct sockaddr_in6* pAddress6 = (struct sockaddr_in6*)pAddress;
+        pAddress6->sin6_family = AF_INET6;
+        pAddress6->sin6_addr.s6_addr[10] = 0xff;
+        pAddress6->sin6_addr.s6_addr[11] = 0xff;
+        pAddress6->sin6_addr.s6_addr[12] = 127;
+        pAddress6->sin6_addr.s6_addr[15] = 1;
+        pAddress6->sin6_port = htons(port);
+        return sizeof(*pAddress6);
+    }
+    struct sockaddr_in* pAddress4 = (struct sockaddr_in*)pAddress;
+    pAddress4->sin_family = AF_INET;
+    pAddress4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    pAddress4->sin_port = htons(port);
+    return sizeof(*pAddress4);
+}
+
+// Returns true if the datagram of length bytes is a chat "!", traced or not
+static bool isBang(const uint8_t* datagram, int length)
+{
+    PacketHeader header;
+    if ((Packet_decodeHeader(datagram, length, &header) != 0) || (header.type != PACKET_CHAT)) {
+        return false;
+    }
+    const uint8_t* pText = &datagram[PACKET_HEADER_LEN];
+    int textLength = Trace_textLength(pText, length - PACKET_HEADER_LEN, (header.flags & PACKET_FLAG_TRACED) != 0);
+    return (textLength == 2) && (memcmp(pText, "!\n", 2) == 0);
+}
+
+// Set up what the receive path needs, as main() would, with output and files out of the way
+static void setup()
+{
+    Log_open("/dev/null");
+    int nullDescriptor = open("/dev/null", O_WRONLY);
+    dup2(nullDescriptor, STDOUT_FILENO);
+    close(nullDescriptor);
+    if ((mkdtemp(directory) == NULL) || (chdir(directory) != 0)) {
+        abort();
+    }
+    struct rlimit limit = {.rlim_cur = FUZZ_MAX_FILE_BYTES, .rlim_max = FUZZ_MAX_FILE_BYTES};
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, SIG_IGN);
+    atexit(removeDirectory);
+
+    if (getenv("FUZZ_RELAY") != NULL) {
+        Relay_enable();
+    }
+    if (getenv("FUZZ_TRACE") != NULL) {
+        Trace_enable("/dev/null");
+    }
+    General_shutdownInit();
+    General_socketInit("0");
+    Resolver_start();
+    Transfer_init(remoteHost, remotePort, true);
+    struct sockaddr_storage remote;
+    socklen_t remoteLength;
+    Resolver_lookup(remoteHost, remotePort, &remote, &remoteLength, true);
+    if (Relay_enabled()) {
+        struct sockaddr_storage peer;
+        socklen_t peerLength = loopbackAddress(FUZZ_PEER_PORT, &peer);
+        Relay_join((struct sockaddr*)&peer, peerLength);
+    }
+    Receiver_init();
+    ready = true;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (!ready) {
+        setup();
+    }
+    if ((size < 2) || (size - 2 > PACKET_RECEIVE_LEN)) {
+        return 0;
+    }
+    static uint8_t buffer[PACKET_RECEIVE_LEN];
+    int length = size - 2;
+    memcpy(buffer, &data[2], length);
+    int segmentLength = (data[1] == 0) ? length : data[1] * 8;
+    if (segmentLength < length / FUZZ_MAX_SEGMENTS + 1) {
+        segmentLength = length / FUZZ_MAX_SEGMENTS + 1;
+    }
+    if ((data[0] & 0x08) == 0) {
+        for (int offset = 0; offset + 1 < length; offset += segmentLength) {
+            buffer[offset] = PACKET_MAGIC;
+            buffer[offset + 1] = 1 + buffer[offset + 1] % PACKET_ROOM;
+        }
+    }
+
+    struct sockaddr_storage source;
+    socklen_t sourceLength = loopbackAddress(FUZZ_SOURCE_PORT + (data[0] & 0x07), &source);
+    bool bang = Relay_enabled() && (segmentLength >= length) && isBang(buffer, length);
+
+    long received = General_stats.messagesReceived;
+    long relayed = General_stats.messagesRelayed;
+    Receiver_handleDatagrams(buffer, length, segmentLength, &source, sourceLength);
+    FUZZ_CHECK(!bang || (General_stats.messagesRelayed == relayed));
+    long pending = General_stats.messagesReceived - received;
+    FUZZ_CHECK(pending <= FUZZ_MAX_SEGMENTS);
+    while (pending > 0) {
+        char* messages[MSG_BATCH_SIZE];
+        int count = Receiver_getBatchFromReceiveList(messages, (pending < MSG_BATCH_SIZE) ? pending : MSG_BATCH_SIZE);
+        for (int i = 0; i < count; i++) {
+            FUZZ_CHECK(strlen(messages[i]) < MSG_MAX_LEN);
+            Arena_free(messages[i]);
+        }
+        pending -= count;
+    }
+    removeReceivedFiles();
+    return 0;
+}
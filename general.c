@@ -1,44 +1,76 @@
 #include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include "arena.h"
 #include "general.h"
+#include "log.h"
 
 int socketDescriptor;
+int socketFamily;
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t programTerminatedCondVar = PTHREAD_COND_INITIALIZER;
+static bool programTerminated = false;
+
+// Once shutdown begins, a byte is written to shutdownPipe and never read, so its read end
+// stays readable for every thread polling it
+static int shutdownPipe[2] = {-1, -1};
+static atomic_bool shuttingDown = false;
+static struct timespec shutdownDeadline;
+
+Stats General_stats;
 
 //Initialize Socket
 void General_socketInit(char* port)
 {
 	// Address
-	struct sockaddr_in sin;
-	memset(&sin, 0, sizeof(sin));
-	sin.sin_family = AF_INET;
-	sin.sin_addr.s_addr = htonl(INADDR_ANY);
-	sin.sin_port = htons(atoi(port));
-	// Create the socket for UDP
-	socketDescriptor = socket(PF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_storage address;
+	socklen_t addressLength;
+	memset(&address, 0, sizeof(address));
+	// Create a dual-stack socket for UDP, or an IPv4 one if IPv6 is unavailable
+	socketFamily = AF_INET6;
+	socketDescriptor = socket(PF_INET6, SOCK_DGRAM, 0);
+	if (socketDescriptor != -1) {
+		int ipv6Only = 0;
+		setsockopt(socketDescriptor, IPPROTO_IPV6, IPV6_V6ONLY, &ipv6Only, sizeof(ipv6Only));
+		struct sockaddr_in6* pSin6 = (struct sockaddr_in6*)&address;
+		pSin6->sin6_family = AF_INET6;
+		pSin6->sin6_addr = in6addr_any;
+		pSin6->sin6_port = htons(atoi(port));
+		addressLength = sizeof(*pSin6);
+	}
+	else {
+		socketFamily = AF_INET;
+		socketDescriptor = socket(PF_INET, SOCK_DGRAM, 0);
+		struct sockaddr_in* pSin = (struct sockaddr_in*)&address;
+		pSin->sin_family = AF_INET;
+		pSin->sin_addr.s_addr = htonl(INADDR_ANY);
+		pSin->sin_port = htons(atoi(port));
+		addressLength = sizeof(*pSin);
+	}
     if (socketDescriptor == -1) {
-        General_print("General.c: Failed to create the socket descriptor\n");
+        Log_write(LOG_ERROR, "General.c: Failed to create the socket descriptor\n");
         exit(EXIT_FAILURE);
     }
 	// Bind the socket to the specified port
-	int result = bind(socketDescriptor, (struct sockaddr*) &sin, sizeof(sin));
+	int result = bind(socketDescriptor, (struct sockaddr*) &address, addressLength);
     if (result == -1) {
-        General_print("General.c: Failed to bind the socket to the specified port\n");
+        Log_write(LOG_ERROR, "General.c: Failed to bind the socket to the specified port\n");
         exit(EXIT_FAILURE);
     }
 }
 
-// Function pointer for List_free()
+// Function pointer for List_free(), for message buffers from Arena_alloc()
 void freeItem(void* item) 
 {
-	free(item);
+	Arena_free(item);
 }
-void (*freeFunction)(void*) = &freeItem;
+void (*General_freeFunction)(void*) = &freeItem;
 
 // Display message
 void General_print(char* message)
@@ -46,20 +78,23 @@ void General_print(char* message)
 	write(fileno(stdout), message, strlen(message));
 }
 
-// Display message, and display error message on failure
+// Display message, and log error message on failure
 void General_printAndCheck(char* message, char* errorMessage)
 {
 	if (write(fileno(stdout), message, strlen(message)) < 0) {
-		write(fileno(stdout), errorMessage, strlen(errorMessage));
+		Log_write(LOG_ERROR, errorMessage);
 	}
 }
 
 // Wait until the program terminates
+// Returns immediately if it was signalled before the wait began
 void General_waitForTermination()
 {
 	pthread_mutex_lock(&mutex);
     {
-        pthread_cond_wait(&programTerminatedCondVar, &mutex);
+        while (!programTerminated) {
+            pthread_cond_wait(&programTerminatedCondVar, &mutex);
+        }
     }
     pthread_mutex_unlock(&mutex);
 }
@@ -69,28 +104,134 @@ void General_terminate()
 {
 	pthread_mutex_lock(&mutex);
     {
+        programTerminated = true;
         pthread_cond_signal(&programTerminatedCondVar);
     }
     pthread_mutex_unlock(&mutex);
 	General_print("\nPROGRAM TERMINATED\n");
 }
 
+// Create the pipe that wakes threads blocked on input when shutdown begins
+void General_shutdownInit()
+{
+	if (pipe(shutdownPipe) != 0) {
+		Log_write(LOG_ERROR, "General.c: Failed to create the shutdown pipe\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Wake every thread waiting in General_waitForInput() and start the flush deadline
+void General_beginShutdown()
+{
+	clock_gettime(CLOCK_MONOTONIC, &shutdownDeadline);
+	shutdownDeadline.tv_sec += SHUTDOWN_DEADLINE_MS / 1000;
+	shutdownDeadline.tv_nsec += (SHUTDOWN_DEADLINE_MS % 1000) * 1000000L;
+	if (shutdownDeadline.tv_nsec >= 1000000000L) {
+		shutdownDeadline.tv_sec++;
+		shutdownDeadline.tv_nsec -= 1000000000L;
+	}
+	atomic_store_explicit(&shuttingDown, true, memory_order_release);
+
+	char wakeup = 0;
+	if (write(shutdownPipe[1], &wakeup, 1) != 1) {
+		Log_write(LOG_ERROR, "General.c: Failed to wake the threads for shutdown\n");
+	}
+}
+
+// Returns true once shutdown has begun
+bool General_isShuttingDown()
+{
+	return atomic_load_explicit(&shuttingDown, memory_order_acquire);
+}
+
+// Returns true once shutdown has begun and its flush deadline has passed
+bool General_shutdownDeadlinePassed()
+{
+	if (!General_isShuttingDown()) {
+		return false;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec > shutdownDeadline.tv_sec) || ((now.tv_sec == shutdownDeadline.tv_sec) && (now.tv_nsec >= shutdownDeadline.tv_nsec));
+}
+
+// Wait until fd has data to read or shutdown has begun
+// Returns true if fd is readable, false once shutting down
+bool General_waitForInput(int fd)
+{
+	return General_waitForInputs(&fd, 1, -1) == 0;
+}
+
+// Wait until one of the count descriptors of fds has data to read, timeoutMs milliseconds
+// pass (never if negative), or shutdown begins
+// Returns the index of a readable descriptor, count on timeout, or -1 once shutting down
+int General_waitForInputs(const int* fds, int count, int timeoutMs)
+{
+	struct pollfd polled[GENERAL_MAX_WAIT_FDS + 1];
+	for (int i = 0; i < count; i++) {
+		polled[i].fd = fds[i];
+		polled[i].events = POLLIN;
+	}
+	polled[count].fd = shutdownPipe[0];
+	polled[count].events = POLLIN;
+	while (1) {
+		if (General_isShuttingDown()) {
+			return -1;
+		}
+		int ready = poll(polled, count + 1, timeoutMs);
+		if (ready == 0) {
+			return count;
+		}
+		if (ready > 0) {
+			if (polled[count].revents != 0) {
+				return -1;
+			}
+			for (int i = 0; i < count; i++) {
+				if (polled[i].revents != 0) {
+					return i;
+				}
+			}
+		}
+	}
+}
+
+// Returns the time of the monotonic clock in microseconds
+uint64_t General_monotonicMicros()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Display the message counters
+void General_printStats()
+{
+	char stats[256];
+	snprintf(stats, sizeof(stats), "Messages: %ld read, %ld sent (%ld failed, %ld dropped), %ld received (%ld dropped, %ld duplicates), %ld printed, %ld relayed\n",
+		General_stats.messagesRead, General_stats.messagesSent, General_stats.sendFailures, General_stats.sendDropped,
+		General_stats.messagesReceived, General_stats.receiveDropped, General_stats.duplicatesDropped, General_stats.messagesPrinted, General_stats.messagesRelayed);
+	General_print(stats);
+}
+
 // Cleanup used resources
 void General_cleanup()
 {
 	int result;
     result = close(socketDescriptor);
 	if (result != 0) {
-		General_print("General.c: Failed to close the socket\n");
+		Log_write(LOG_ERROR, "General.c: Failed to close the socket\n");
 	}
 
+	close(shutdownPipe[0]);
+	close(shutdownPipe[1]);
+
 	result = pthread_mutex_destroy(&mutex);
 	if (result != 0) {
-		General_print("General.c: Failed to destroy the mutex\n");
+		Log_write(LOG_ERROR, "General.c: Failed to destroy the mutex\n");
 	}
 
     result = pthread_cond_destroy(&programTerminatedCondVar);
 	if (result != 0) {
-		General_print("General.c: Failed to destroy the conditional variable\n");
+		Log_write(LOG_ERROR, "General.c: Failed to destroy the conditional variable\n");
 	}
 }
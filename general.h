@@ -1,19 +1,27 @@
 #ifndef _GENERAL_H_
 #define _GENERAL_H_
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #define MSG_MAX_LEN 512
 
+// Maximum number of messages handed from one thread to another at once
+#define MSG_BATCH_SIZE 32
+
 //Initialize Socket
-int socketDescriptor;
+//The socket is dual-stack IPv6 (socketFamily AF_INET6) unless IPv6 is unavailable
+extern int socketDescriptor;
+extern int socketFamily;
 void General_socketInit(char* port);
 
 // Function pointer for List_free()
-void (*General_freeFunction)(void*);
+extern void (*General_freeFunction)(void*);
 
 // Display message
 void General_print(char* message);
 
-// Display message, and display error message on failure
+// Display message, and log error message on failure
 void General_printAndCheck(char* message, char* errorMessage);
 
 // Wait until the program terminates
@@ -22,6 +30,54 @@ void General_waitForTermination();
 // Signal to terminate the program
 void General_terminate();
 
+// Milliseconds the threads get to flush queued messages once shutdown has begun
+#define SHUTDOWN_DEADLINE_MS 2000
+
+// Create the pipe that wakes threads blocked on input when shutdown begins
+void General_shutdownInit();
+
+// Wake every thread waiting in General_waitForInput() and start the flush deadline
+void General_beginShutdown();
+
+// Returns true once shutdown has begun
+bool General_isShuttingDown();
+
+// Returns true once shutdown has begun and its flush deadline has passed
+bool General_shutdownDeadlinePassed();
+
+// Wait until fd has data to read or shutdown has begun
+// Returns true if fd is readable, false once shutting down
+bool General_waitForInput(int fd);
+
+// Most descriptors General_waitForInputs() waits on at once
+#define GENERAL_MAX_WAIT_FDS 4
+
+// Wait until one of the count descriptors of fds has data to read, timeoutMs milliseconds
+// pass (never if negative), or shutdown begins
+// Returns the index of a readable descriptor, count on timeout, or -1 once shutting down
+int General_waitForInputs(const int* fds, int count, int timeoutMs);
+
+// Returns the time of the monotonic clock in microseconds
+uint64_t General_monotonicMicros();
+
+// Message counters, reported once every thread has finished
+typedef struct Stats_s Stats;
+struct Stats_s {
+    atomic_long messagesRead;
+    atomic_long messagesSent;
+    atomic_long messagesReceived;
+    atomic_long messagesPrinted;
+    atomic_long sendFailures;
+    atomic_long sendDropped;
+    atomic_long receiveDropped;
+    atomic_long duplicatesDropped;
+    atomic_long messagesRelayed;
+};
+extern Stats General_stats;
+
+// Display the message counters
+void General_printStats();
+
 // Cleanup used resources
 void General_cleanup();
 
@@ -0,0 +1,353 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "general.h"
+#include "impair.h"
+#include "log.h"
+
+enum DelayDistribution {DELAY_UNIFORM, DELAY_NORMAL};
+
+static bool enabled = false;
+static double lossProbability = 0;
+static double duplicateProbability = 0;
+static double reorderProbability = 0;
+static double delayMs = 0;
+static double jitterMs = 0;
+static enum DelayDistribution distribution = DELAY_UNIFORM;
+static uint64_t seed = 1;
+
+// One pseudo-random stream per packet type, indexed by the type byte of the datagram
+static uint64_t streams[256];
+
+// A delayed datagram, kept in a binary min-heap ordered by when it is due, then by when it
+// was sent, so datagrams with the same delay keep their order
+typedef struct Pending_s Pending;
+struct Pending_s {
+    uint64_t due;
+    uint64_t order;
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+    size_t length;
+    uint8_t datagram[];
+};
+static Pending** heap;
+static int heapCount = 0;
+static uint64_t nextOrder = 0;
+
+static long dropped = 0;
+static long duplicated = 0;
+static long delayed = 0;
+static long reordered = 0;
+
+static pthread_t threadPID;
+static bool threadStarted = false;
+static bool stopping = false;
+static pthread_mutex_t impairMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pendingCondVar;
+
+// Returns the next value of a splitmix64 stream
+static uint64_t nextRandom(uint64_t* pState)
+{
+    uint64_t z = (*pState += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Returns a uniform value in [0, 1) from a stream
+static double nextUniform(uint64_t* pState)
+{
+    return (nextRandom(pState) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Returns a delay in microseconds drawn from the configured distribution, never negative
+static uint64_t nextDelay(uint64_t* pState)
+{
+    double delay = delayMs;
+    if (distribution == DELAY_NORMAL) {
+        // Sum of 12 uniforms (Irwin-Hall): mean 6, standard deviation 1
+        double sum = 0;
+        for (int i = 0; i < 12; i++) {
+            sum += nextUniform(pState);
+        }
+        delay += jitterMs * (sum - 6);
+    }
+    else {
+        delay += jitterMs * (2 * nextUniform(pState) - 1);
+    }
+    return (delay > 0) ? (uint64_t)(delay * 1000) : 0;
+}
+
+// Returns true if heap entry a is due before heap entry b
+static bool dueBefore(const Pending* pA, const Pending* pB)
+{
+    return (pA->due < pB->due) || ((pA->due == pB->due) && (pA->order < pB->order));
+}
+
+// Add pPending to the heap
+// Must be called with impairMutex held
+static void pushPending(Pending* pPending)
+{
+    int index = heapCount++;
+    while ((index > 0) && dueBefore(pPending, heap[(index - 1) / 2])) {
+        heap[index] = heap[(index - 1) / 2];
+        index = (index - 1) / 2;
+    }
+    heap[index] = pPending;
+}
+
+// Remove and return the datagram due first
+// Must be called with impairMutex held
+static Pending* popPending()
+{
+    Pending* pFirst = heap[0];
+    Pending* pLast = heap[--heapCount];
+    int index = 0;
+    while (2 * index + 1 < heapCount) {
+        int child = 2 * index + 1;
+        if ((child + 1 < heapCount) && dueBefore(heap[child + 1], heap[child])) {
+            child++;
+        }
+        if (!dueBefore(heap[child], pLast)) {
+            break;
+        }
+        heap[index] = heap[child];
+        index = child;
+    }
+    heap[index] = pLast;
+    return pFirst;
+}
+
+// Parses a probability in [0, 1]
+// Returns 0 on success, -1 if value is not one
+static int parseProbability(const char* value, double* pProbability)
+{
+    char* pEnd;
+    double probability = strtod(value, &pEnd);
+    if ((pEnd == value) || (*pEnd != 0) || (probability < 0) || (probability > 1)) {
+        return -1;
+    }
+    *pProbability = probability;
+    return 0;
+}
+
+// Parses a non-negative number of milliseconds
+// Returns 0 on success, -1 if value is not one
+static int parseMilliseconds(const char* value, double* pMilliseconds)
+{
+    char* pEnd;
+    double milliseconds = strtod(value, &pEnd);
+    if ((pEnd == value) || (*pEnd != 0) || (milliseconds < 0)) {
+        return -1;
+    }
+    *pMilliseconds = milliseconds;
+    return 0;
+}
+
+// Applies one "name=value" setting
+// Returns 0 on success, -1 if it is malformed
+static int applySetting(char* setting)
+{
+    char* value = strchr(setting, '=');
+    if (value == NULL) {
+        return -1;
+    }
+    *value++ = 0;
+    if (strcmp(setting, "loss") == 0) {
+        return parseProbability(value, &lossProbability);
+    }
+    if (strcmp(setting, "dup") == 0) {
+        return parseProbability(value, &duplicateProbability);
+    }
+    if (strcmp(setting, "reorder") == 0) {
+        return parseProbability(value, &reorderProbability);
+    }
+    if (strcmp(setting, "delay") == 0) {
+        return parseMilliseconds(value, &delayMs);
+    }
+    if (strcmp(setting, "jitter") == 0) {
+        return parseMilliseconds(value, &jitterMs);
+    }
+    if (strcmp(setting, "dist") == 0) {
+        if (strcmp(value, "uniform") == 0) {
+            distribution = DELAY_UNIFORM;
+        }
+        else if (strcmp(value, "normal") == 0) {
+            distribution = DELAY_NORMAL;
+        }
+        else {
+            return -1;
+        }
+        return 0;
+    }
+    if (strcmp(setting, "seed") == 0) {
+        char* pEnd;
+        seed = strtoull(value, &pEnd, 10);
+        return ((pEnd == value) || (*pEnd != 0)) ? -1 : 0;
+    }
+    return -1;
+}
+
+// Configure impairment from a comma-separated list of settings
+int Impair_configure(const char* settings)
+{
+    char* copy = strdup(settings);
+    int result = 0;
+    char* pSave;
+    for (char* setting = strtok_r(copy, ",", &pSave); (setting != NULL) && (result == 0); setting = strtok_r(NULL, ",", &pSave)) {
+        result = applySetting(setting);
+    }
+    free(copy);
+    if (result != 0) {
+        return -1;
+    }
+    for (int type = 0; type < 256; type++) {
+        streams[type] = seed ^ ((uint64_t)type << 56);
+    }
+    enabled = true;
+    return 0;
+}
+
+// Returns true if impairment was configured
+bool Impair_enabled()
+{
+    return enabled;
+}
+
+// Sends delayed datagrams when they are due. Once stopping, sends the rest as they fall
+// due until the shutdown deadline, then drops what is left.
+void* impairThread()
+{
+    pthread_mutex_lock(&impairMutex);
+    while (1) {
+        if (stopping && ((heapCount == 0) || General_shutdownDeadlinePassed())) {
+            break;
+        }
+        if (heapCount == 0) {
+            pthread_cond_wait(&pendingCondVar, &impairMutex);
+            continue;
+        }
+        uint64_t now = General_monotonicMicros();
+        if (heap[0]->due > now) {
+            // Wake at the due time, or within 100 ms to notice the shutdown deadline
+            uint64_t wait = heap[0]->due - now;
+            if (stopping && (wait > 100000)) {
+                wait = 100000;
+            }
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += wait / 1000000;
+            deadline.tv_nsec += (wait % 1000000) * 1000;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&pendingCondVar, &impairMutex, &deadline);
+            continue;
+        }
+        Pending* pPending = popPending();
+        pthread_mutex_unlock(&impairMutex);
+        sendto(socketDescriptor, pPending->datagram, pPending->length, 0, (struct sockaddr*)&pPending->address, pPending->addressLength);
+        free(pPending);
+        pthread_mutex_lock(&impairMutex);
+    }
+    dropped += heapCount;
+    while (heapCount > 0) {
+        free(popPending());
+    }
+    pthread_mutex_unlock(&impairMutex);
+    return NULL;
+}
+
+// Start background thread that sends delayed datagrams
+void Impair_start()
+{
+    if (!enabled) {
+        return;
+    }
+    heap = malloc(IMPAIR_MAX_PENDING * sizeof(*heap));
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&pendingCondVar, &attributes);
+    pthread_condattr_destroy(&attributes);
+    if ((heap == NULL) || (pthread_create(&threadPID, NULL, impairThread, NULL) != 0)) {
+        Log_write(LOG_ERROR, "Impair Thread Error: Failed to create the impairment thread\n");
+        exit(EXIT_FAILURE);
+    }
+    threadStarted = true;
+}
+
+// Send length bytes of datagram to pAddress, subject to the configured impairment
+int Impair_send(const void* datagram, size_t length, const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    uint64_t* pStream = &streams[(length > 1) ? ((const uint8_t*)datagram)[1] : 0];
+    int sendNow = 0;
+    pthread_mutex_lock(&impairMutex);
+    {
+        if (nextUniform(pStream) < lossProbability) {
+            dropped++;
+        }
+        else {
+            int copies = 1;
+            if (nextUniform(pStream) < duplicateProbability) {
+                copies = 2;
+                duplicated++;
+            }
+            for (int i = 0; i < copies; i++) {
+                bool overtake = (nextUniform(pStream) < reorderProbability);
+                uint64_t delay = nextDelay(pStream);
+                if (overtake && (delay > 0)) {
+                    reordered++;
+                    delay = 0;
+                }
+                Pending* pPending = (delay > 0) && (heapCount < IMPAIR_MAX_PENDING) ? malloc(sizeof(Pending) + length) : NULL;
+                if (pPending == NULL) {
+                    sendNow++;
+                    continue;
+                }
+                pPending->due = General_monotonicMicros() + delay;
+                pPending->order = nextOrder++;
+                memcpy(&pPending->address, pAddress, addressLength);
+                pPending->addressLength = addressLength;
+                pPending->length = length;
+                memcpy(pPending->datagram, datagram, length);
+                pushPending(pPending);
+                delayed++;
+                pthread_cond_signal(&pendingCondVar);
+            }
+        }
+    }
+    pthread_mutex_unlock(&impairMutex);
+
+    for (int i = 0; i < sendNow; i++) {
+        if (sendto(socketDescriptor, datagram, length, 0, pAddress, addressLength) < 0) {
+            return -1;
+        }
+    }
+    return length;
+}
+
+// Send the datagrams still delayed until the shutdown deadline, then stop background thread
+void Impair_shutdown()
+{
+    if (!threadStarted) {
+        return;
+    }
+    pthread_mutex_lock(&impairMutex);
+    {
+        stopping = true;
+        pthread_cond_signal(&pendingCondVar);
+    }
+    pthread_mutex_unlock(&impairMutex);
+    pthread_join(threadPID, NULL);
+    pthread_cond_destroy(&pendingCondVar);
+    free(heap);
+
+    char stats[256];
+    snprintf(stats, sizeof(stats), "Impairment: %ld dropped, %ld duplicated, %ld delayed, %ld reordered\n", dropped, duplicated, delayed, reordered);
+    General_print(stats);
+}
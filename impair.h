@@ -0,0 +1,44 @@
+#ifndef _IMPAIR_H_
+#define _IMPAIR_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+// Simulated network impairment for testing over loopback, applied to every datagram this
+// end sends. Datagrams can be lost, duplicated, delayed and reordered. Delayed datagrams are
+// copied and sent by a background thread when they are due.
+//
+// Decisions come from pseudo-random streams seeded from the configured seed, one stream per
+// packet type. Each type is sent by a single thread, so the same seed and the same traffic
+// give the same decisions, however the threads interleave.
+
+// Most datagrams waiting to be sent at once; more are sent without delay
+#define IMPAIR_MAX_PENDING 65536
+
+// Configure impairment from a comma-separated list of settings:
+//   loss=P        drop each datagram with probability P
+//   dup=P         send a second copy with probability P
+//   delay=MS      delay datagrams by MS milliseconds on average
+//   jitter=MS     spread of the delay: half-width if uniform, standard deviation if normal
+//   dist=NAME     delay distribution, "uniform" (default) or "normal"
+//   reorder=P     send a datagram without its delay with probability P, overtaking others
+//   seed=N        seed of the pseudo-random streams (default 1)
+// e.g. "loss=0.02,delay=40,jitter=10,dist=normal,seed=7"
+// Returns 0 on success, -1 if the list is malformed
+int Impair_configure(const char* settings);
+
+// Returns true if impairment was configured
+bool Impair_enabled();
+
+// Start background thread that sends delayed datagrams
+void Impair_start();
+
+// Send length bytes of datagram to pAddress, subject to the configured impairment
+// Returns length, or -1 if sending at once failed
+int Impair_send(const void* datagram, size_t length, const struct sockaddr* pAddress, socklen_t addressLength);
+
+// Send the datagrams still delayed, as they fall due, until the shutdown deadline;
+// drop the rest, stop background thread and display what was impaired
+void Impair_shutdown();
+
+#endif
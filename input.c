@@ -1,33 +1,101 @@
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "arena.h"
+#include "config.h"
 #include "general.h"
 #include "input.h"
 #include "list.h"
+#include "log.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "transfer.h"
 
 static List* pSendList;
 static pthread_t threadPID;
 static pthread_mutex_t sendListMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t listNotEmptyCondVar = PTHREAD_COND_INITIALIZER;
+static bool sendListClosed = false;
 
+// Messages read but not yet on the send list. Lines that are already waiting on stdin are
+// gathered here and added in one step.
+static char* stagedMessages[MSG_BATCH_SIZE];
+static int stagedCount = 0;
+
+// Mark the send list as complete, so the send thread stops once it has taken every message
+static void closeSendList()
+{
+    pthread_mutex_lock(&sendListMutex);
+    {
+        sendListClosed = true;
+        pthread_cond_broadcast(&listNotEmptyCondVar);
+    }
+    pthread_mutex_unlock(&sendListMutex);
+}
+
+// Add the staged messages to the send list
+static void flushStaged()
+{
+    if (stagedCount > 0) {
+        Input_addBatchToSendList(stagedMessages, stagedCount);
+        stagedCount = 0;
+    }
+}
+
+// Wait until stdin has data to read, first adding the staged messages to the send list unless
+// it already has
+// Returns true if stdin is readable, false once shutting down
+static bool waitForStdin()
+{
+    int descriptor = fileno(stdin);
+    if ((stagedCount > 0) && (General_waitForInputs(&descriptor, 1, 0) != 0)) {
+        flushStaged();
+    }
+    return General_waitForInput(descriptor);
+}
+
+// Reads user input one line at a time until "!", the end of input, or shutdown.
+// A line starting with TRANSFER_COMMAND sends a file instead of a message.
 void* inputThread()
 {	
     while (1) {
         char message[MSG_MAX_LEN];
 
         int bytesRead = 0;
+        bool endOfInput = false;
+        uint64_t readStart = 0;
         for (int i = 0; i < MSG_MAX_LEN; i++) {
-            bytesRead += read(fileno(stdin), &message[i], 1);
+            if (!waitForStdin()) {
+                flushStaged();
+                closeSendList();
+                return NULL;
+            }
+            if (i == 0) {
+                readStart = Trace_now();
+            }
+            int result = read(fileno(stdin), &message[i], 1);
+            if (result <= 0) {
+                endOfInput = (result == 0);
+                bytesRead = (result == 0) ? bytesRead : result;
+                break;
+            }
+            bytesRead += result;
             if (message[i] == '\n') {
                 break;
             }
         }
         if (bytesRead < 0) {
-            General_print("Input Thread Error: Failed to read the message\n");
+            Log_write(LOG_ERROR, "Input Thread Error: Failed to read the message\n");
             continue;
         }
+        if (endOfInput && (bytesRead == 0)) {
+            flushStaged();
+            closeSendList();
+            return NULL;
+        }
 
         size_t messageSize;
         int terminateIndex;
@@ -39,80 +107,127 @@ void* inputThread()
             messageSize = MSG_MAX_LEN;
         }
         message[terminateIndex] = 0;
-        char* pMessage = (char*)malloc(messageSize);
+        if (strncmp(message, TRANSFER_COMMAND, strlen(TRANSFER_COMMAND)) == 0) {
+            char* path = &message[strlen(TRANSFER_COMMAND)];
+            path[strcspn(path, "\n")] = 0;
+            if (Transfer_sendFile(path) != 0) {
+                Log_write(LOG_WARN, "Input Thread Error: A file is already being sent\n");
+            }
+            continue;
+        }
+        char* pMessage = (char*)Arena_alloc(messageSize + Trace_blockLength());
+        if (pMessage == NULL) {
+            Log_write(LOG_ERROR, "Input Thread Error: Failed to allocate the message\n");
+            General_stats.sendDropped++;
+            continue;
+        }
         memcpy(pMessage, message, messageSize);
+        memset(&pMessage[messageSize], 0, Trace_blockLength());
+        Trace_stampAt(pMessage, TRACE_READ_START, readStart);
+        Trace_stamp(pMessage, TRACE_READ_DONE);
+        General_stats.messagesRead++;
         if (strcmp(pMessage, "!\n") == 0) {
-            Input_addToSendList(pMessage);
+            // Shutdown begins now rather than once "!" is sent, which may be waiting on DNS;
+            // the send thread still flushes it before the shutdown deadline
+            stagedMessages[stagedCount++] = pMessage;
+            flushStaged();
+            closeSendList();
+            General_terminate();
             return NULL;
         }
-        Input_addToSendList(pMessage);
+        stagedMessages[stagedCount++] = pMessage;
+        if (stagedCount == MSG_BATCH_SIZE) {
+            flushStaged();
+        }
     }
 }
 
-// Create a empty list and a thread that adds user input to the newly created list
+// Create a empty list for user input
 void Input_init()
 {
     pSendList = List_create();
     if (pSendList == NULL) {
-        General_print("Input Thread Error: Failed to create the send list\n");
+        Log_write(LOG_ERROR, "Input Thread Error: Failed to create the send list\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_create(&threadPID, NULL, inputThread, NULL) != 0) {
-        General_print("Input Thread Error: Failed to create the input thread\n");
+}
+
+// Create a thread that adds user input to the send list
+void Input_start()
+{
+    if (Scheduler_createThread(&threadPID, THREAD_INPUT, inputThread) != 0) {
+        Log_write(LOG_ERROR, "Input Thread Error: Failed to create the input thread\n");
         exit(EXIT_FAILURE);
     }
 }
 
-// Add input to the send list
-void Input_addToSendList(char* message)
+// Add count messages to the send list, earliest first, in one step
+void Input_addBatchToSendList(char** messages, int count)
 {
+    int added = 0;
     pthread_mutex_lock(&sendListMutex);
     {
-        if (List_prepend(pSendList, message) == -1) {
-            General_print("Input Thread Error: Failed to add the input to the send list\n");
-            free(message);
-        } else if (List_count(pSendList) == 1) {
+        bool wasEmpty = List_count(pSendList) == 0;
+        int room = Config_settings.sendQueueCapacity - List_count(pSendList);
+        added = (count < room) ? count : ((room > 0) ? room : 0);
+        if ((added > 0) && (List_prependMany(pSendList, (void**)messages, added) == -1)) {
+            // Too few nodes left for all of them; add as many as there are
+            int fit = 0;
+            while ((fit < added) && (List_prepend(pSendList, messages[fit]) == 0)) {
+                fit++;
+            }
+            added = fit;
+        }
+        if (wasEmpty && (added > 0)) {
             pthread_cond_signal(&listNotEmptyCondVar);
         }
     }
     pthread_mutex_unlock(&sendListMutex);
+
+    if (added < count) {
+        Log_write(LOG_ERROR, "Input Thread Error: Failed to add the input to the send list\n");
+        General_stats.sendDropped += count - added;
+        for (int i = added; i < count; i++) {
+            Arena_free(messages[i]);
+        }
+    }
 }
 
-// Get the earliest message from the send list
-char* Input_getFromSendList()
+// Get up to maxMessages of the earliest messages from the send list, earliest first
+// Returns 0 once the list is closed and empty
+int Input_getBatchFromSendList(char** messages, int maxMessages)
 {
-    char* message;
+    int count;
     pthread_mutex_lock(&sendListMutex);
     {
-        if (List_count(pSendList) == 0) {
+        while ((List_count(pSendList) == 0) && !sendListClosed) {
             pthread_cond_wait(&listNotEmptyCondVar, &sendListMutex);
         }
-        message = (char*)List_trim(pSendList);  
+        count = List_drain(pSendList, (void**)messages, maxMessages);
     }
     pthread_mutex_unlock(&sendListMutex);
-    return message;
+    return count;
 }
 
-// Cancel and wait for thread to finish, then cleanup memory
+// Wait for the thread to finish once shutdown has begun, then cleanup memory.
+// Messages the send thread did not get to are counted as dropped.
 void Input_shutdown()
 {
-    pthread_cancel(threadPID);
     int result = pthread_join(threadPID, NULL);
     if (result != 0) {
-        General_print("Input Thread Error: Failed to cancel and join thread\n");
+        Log_write(LOG_ERROR, "Input Thread Error: Failed to join thread\n");
     }
 
-    pthread_mutex_trylock(&sendListMutex);
-    pthread_mutex_unlock(&sendListMutex);
     result = pthread_mutex_destroy(&sendListMutex);
     if (result != 0) {
-        General_print("Input Thread Error: Failed to destroy the mutex\n");
+        Log_write(LOG_ERROR, "Input Thread Error: Failed to destroy the mutex\n");
     }
     
     result = pthread_cond_destroy(&listNotEmptyCondVar);
     if (result != 0) {
-        General_print("Input Thread Error: Failed to destroy the conditional variable\n");
+        Log_write(LOG_ERROR, "Input Thread Error: Failed to destroy the conditional variable\n");
     }
 
+    General_stats.sendDropped += List_count(pSendList);
     List_free(pSendList, (*General_freeFunction));
 }
@@ -1,16 +1,22 @@
 #ifndef _INPUT_H_
 #define _INPUT_H_
 
-// Start background input thread
+// Create the send list
 void Input_init();
 
-// Add input to the send list
-void Input_addToSendList(char* message);
+// Start background input thread
+void Input_start();
+
+// Add count messages to the send list, earliest first, in one step. Messages beyond the send
+// queue capacity are dropped.
+void Input_addBatchToSendList(char** messages, int count);
 
-// Get the earliest message from the send list
-char* Input_getFromSendList();
+// Get up to maxMessages of the earliest messages from the send list, earliest first.
+// Waits until there is at least one. Returns the number of messages, or 0 once
+// the input thread has finished and every message has been taken.
+int Input_getBatchFromSendList(char** messages, int maxMessages);
 
-// Stop background input thread and cleanup
+// Wait for background input thread to finish once shutdown has begun, and cleanup
 void Input_shutdown();
 
 #endif
@@ -1,6 +1,7 @@
 #include "list.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 static List lists[LIST_MAX_NUM_HEADS];
@@ -102,6 +103,41 @@ static void markAsAvailableNode(Node* pNode)
     return;
 }
 
+// Adds the chain of nodes from pFirst to pLast (linked through next) to the available nodes pool
+// Does not change the items in the nodes
+static void markAsAvailableChain(Node* pFirst, Node* pLast)
+{
+    if (pFirst == NULL) {
+        return;
+    }
+    pLast->next = pAvailableNode;
+    pAvailableNode = pFirst;
+    return;
+}
+
+// Takes count nodes from the available nodes pool, linked to each other through next and previous,
+// and returns the first one. Returns NULL and leaves the pool unchanged if there are not enough nodes.
+static Node* nextAvailableChain(int count)
+{
+    assert(count > 0);
+    Node* pLast = pAvailableNode;
+    if (pLast == NULL) {
+        return NULL;
+    }
+    for (int i = 1; i < count; i++) {
+        if (pLast->next == NULL) {
+            return NULL;
+        }
+        pLast->next->previous = pLast;
+        pLast = pLast->next;
+    }
+    Node* pFirst = pAvailableNode;
+    pAvailableNode = pLast->next;
+    pFirst->previous = NULL;
+    pLast->next = NULL;
+    return pFirst;
+}
+
 // Returns true if pList is empty, false if non-empty.
 static bool isEmptyList(List* pList)
 {
@@ -303,6 +339,7 @@ int List_add(List* pList, void* pItem)
         pList->current->next = pNode;
         pList->current = pNode;
         pList->state = within;
+        pList->size++;
         return 0;
     }
 }
@@ -422,6 +459,7 @@ void* List_remove(List* pList)
     }
     else if (pNode->next == NULL) {
         pNode->previous->next = NULL;
+        pList->tail = pNode->previous;
         pList->current = NULL;
         pList->state = beyond;
     }
@@ -464,18 +502,18 @@ void List_concat(List* pList1, List* pList2)
 // Delete pList. pItemFreeFn is a pointer to a routine that frees an item. 
 // It should be invoked (within List_free) as: (*pItemFreeFn)(itemToBeFreedFromNode);
 // pList and all its nodes no longer exists after the operation; its head and nodes are available for future operations.
+// pItemFreeFn may be NULL when the items are owned elsewhere; the nodes are then
+// returned to the pool in one step instead of one at a time.
 typedef void (*FREE_FN)(void* pItem);
 void List_free(List* pList, FREE_FN pItemFreeFn)
 {
     assert(pList != NULL);
-    Node* pCurrent = pList->head;
-    Node* pNext;
-    while (pCurrent != NULL) {
-        pNext = pCurrent->next;
-        (*pItemFreeFn)(pCurrent->item);
-        markAsAvailableNode(pCurrent);
-        pCurrent = pNext;
+    if (pItemFreeFn != NULL) {
+        for (Node* pCurrent = pList->head; pCurrent != NULL; pCurrent = pCurrent->next) {
+            (*pItemFreeFn)(pCurrent->item);
+        }
     }
+    markAsAvailableChain(pList->head, pList->tail);
     resetList(pList);
     markAsAvailableList(pList);
     return;
@@ -502,12 +540,114 @@ void* List_trim(List* pList)
         pList->tail = pNode->previous;
         pList->tail->next = NULL;
         pList->current = pList->tail;
+        pList->state = within;
     }
     pList->size--;
     markAsAvailableNode(pNode);
     return pNode->item;
 }
 
+// Adds the count items of pItems to the front of pList as if each were passed to List_prepend
+// in order, and makes the new first item the current one. Either all items are added or none are.
+// Returns 0 on success, -1 on failure.
+int List_prependMany(List* pList, void** pItems, int count)
+{
+    assert((pList != NULL) && (count >= 0));
+    if (count == 0) {
+        return 0;
+    }
+    Node* pFirst = nextAvailableChain(count);
+    if (pFirst == NULL) {
+        return -1;
+    }
+    Node* pNode = pFirst;
+    for (int i = count - 1; i >= 0; i--) {
+        pNode->item = pItems[i];
+        if (i > 0) {
+            pNode = pNode->next;
+        }
+    }
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        pList->tail = pNode;
+    }
+    else {
+        assert(isNonEmptyList(pList));
+        pNode->next = pList->head;
+        pList->head->previous = pNode;
+    }
+    pList->head = pFirst;
+    pList->size += count;
+    pList->current = pFirst;
+    pList->state = within;
+    return 0;
+}
+
+// Takes up to maxItems items off the end of pList and stores them in pItems, in the order
+// repeated calls to List_trim would return them. Makes the new last item the current one.
+// Returns the number of items taken.
+int List_drain(List* pList, void** pItems, int maxItems)
+{
+    assert((pList != NULL) && (maxItems >= 0));
+    int count = (pList->size < maxItems) ? pList->size : maxItems;
+    if (count == 0) {
+        return 0;
+    }
+    assert(isNonEmptyList(pList));
+    Node* pLast = pList->tail;
+    Node* pFirst = pLast;
+    pItems[0] = pFirst->item;
+    for (int i = 1; i < count; i++) {
+        pFirst = pFirst->previous;
+        pItems[i] = pFirst->item;
+    }
+    pList->size -= count;
+    if (pList->size == 0) {
+        pList->head = NULL;
+        pList->tail = NULL;
+        pList->current = NULL;
+        pList->state = before;
+    }
+    else {
+        pList->tail = pFirst->previous;
+        pList->tail->next = NULL;
+        pList->current = pList->tail;
+        pList->state = within;
+    }
+    markAsAvailableChain(pFirst, pLast);
+    return count;
+}
+
+// Positions the current pointer on the node a search starts from.
+// Returns false if there is no node left to search.
+static bool startSearch(List* pList)
+{
+    if (pList->size == 0) {
+        assert(isEmptyList(pList));
+        pList->state = beyond;
+        return false;
+    }
+    else if (pList->state == before) {
+        assert(isNonEmptyList(pList));
+        pList->current = pList->head;
+        pList->state = within;
+    }
+    else if (pList->state == beyond) {
+        assert(isNonEmptyList(pList));
+        return false;
+    }
+    return true;
+}
+
+// Returns true if the string pItem is equal to (or starts with) the length characters of pString
+static bool matchesString(const char* pItem, const char* pString, size_t length, bool prefix)
+{
+    if ((pItem == NULL) || ((length > 0) && (pItem[0] != pString[0]))) {
+        return false;
+    }
+    return prefix ? (strncmp(pItem, pString, length) == 0) : (strcmp(pItem, pString) == 0);
+}
+
 // Search pList, starting at the current item, until the end is reached or a match is found. 
 // In this context, a match is determined by the comparator parameter. This parameter is a
 // pointer to a routine that takes as its first argument an item pointer, and as its second 
@@ -524,19 +664,7 @@ typedef bool (*COMPARATOR_FN)(void* pItem, void* pComparisonArg);
 void* List_search(List* pList, COMPARATOR_FN pComparator, void* pComparisonArg)
 {
     assert((pList != NULL) && (pComparisonArg != NULL));
-
-    if (pList->size == 0) {
-        assert(isEmptyList(pList));
-        pList->state = beyond;
-        return NULL;
-    }
-    else if (pList->state == before) {
-        assert(isNonEmptyList(pList));
-        pList->current = pList->head;
-        pList->state = within;
-    }
-    else if (pList->state == beyond) {
-        assert(isNonEmptyList(pList));
+    if (!startSearch(pList)) {
         return NULL;
     }
     Node* pCurrent = pList->current;
@@ -555,3 +683,77 @@ void* List_search(List* pList, COMPARATOR_FN pComparator, void* pComparisonArg)
     pList->state = beyond;
     return NULL;
 }
+
+// Search pList for the item pointer pItem.
+void* List_searchPointer(List* pList, void* pItem)
+{
+    assert((pList != NULL) && (pItem != NULL));
+    if (!startSearch(pList)) {
+        return NULL;
+    }
+    for (Node* pCurrent = pList->current; pCurrent != NULL; pCurrent = pCurrent->next) {
+        if (pCurrent->item == pItem) {
+            pList->current = pCurrent;
+            return pItem;
+        }
+    }
+    pList->current = NULL;
+    pList->state = beyond;
+    return NULL;
+}
+
+// Search pList, whose items are strings, for an item equal to pString.
+// If prefix is true, an item matches when it starts with pString.
+void* List_searchString(List* pList, const char* pString, bool prefix)
+{
+    assert((pList != NULL) && (pString != NULL));
+    if (!startSearch(pList)) {
+        return NULL;
+    }
+    size_t length = strlen(pString);
+    for (Node* pCurrent = pList->current; pCurrent != NULL; pCurrent = pCurrent->next) {
+        if (matchesString(pCurrent->item, pString, length, prefix)) {
+            pList->current = pCurrent;
+            return pCurrent->item;
+        }
+    }
+    pList->current = NULL;
+    pList->state = beyond;
+    return NULL;
+}
+
+// Number of items gathered from consecutive nodes for one call of a batch comparator. Half a
+// chunk of the array backend, which passes its runs in place: here the walk is bound by
+// loading each next pointer, which a longer run does not save, while gathering it costs a
+// store per item.
+#define SEARCH_BATCH_SIZE 8
+
+// Search pList with a comparator that takes a run of count consecutive items at a time.
+// Items are gathered from up to SEARCH_BATCH_SIZE nodes per run.
+void* List_searchBatch(List* pList, BATCH_COMPARATOR_FN pComparator, void* pComparisonArg)
+{
+    assert((pList != NULL) && (pComparisonArg != NULL));
+    if (!startSearch(pList)) {
+        return NULL;
+    }
+    void* items[SEARCH_BATCH_SIZE];
+    Node* pNodes[SEARCH_BATCH_SIZE];
+    Node* pCurrent = pList->current;
+    while (pCurrent != NULL) {
+        int count = 0;
+        for (; (pCurrent != NULL) && (count < SEARCH_BATCH_SIZE); pCurrent = pCurrent->next) {
+            items[count] = pCurrent->item;
+            pNodes[count] = pCurrent;
+            count++;
+        }
+        int found = (*pComparator)(items, count, pComparisonArg);
+        if (found >= 0) {
+            assert(found < count);
+            pList->current = pNodes[found];
+            return items[found];
+        }
+    }
+    pList->current = NULL;
+    pList->state = beyond;
+    return NULL;
+}
@@ -2,6 +2,45 @@
 #define _LIST_H_
 #include <stdbool.h>
 
+// Maximum number of unique lists the system can support
+#define LIST_MAX_NUM_HEADS 10
+
+// Maximum total number of nodes (statically allocated) to be shared across all lists
+#define LIST_MAX_NUM_NODES 1000
+
+#ifdef LIST_ARRAY_BACKEND
+
+// Array-backed (unrolled) variant, built from arraylist.c: items are stored contiguously in
+// chunks so traversal and search walk memory sequentially. Every chunk of a list with more
+// than one chunk is kept at least half full.
+#define LIST_CHUNK_CAPACITY 16
+
+// Enough chunks for LIST_MAX_NUM_NODES items spread across all lists
+#define LIST_MAX_NUM_CHUNKS (2 * LIST_MAX_NUM_NODES / LIST_CHUNK_CAPACITY + LIST_MAX_NUM_HEADS)
+
+typedef struct Chunk_s Chunk;
+struct Chunk_s {
+    int count;
+    Chunk* previous;
+    Chunk* next;
+    void* items[LIST_CHUNK_CAPACITY];
+};
+
+// The current item is items[currentIndex] of the current chunk.
+// Field nextAvailableList is solely used for tracking available lists
+typedef struct List_s List;
+struct List_s{
+    int size;
+    Chunk* head;
+    Chunk* tail;
+    Chunk* current;
+    int currentIndex;
+    enum PointingState{before, beyond, within} state;
+    List* nextAvailableList;
+};
+
+#else
+
 typedef struct Node_s Node;
 struct Node_s {
     void* item;
@@ -20,11 +59,7 @@ struct List_s{
     List* nextAvailableList;
 };
 
-// Maximum number of unique lists the system can support
-#define LIST_MAX_NUM_HEADS 10
-
-// Maximum total number of nodes (statically allocated) to be shared across all lists
-#define LIST_MAX_NUM_NODES 1000
+#endif
 
 // Makes a new, empty list, and returns its reference on success. 
 // Returns a NULL pointer on failure.
@@ -88,6 +123,8 @@ void List_concat(List* pList1, List* pList2);
 // It should be invoked (within List_free) as: (*pItemFreeFn)(itemToBeFreedFromNode);
 // pList and all its nodes no longer exists after the operation; its head and nodes are 
 // available for future operations.
+// pItemFreeFn may be NULL when the items are owned elsewhere; the nodes are then
+// returned to the pool in one step instead of one at a time.
 typedef void (*FREE_FN)(void* pItem);
 void List_free(List* pList, FREE_FN pItemFreeFn);
 
@@ -95,6 +132,16 @@ void List_free(List* pList, FREE_FN pItemFreeFn);
 // Return NULL if pList is initially empty.
 void* List_trim(List* pList);
 
+// Adds the count items of pItems to the front of pList as if each were passed to List_prepend
+// in order, and makes the new first item the current one. Either all items are added or none are.
+// Returns 0 on success, -1 on failure.
+int List_prependMany(List* pList, void** pItems, int count);
+
+// Takes up to maxItems items off the end of pList and stores them in pItems, in the order
+// repeated calls to List_trim would return them. Makes the new last item the current one.
+// Returns the number of items taken.
+int List_drain(List* pList, void** pItems, int maxItems);
+
 // Search pList, starting at the current item, until the end is reached or a match is found. 
 // In this context, a match is determined by the comparator parameter. This parameter is a
 // pointer to a routine that takes as its first argument an item pointer, and as its second 
@@ -110,4 +157,21 @@ void* List_trim(List* pList);
 typedef bool (*COMPARATOR_FN)(void* pItem, void* pComparisonArg);
 void* List_search(List* pList, COMPARATOR_FN pComparator, void* pComparisonArg);
 
+// Specialized forms of List_search for common comparators. They follow the same rules for
+// where the search starts and where the current pointer is left, but do not call a comparator
+// for every item. On the array backend, consecutive items are compared several at a time.
+
+// Search pList for the item pointer pItem.
+void* List_searchPointer(List* pList, void* pItem);
+
+// Search pList, whose items are strings, for an item equal to pString.
+// If prefix is true, an item matches when it starts with pString.
+void* List_searchString(List* pList, const char* pString, bool prefix);
+
+// Search pList with a comparator that takes a run of count consecutive items at a time.
+// Comparator returns the index of the first item of the run that matches pComparisonArg,
+// or -1 if none of them do.
+typedef int (*BATCH_COMPARATOR_FN)(void** pItems, int count, void* pComparisonArg);
+void* List_searchBatch(List* pList, BATCH_COMPARATOR_FN pComparator, void* pComparisonArg);
+
 #endif
@@ -0,0 +1,547 @@
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "general.h"
+#include "packet.h"
+
+// Load generator for s-talk. It simulates many peers, each with its own socket, sending
+// chat messages to one address on a schedule, and checks the chat messages its peers get
+// back (from a hub relaying them, or from "loadgen --echo") against what was sent.
+//
+// The schedule is generated from a seed, so the same options always send the same traffic.
+// --record writes when each message was actually sent, and --replay sends that again.
+// Each message is "loadgen <index>" padded to its size, the index being its place in the
+// schedule; receipts are matched on it to measure loss and latency.
+
+// Most peers, and most messages in one schedule
+#define LOADGEN_MAX_PEERS 1000
+#define LOADGEN_MAX_MESSAGES (16 * 1024 * 1024)
+
+// Messages must hold their index; s-talk displays at most MSG_MAX_LEN - 1 bytes of one
+#define LOADGEN_MIN_SIZE 24
+#define LOADGEN_MAX_SIZE (MSG_MAX_LEN - 1)
+
+// Socket receive buffer of every peer and of the echo socket, so bursts are not dropped
+// here before they are counted
+#define LOADGEN_SOCKET_BUFFER (1024 * 1024)
+
+// A send more than this late is reported as behind schedule
+#define LOADGEN_LATE_USEC 1000
+
+// One message of the schedule: when to send it, relative to the start, from which peer
+typedef struct Message_s Message;
+struct Message_s {
+    uint64_t offset;
+    uint32_t peer;
+    uint32_t size;
+};
+
+// Generation settings
+static int peerCount = 1;
+static double rate = 10;
+static int burst = 1;
+static int minSize = 64;
+static int maxSize = 64;
+static double durationSeconds = 10;
+static uint64_t seed = 1;
+static int drainMs = 1000;
+static char* recordPath = NULL;
+static char* replayPath = NULL;
+
+static Message* schedule;
+static int messageCount = 0;
+
+// Per message: when it was sent in monotonic microseconds (0 until it is), how many times
+// it came back, and the latency of its first receipt
+static atomic_ullong* sentMicros;
+static atomic_int* receipts;
+static uint64_t* latencies;
+
+static int* sockets;
+static struct sockaddr_storage target;
+static socklen_t targetLength;
+
+static atomic_bool receiving = true;
+static long lateSends = 0;
+static long sendFailures = 0;
+static long invalidReceipts = 0;
+
+static void printUsage()
+{
+    General_print("Usage: loadgen [options] [target machine name] [target port number]\n");
+    General_print("       loadgen --echo [port number]\n");
+    General_print("Options:\n");
+    General_print("  --peers N                simulate N peers, each sending from its own port (default 1)\n");
+    General_print("  --rate R                 messages per second from each peer (default 10)\n");
+    General_print("  --burst N                send messages N at a time, at the same average rate (default 1)\n");
+    General_print("  --size MIN[-MAX]         message size in bytes, uniform between MIN and MAX (default 64)\n");
+    General_print("  --duration SECONDS       how long to send for (default 10)\n");
+    General_print("  --seed N                 seed of the schedule (default 1)\n");
+    General_print("  --drain MS               how long to wait for receipts after the last send (default 1000)\n");
+    General_print("  --record FILE            write when each message was sent to FILE\n");
+    General_print("  --replay FILE            send the messages recorded in FILE instead of generating them\n");
+    General_print("  --echo                   send every datagram received on [port number] back to its source\n");
+}
+
+// Exit with an error message
+static void fail(char* message)
+{
+    General_print("Loadgen Error: ");
+    General_print(message);
+    General_print("\n");
+    exit(EXIT_FAILURE);
+}
+
+// Returns the next value of a splitmix64 stream
+static uint64_t nextRandom(uint64_t* pState)
+{
+    uint64_t z = (*pState += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Orders messages by send time, then by peer
+static int compareMessages(const void* pA, const void* pB)
+{
+    const Message* pFirst = pA;
+    const Message* pSecond = pB;
+    if (pFirst->offset != pSecond->offset) {
+        return (pFirst->offset < pSecond->offset) ? -1 : 1;
+    }
+    return (pFirst->peer < pSecond->peer) ? -1 : (pFirst->peer > pSecond->peer);
+}
+
+// Fill the schedule from the generation settings. Each peer sends a burst every
+// burst / rate seconds, starting at a random phase, with random sizes from its own stream.
+static void generateSchedule()
+{
+    uint64_t period = (uint64_t)(1000000.0 * burst / rate);
+    if (period == 0) {
+        period = 1;
+    }
+    uint64_t end = (uint64_t)(durationSeconds * 1000000);
+    double capacity = (double)peerCount * (end / period + 1) * burst;
+    if (capacity > LOADGEN_MAX_MESSAGES) {
+        fail("Too many messages; lower --peers, --rate or --duration");
+    }
+    schedule = malloc(((size_t)capacity + 1) * sizeof(*schedule));
+    if (schedule == NULL) {
+        fail("Failed to allocate the schedule");
+    }
+    for (int peer = 0; peer < peerCount; peer++) {
+        uint64_t stream = seed ^ ((uint64_t)(peer + 1) << 32);
+        for (uint64_t offset = nextRandom(&stream) % period; offset < end; offset += period) {
+            for (int i = 0; i < burst; i++) {
+                Message* pMessage = &schedule[messageCount++];
+                pMessage->offset = offset;
+                pMessage->peer = peer;
+                pMessage->size = minSize + nextRandom(&stream) % (maxSize - minSize + 1);
+            }
+        }
+    }
+    qsort(schedule, messageCount, sizeof(*schedule), compareMessages);
+}
+
+// Read the schedule from a trace written by --record: one "offset peer size" line per message,
+// with the offset in microseconds; lines starting with '#' are comments
+static void readSchedule(const char* path)
+{
+    FILE* pFile = fopen(path, "r");
+    if (pFile == NULL) {
+        fail("Failed to open the trace to replay");
+    }
+    int capacity = 1024;
+    schedule = malloc(capacity * sizeof(*schedule));
+    peerCount = 0;
+    char line[128];
+    while ((schedule != NULL) && (fgets(line, sizeof(line), pFile) != NULL)) {
+        if (line[0] == '#') {
+            continue;
+        }
+        unsigned long long offset;
+        unsigned int peer;
+        unsigned int size;
+        if ((sscanf(line, "%llu %u %u", &offset, &peer, &size) != 3) || (peer >= LOADGEN_MAX_PEERS)
+            || (size < LOADGEN_MIN_SIZE) || (size > LOADGEN_MAX_SIZE) || (messageCount == LOADGEN_MAX_MESSAGES)) {
+            fail("Malformed trace");
+        }
+        if (messageCount == capacity) {
+            capacity *= 2;
+            schedule = realloc(schedule, capacity * sizeof(*schedule));
+            if (schedule == NULL) {
+                break;
+            }
+        }
+        schedule[messageCount++] = (Message){.offset = offset, .peer = peer, .size = size};
+        if ((int)peer >= peerCount) {
+            peerCount = peer + 1;
+        }
+    }
+    fclose(pFile);
+    if (schedule == NULL) {
+        fail("Failed to allocate the schedule");
+    }
+    if (messageCount == 0) {
+        fail("The trace has no messages");
+    }
+    qsort(schedule, messageCount, sizeof(*schedule), compareMessages);
+}
+
+// Write when each message was sent, relative to the first send, in the format readSchedule() reads
+static void writeTrace(const char* path)
+{
+    FILE* pFile = fopen(path, "w");
+    if (pFile == NULL) {
+        General_print("Loadgen Error: Failed to write the trace\n");
+        return;
+    }
+    fprintf(pFile, "# loadgen trace: offset (microseconds) peer size\n");
+    uint64_t start = 0;
+    for (int i = 0; i < messageCount; i++) {
+        uint64_t sent = sentMicros[i];
+        if (sent == 0) {
+            continue;
+        }
+        if (start == 0) {
+            start = sent;
+        }
+        fprintf(pFile, "%llu %u %u\n", (unsigned long long)(sent - start), schedule[i].peer, schedule[i].size);
+    }
+    fclose(pFile);
+}
+
+// Create one socket per peer, of the target's family, each bound to its own port
+static void openSockets()
+{
+    sockets = malloc(peerCount * sizeof(*sockets));
+    if (sockets == NULL) {
+        fail("Failed to allocate the sockets");
+    }
+    for (int peer = 0; peer < peerCount; peer++) {
+        sockets[peer] = socket(target.ss_family, SOCK_DGRAM, 0);
+        if (sockets[peer] == -1) {
+            fail("Failed to create a socket for every peer; raise the open file limit or lower --peers");
+        }
+        int bufferSize = LOADGEN_SOCKET_BUFFER;
+        setsockopt(sockets[peer], SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    }
+}
+
+// Returns the index of the message in a chat datagram of length bytes, or -1 if it is not
+// one this run sent
+static int parseReceipt(const uint8_t* datagram, int length)
+{
+    PacketHeader header;
+    if ((Packet_decodeHeader(datagram, length, &header) != 0) || (header.type != PACKET_CHAT)) {
+        return -1;
+    }
+    char text[LOADGEN_MIN_SIZE];
+    int textLength = length - PACKET_HEADER_LEN;
+    if (textLength < LOADGEN_MIN_SIZE) {
+        return -1;
+    }
+    memcpy(text, &datagram[PACKET_HEADER_LEN], sizeof(text) - 1);
+    text[sizeof(text) - 1] = 0;
+    unsigned int index;
+    if ((sscanf(text, "loadgen %u", &index) != 1) || (index >= (unsigned int)messageCount)
+        || (schedule[index].size != (uint32_t)textLength) || (sentMicros[index] == 0)) {
+        return -1;
+    }
+    return index;
+}
+
+// Match the chat messages every peer receives against the ones sent, and answer keepalives
+// so a hub keeps the peers alive, until the sends have drained
+void* receiveThread()
+{
+    struct pollfd* fds = malloc(peerCount * sizeof(*fds));
+    if (fds == NULL) {
+        fail("Failed to allocate the poll set");
+    }
+    for (int peer = 0; peer < peerCount; peer++) {
+        fds[peer] = (struct pollfd){.fd = sockets[peer], .events = POLLIN};
+    }
+    uint8_t datagram[PACKET_MAX_LEN];
+    while (receiving) {
+        if (poll(fds, peerCount, 100) <= 0) {
+            continue;
+        }
+        for (int peer = 0; peer < peerCount; peer++) {
+            if (fds[peer].revents == 0) {
+                continue;
+            }
+            struct sockaddr_storage source;
+            socklen_t sourceLength = sizeof(source);
+            int length;
+            while ((length = recvfrom(sockets[peer], datagram, sizeof(datagram), MSG_DONTWAIT, (struct sockaddr*)&source, &sourceLength)) >= 0) {
+                PacketHeader header;
+                if ((Packet_decodeHeader(datagram, length, &header) == 0) && (header.type == PACKET_KEEPALIVE)) {
+                    datagram[1] = PACKET_KEEPALIVE_ACK;
+                    sendto(sockets[peer], datagram, PACKET_HEADER_LEN, 0, (struct sockaddr*)&source, sourceLength);
+                    continue;
+                }
+                int index = parseReceipt(datagram, length);
+                if (index < 0) {
+                    invalidReceipts++;
+                }
+                else if (receipts[index]++ == 0) {
+                    latencies[index] = General_monotonicMicros() - sentMicros[index];
+                }
+                sourceLength = sizeof(source);
+            }
+        }
+    }
+    free(fds);
+    return NULL;
+}
+
+// Send every message of the schedule when it is due, or at once if sending is behind
+static void sendSchedule()
+{
+    uint32_t* sequences = malloc(peerCount * sizeof(*sequences));
+    if (sequences == NULL) {
+        fail("Failed to allocate the sequence numbers");
+    }
+    uint64_t stream = seed;
+    for (int peer = 0; peer < peerCount; peer++) {
+        sequences[peer] = (uint32_t)nextRandom(&stream);
+    }
+    char text[LOADGEN_MAX_SIZE + 1];
+    memset(text, '.', sizeof(text));
+    uint64_t start = General_monotonicMicros();
+    for (int i = 0; i < messageCount; i++) {
+        const Message* pMessage = &schedule[i];
+        uint64_t due = start + pMessage->offset;
+        uint64_t now = General_monotonicMicros();
+        if (due > now) {
+            struct timespec deadline = {.tv_sec = due / 1000000, .tv_nsec = (due % 1000000) * 1000};
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {
+            }
+        }
+        else if (now - due > LOADGEN_LATE_USEC) {
+            lateSends++;
+        }
+
+        int prefixLength = snprintf(text, sizeof(text), "loadgen %d ", i);
+        text[prefixLength] = '.';
+        text[pMessage->size - 1] = '\n';
+        PacketHeader header = {.type = PACKET_CHAT, .flags = 0, .sequence = sequences[pMessage->peer]++, .timestamp = General_monotonicMicros()};
+        uint8_t datagram[PACKET_HEADER_LEN + LOADGEN_MAX_SIZE];
+        Packet_encodeHeader(&header, datagram);
+        memcpy(&datagram[PACKET_HEADER_LEN], text, pMessage->size);
+        sentMicros[i] = header.timestamp;
+        if (sendto(sockets[pMessage->peer], datagram, PACKET_HEADER_LEN + pMessage->size, 0, (struct sockaddr*)&target, targetLength) < 0) {
+            sentMicros[i] = 0;
+            sendFailures++;
+        }
+        text[pMessage->size - 1] = '.';
+    }
+    free(sequences);
+}
+
+// Orders latencies
+static int compareLatencies(const void* pA, const void* pB)
+{
+    uint64_t first = *(const uint64_t*)pA;
+    uint64_t second = *(const uint64_t*)pB;
+    return (first > second) - (first < second);
+}
+
+// Display what was sent and received, and the latency distribution of the messages that came back
+static void printReport(uint64_t elapsedMicros)
+{
+    long sent = 0;
+    long delivered = 0;
+    long extraReceipts = 0;
+    uint64_t* sorted = malloc((messageCount + 1) * sizeof(*sorted));
+    for (int i = 0; i < messageCount; i++) {
+        if (sentMicros[i] == 0) {
+            continue;
+        }
+        sent++;
+        if (receipts[i] > 0) {
+            extraReceipts += receipts[i] - 1;
+            if (sorted != NULL) {
+                sorted[delivered] = latencies[i];
+            }
+            delivered++;
+        }
+    }
+    char report[512];
+    snprintf(report, sizeof(report), "Sent %ld messages from %d peers in %.3f s (%.0f/s), %ld behind schedule, %ld failed\n"
+        "Received %ld (%.3f%% lost), %ld extra receipts, %ld invalid\n",
+        sent, peerCount, elapsedMicros / 1e6, sent * 1e6 / (elapsedMicros ? elapsedMicros : 1), lateSends, sendFailures,
+        delivered, sent ? 100.0 * (sent - delivered) / sent : 0.0, extraReceipts, invalidReceipts);
+    General_print(report);
+    if ((sorted != NULL) && (delivered > 0)) {
+        qsort(sorted, delivered, sizeof(*sorted), compareLatencies);
+        snprintf(report, sizeof(report), "Latency (us): min %llu, p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+            (unsigned long long)sorted[0], (unsigned long long)sorted[delivered / 2],
+            (unsigned long long)sorted[delivered * 9 / 10], (unsigned long long)sorted[delivered * 99 / 100],
+            (unsigned long long)sorted[delivered * 999 / 1000], (unsigned long long)sorted[delivered - 1]);
+        General_print(report);
+    }
+    free(sorted);
+}
+
+// Send every datagram received on port back to where it came from, until killed
+static void echo(char* port)
+{
+    General_socketInit(port);
+    int bufferSize = LOADGEN_SOCKET_BUFFER;
+    setsockopt(socketDescriptor, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    uint8_t datagram[PACKET_RECEIVE_LEN];
+    while (1) {
+        struct sockaddr_storage source;
+        socklen_t sourceLength = sizeof(source);
+        int length = recvfrom(socketDescriptor, datagram, sizeof(datagram), 0, (struct sockaddr*)&source, &sourceLength);
+        if (length >= 0) {
+            sendto(socketDescriptor, datagram, length, 0, (struct sockaddr*)&source, sourceLength);
+        }
+    }
+}
+
+// Applies the command-line options, and returns the index of the first positional argument
+static int parseOptions(int argc, char** args, bool* pEcho)
+{
+    static struct option options[] = {
+        {"peers", required_argument, NULL, 'p'},
+        {"rate", required_argument, NULL, 'r'},
+        {"burst", required_argument, NULL, 'b'},
+        {"size", required_argument, NULL, 's'},
+        {"duration", required_argument, NULL, 'd'},
+        {"seed", required_argument, NULL, 'S'},
+        {"drain", required_argument, NULL, 'D'},
+        {"record", required_argument, NULL, 'w'},
+        {"replay", required_argument, NULL, 'R'},
+        {"echo", no_argument, NULL, 'e'},
+        {NULL, 0, NULL, 0}
+    };
+    int option;
+    while ((option = getopt_long(argc, args, "", options, NULL)) != -1) {
+        bool valid = true;
+        if (option == 'p') {
+            peerCount = atoi(optarg);
+            valid = (peerCount >= 1) && (peerCount <= LOADGEN_MAX_PEERS);
+        }
+        else if (option == 'r') {
+            rate = atof(optarg);
+            valid = (rate > 0);
+        }
+        else if (option == 'b') {
+            burst = atoi(optarg);
+            valid = (burst >= 1);
+        }
+        else if (option == 's') {
+            int count = sscanf(optarg, "%d-%d", &minSize, &maxSize);
+            if (count == 1) {
+                maxSize = minSize;
+            }
+            valid = (count >= 1) && (minSize >= LOADGEN_MIN_SIZE) && (maxSize >= minSize) && (maxSize <= LOADGEN_MAX_SIZE);
+        }
+        else if (option == 'd') {
+            durationSeconds = atof(optarg);
+            valid = (durationSeconds > 0);
+        }
+        else if (option == 'S') {
+            seed = strtoull(optarg, NULL, 10);
+        }
+        else if (option == 'D') {
+            drainMs = atoi(optarg);
+            valid = (drainMs >= 0);
+        }
+        else if (option == 'w') {
+            recordPath = optarg;
+        }
+        else if (option == 'R') {
+            replayPath = optarg;
+        }
+        else if (option == 'e') {
+            *pEcho = true;
+        }
+        else {
+            valid = false;
+        }
+        if (!valid) {
+            printUsage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    return optind;
+}
+
+int main(int argc, char** args)
+{
+    bool echoMode = false;
+    int first = parseOptions(argc, args, &echoMode);
+    if (echoMode) {
+        if (argc - first != 1) {
+            printUsage();
+            return EXIT_FAILURE;
+        }
+        echo(args[first]);
+    }
+    if (argc - first != 2) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM};
+    struct addrinfo* pResult;
+    if (getaddrinfo(args[first], args[first + 1], &hints, &pResult) != 0) {
+        fail("Failed to resolve the target machine name");
+    }
+    memcpy(&target, pResult->ai_addr, pResult->ai_addrlen);
+    targetLength = pResult->ai_addrlen;
+    freeaddrinfo(pResult);
+
+    if (replayPath != NULL) {
+        readSchedule(replayPath);
+    }
+    else {
+        generateSchedule();
+    }
+    sentMicros = calloc(messageCount + 1, sizeof(*sentMicros));
+    receipts = calloc(messageCount + 1, sizeof(*receipts));
+    latencies = calloc(messageCount + 1, sizeof(*latencies));
+    if ((sentMicros == NULL) || (receipts == NULL) || (latencies == NULL)) {
+        fail("Failed to allocate the message table");
+    }
+    openSockets();
+
+    pthread_t receiveThreadPID;
+    if (pthread_create(&receiveThreadPID, NULL, receiveThread, NULL) != 0) {
+        fail("Failed to create the receive thread");
+    }
+    uint64_t start = General_monotonicMicros();
+    sendSchedule();
+    uint64_t elapsed = General_monotonicMicros() - start;
+    struct timespec drain = {.tv_sec = drainMs / 1000, .tv_nsec = (drainMs % 1000) * 1000000L};
+    nanosleep(&drain, NULL);
+    receiving = false;
+    pthread_join(receiveThreadPID, NULL);
+
+    printReport(elapsed);
+    if (recordPath != NULL) {
+        writeTrace(recordPath);
+    }
+    for (int peer = 0; peer < peerCount; peer++) {
+        close(sockets[peer]);
+    }
+    free(sockets);
+    free(schedule);
+    free((void*)sentMicros);
+    free((void*)receipts);
+    free(latencies);
+    return 0;
+}
@@ -0,0 +1,321 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "general.h"
+#include "log.h"
+
+// Longest formatted line, with its timestamp, level and suppressed count
+#define LOG_LINE_LEN (LOG_TEXT_LEN + 64)
+
+// Slots of the per-thread table of recently logged messages, keyed by their hash
+#define LOG_LIMIT_SLOTS 32
+
+typedef struct Entry_s Entry;
+struct Entry_s {
+    uint64_t micros;
+    enum LogLevel level;
+    uint32_t suppressed;
+    char text[LOG_TEXT_LEN];
+};
+
+// How often one message was logged in its current window
+typedef struct Limit_s Limit;
+struct Limit_s {
+    char text[LOG_TEXT_LEN];
+    uint32_t hash;
+    uint64_t windowStart;
+    int count;
+    uint32_t suppressed;
+};
+
+// Single-producer, single-consumer ring. The owning thread fills entries and advances head;
+// the drain advances tail. A ring whose thread exited is reused by the next new thread.
+typedef struct Ring_s Ring;
+struct Ring_s {
+    atomic_uint head;
+    atomic_uint tail;
+    atomic_bool owned;
+    atomic_long lost;
+    Limit limits[LOG_LIMIT_SLOTS];
+    Entry entries[LOG_RING_ENTRIES];
+};
+
+static Ring* rings[LOG_MAX_THREADS];
+static atomic_int ringCount = 0;
+static pthread_mutex_t registerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ringKey;
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+
+static int logDescriptor = STDERR_FILENO;
+static atomic_int minimumLevel = LOG_INFO;
+static uint64_t startMicros;
+
+// Only one drain runs at a time: the background thread's, or the exit handler's
+static pthread_mutex_t drainMutex = PTHREAD_MUTEX_INITIALIZER;
+static char output[16 * LOG_LINE_LEN];
+static int outputLength = 0;
+static pthread_t threadPID;
+static bool started = false;
+static atomic_bool stopping = false;
+
+static const char* levelNames[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+static const char* levelOptions[] = {"debug", "info", "warn", "error"};
+
+// Format an entry as a line of line, which holds LOG_LINE_LEN bytes
+// Returns the length of the line
+static int formatEntry(char* line, uint64_t micros, enum LogLevel level, uint32_t suppressed, const char* text)
+{
+    uint64_t elapsed = (micros > startMicros) ? (micros - startMicros) : 0;
+    int length = snprintf(line, LOG_LINE_LEN - 1, "[%6llu.%06llu] %-5s %.*s", (unsigned long long)(elapsed / 1000000),
+        (unsigned long long)(elapsed % 1000000), levelNames[level], (int)strcspn(text, "\n"), text);
+    if (suppressed > 0) {
+        length += snprintf(&line[length], LOG_LINE_LEN - 1 - length, " (%u more suppressed)", suppressed);
+    }
+    line[length++] = '\n';
+    return length;
+}
+
+// Write length bytes of buffer to the log
+static void writeLog(const char* buffer, int length)
+{
+    if (write(logDescriptor, buffer, length) < 0) {
+        // Nowhere left to report it
+    }
+}
+
+// Add an entry to the drain's output, writing it out when full
+// Must be called with drainMutex held
+static void appendEntry(uint64_t micros, enum LogLevel level, uint32_t suppressed, const char* text)
+{
+    if (outputLength + LOG_LINE_LEN > (int)sizeof(output)) {
+        writeLog(output, outputLength);
+        outputLength = 0;
+    }
+    outputLength += formatEntry(&output[outputLength], micros, level, suppressed, text);
+}
+
+// Write every entry queued on every ring
+static void drain()
+{
+    pthread_mutex_lock(&drainMutex);
+    {
+        int count = ringCount;
+        for (int i = 0; i < count; i++) {
+            Ring* pRing = rings[i];
+            unsigned int tail = atomic_load_explicit(&pRing->tail, memory_order_relaxed);
+            unsigned int head = atomic_load_explicit(&pRing->head, memory_order_acquire);
+            for (; tail != head; tail++) {
+                Entry* pEntry = &pRing->entries[tail % LOG_RING_ENTRIES];
+                appendEntry(pEntry->micros, pEntry->level, pEntry->suppressed, pEntry->text);
+            }
+            atomic_store_explicit(&pRing->tail, tail, memory_order_release);
+            long lost = atomic_exchange(&pRing->lost, 0);
+            if (lost > 0) {
+                char text[64];
+                snprintf(text, sizeof(text), "%ld log messages lost to a full ring", lost);
+                appendEntry(General_monotonicMicros(), LOG_WARN, 0, text);
+            }
+        }
+        if (outputLength > 0) {
+            writeLog(output, outputLength);
+            outputLength = 0;
+        }
+    }
+    pthread_mutex_unlock(&drainMutex);
+}
+
+// Releases the ring of an exiting thread for reuse
+static void releaseRing(void* pRing)
+{
+    atomic_store(&((Ring*)pRing)->owned, false);
+}
+
+// Set up the thread key, the clock origin and the exit handler, once
+static void initialize()
+{
+    pthread_key_create(&ringKey, releaseRing);
+    startMicros = General_monotonicMicros();
+    atexit(drain);
+}
+
+// Returns the calling thread's ring, taking one on its first call
+// Returns NULL if every ring is taken
+static Ring* ringOfThread()
+{
+    pthread_once(&initOnce, initialize);
+    Ring* pRing = pthread_getspecific(ringKey);
+    if (pRing != NULL) {
+        return pRing;
+    }
+    pthread_mutex_lock(&registerMutex);
+    {
+        // Reuse a released ring, once its entries are written, before adding one
+        for (int i = 0; (i < ringCount) && (pRing == NULL); i++) {
+            if (!rings[i]->owned && (rings[i]->head == rings[i]->tail)) {
+                pRing = rings[i];
+                memset(pRing->limits, 0, sizeof(pRing->limits));
+            }
+        }
+        if ((pRing == NULL) && (ringCount < LOG_MAX_THREADS)) {
+            pRing = calloc(1, sizeof(Ring));
+            if (pRing != NULL) {
+                rings[ringCount] = pRing;
+                atomic_fetch_add(&ringCount, 1);
+            }
+        }
+        if (pRing != NULL) {
+            pRing->owned = true;
+            pthread_setspecific(ringKey, pRing);
+        }
+    }
+    pthread_mutex_unlock(&registerMutex);
+    return pRing;
+}
+
+// Count message against its burst limit
+// Returns -1 if it should be suppressed, otherwise how many copies were suppressed before it
+static int64_t checkLimit(Ring* pRing, const char* message, uint64_t now)
+{
+    uint32_t hash = 2166136261u;
+    for (const char* pChar = message; *pChar != 0; pChar++) {
+        hash = (hash ^ (uint8_t)*pChar) * 16777619u;
+    }
+    Limit* pLimit = &pRing->limits[hash % LOG_LIMIT_SLOTS];
+    uint32_t carried = 0;
+    if ((pLimit->hash != hash) || (pLimit->count == 0)) {
+        pLimit->hash = hash;
+        pLimit->windowStart = now;
+        pLimit->count = 0;
+        pLimit->suppressed = 0;
+        snprintf(pLimit->text, sizeof(pLimit->text), "%s", message);
+    }
+    else if (now - pLimit->windowStart >= LOG_BURST_WINDOW_MS * 1000) {
+        carried = pLimit->suppressed;
+        pLimit->windowStart = now;
+        pLimit->count = 0;
+        pLimit->suppressed = 0;
+    }
+    if (++pLimit->count > LOG_BURST) {
+        pLimit->suppressed++;
+        return -1;
+    }
+    return carried;
+}
+
+// Write entries to the file at path, appended, instead of stderr
+int Log_open(const char* path)
+{
+    int descriptor = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (descriptor < 0) {
+        return -1;
+    }
+    if (logDescriptor != STDERR_FILENO) {
+        close(logDescriptor);
+    }
+    logDescriptor = descriptor;
+    return 0;
+}
+
+// Drop entries below the level called name
+int Log_setLevel(const char* name)
+{
+    for (int level = LOG_DEBUG; level <= LOG_ERROR; level++) {
+        if (strcmp(name, levelOptions[level]) == 0) {
+            minimumLevel = level;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Record message at level: copy it to the calling thread's ring, unless it is over its burst
+void Log_write(enum LogLevel level, const char* message)
+{
+    if (level < minimumLevel) {
+        return;
+    }
+    uint64_t now = General_monotonicMicros();
+    Ring* pRing = ringOfThread();
+    if (pRing == NULL) {
+        char line[LOG_LINE_LEN];
+        writeLog(line, formatEntry(line, now, level, 0, message));
+        return;
+    }
+    int64_t suppressed = checkLimit(pRing, message, now);
+    if (suppressed < 0) {
+        return;
+    }
+    unsigned int head = atomic_load_explicit(&pRing->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&pRing->tail, memory_order_acquire);
+    if (head - tail == LOG_RING_ENTRIES) {
+        pRing->lost++;
+        return;
+    }
+    Entry* pEntry = &pRing->entries[head % LOG_RING_ENTRIES];
+    pEntry->micros = now;
+    pEntry->level = level;
+    pEntry->suppressed = suppressed;
+    snprintf(pEntry->text, sizeof(pEntry->text), "%s", message);
+    atomic_store_explicit(&pRing->head, head + 1, memory_order_release);
+}
+
+// Writes queued entries every LOG_FLUSH_MS until stopped
+void* logThread()
+{
+    struct timespec interval = {.tv_sec = 0, .tv_nsec = LOG_FLUSH_MS * 1000000L};
+    while (!stopping) {
+        nanosleep(&interval, NULL);
+        drain();
+    }
+    return NULL;
+}
+
+// Start background thread that writes entries
+void Log_start()
+{
+    pthread_once(&initOnce, initialize);
+    if (pthread_create(&threadPID, NULL, logThread, NULL) != 0) {
+        // Entries are still written at exit
+        General_print("Log Thread Error: Failed to create the log thread\n");
+        return;
+    }
+    started = true;
+}
+
+// Report suppressed messages, then stop background thread and write what is left
+void Log_shutdown()
+{
+    // Written before the join, after the entries queued ahead of them, so the counts are out
+    // even if the join or the exit handler never completes
+    drain();
+    pthread_mutex_lock(&drainMutex);
+    {
+        for (int i = 0; i < ringCount; i++) {
+            for (int slot = 0; slot < LOG_LIMIT_SLOTS; slot++) {
+                Limit* pLimit = &rings[i]->limits[slot];
+                if (pLimit->suppressed > 0) {
+                    appendEntry(General_monotonicMicros(), LOG_WARN, pLimit->suppressed, pLimit->text);
+                    pLimit->suppressed = 0;
+                }
+            }
+        }
+        if (outputLength > 0) {
+            writeLog(output, outputLength);
+            outputLength = 0;
+        }
+    }
+    pthread_mutex_unlock(&drainMutex);
+    if (started) {
+        stopping = true;
+        pthread_join(threadPID, NULL);
+        started = false;
+    }
+    drain();
+}
@@ -0,0 +1,44 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+// Diagnostics, kept apart from the chat on stdout. Log_write() copies the message and a binary
+// timestamp into a ring owned by the calling thread, without locking or formatting; a
+// background thread drains every ring, formats the entries and writes them to the log file,
+// stderr by default. A message repeated more than LOG_BURST times within LOG_BURST_WINDOW_MS
+// by one thread is counted instead of queued, and the count is reported with its next copy.
+// Entries still queued when the program exits are written by an exit handler.
+
+enum LogLevel {LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR};
+
+// Entries per thread ring, longest message kept, and most threads with a ring at once;
+// further threads write synchronously
+#define LOG_RING_ENTRIES 256
+#define LOG_TEXT_LEN 160
+#define LOG_MAX_THREADS 64
+
+// Milliseconds between drains of the rings
+#define LOG_FLUSH_MS 20
+
+// Copies of one message a thread may log per window; the rest are counted
+#define LOG_BURST 5
+#define LOG_BURST_WINDOW_MS 1000
+
+// Write entries to the file at path, appended, instead of stderr
+// Returns 0 on success, -1 if it cannot be opened
+int Log_open(const char* path);
+
+// Drop entries below the level called name: "debug", "info" (default), "warn" or "error"
+// Returns 0 on success, -1 if name is not a level
+int Log_setLevel(const char* name);
+
+// Record message at level, from any thread
+void Log_write(enum LogLevel level, const char* message);
+
+// Start background thread that writes entries
+void Log_start();
+
+// Once every other thread has finished, report counts of suppressed messages, then stop
+// background thread and write what is left
+void Log_shutdown();
+
+#endif
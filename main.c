@@ -1,15 +1,199 @@
+#include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "config.h"
+#include "control.h"
+#include "flow.h"
 #include "general.h"
+#include "impair.h"
 #include "input.h"
+#include "log.h"
 #include "sender.h"
 #include "receiver.h"
+#include "relay.h"
+#include "room.h"
 #include "printer.h"
+#include "timer.h"
+#include "trace.h"
+#include "transfer.h"
+#include "resolver.h"
+#include "scheduler.h"
+#include "shm.h"
+
+static void printUsage()
+{
+    General_print("Usage: s-talk [options] [local port number] [remote machine name] [remote port number]\n");
+    General_print("Options:\n");
+    General_print("  --pin ROLE=CPUS          run the ROLE thread on CPUS (e.g. receiver=2 or sender=0,2-3)\n");
+    General_print("  --fifo ROLE=PRIORITY     run the ROLE thread under SCHED_FIFO with PRIORITY\n");
+    General_print("  --irq-interface NAME     run the receiver thread on the CPUs serving NAME's interrupts\n");
+    General_print("  --busy-poll              spin while waiting for messages, for lower latency at the cost of CPU\n");
+    General_print("  --no-offload             send file chunks one datagram at a time, without UDP GSO/GRO\n");
+    General_print("  --no-shm                 use UDP even when the remote user is on this host\n");
+    General_print("  --impair SETTINGS        simulate a lossy, slow link for what this end sends, e.g.\n");
+    General_print("                           loss=0.02,dup=0.01,delay=40,jitter=10,dist=normal,reorder=0.05,seed=7\n");
+    General_print("  --relay                  forward every message to all other peers instead of displaying it\n");
+    General_print("  --config FILE            read options from FILE, one per line; the command line overrides it\n");
+    General_print("  --control PATH           accept \"get\", \"set NAME VALUE\" and \"top\" commands on a Unix socket at PATH\n");
+    General_print("  --rcvbuf BYTES           socket receive buffer size\n");
+    General_print("  --sndbuf BYTES           socket send buffer size\n");
+    General_print("  --batch N                messages taken off a queue at once (1-32, default 32)\n");
+    General_print("  --rate N                 most messages sent per second (default 0, no limit)\n");
+    General_print("  --send-queue N           most messages waiting to be sent (default 1000)\n");
+    General_print("  --receive-queue N        most messages waiting to be displayed (default 1000)\n");
+    General_print("  --peer-rate N            most chat messages received per second from one source (default 0, no limit)\n");
+    General_print("  --peer-share PERCENT     most of the receive queue one source may fill (default 100)\n");
+    General_print("  --max-file MEGABYTES     largest file accepted from the remote user (default 1024)\n");
+    General_print("  --report SECONDS         log the sources that sent the most every SECONDS (default 0, never)\n");
+    General_print("  --log FILE               append diagnostics to FILE instead of stderr\n");
+    General_print("  --log-level LEVEL        log only LEVEL and above: debug, info (default), warn or error\n");
+    General_print("  --trace FILE             time each message through every stage and write the spans to FILE\n");
+    General_print("ROLE is one of input, sender, receiver or printer.\n");
+}
+
+// Whether file transfers may use UDP segmentation and receive offload
+static bool offload = true;
+
+// Path of the control socket, or NULL for none
+static char* controlPath = NULL;
+
+static struct option options[] = {
+    {"pin", required_argument, NULL, 'p'},
+    {"fifo", required_argument, NULL, 'f'},
+    {"irq-interface", required_argument, NULL, 'q'},
+    {"busy-poll", no_argument, NULL, 'b'},
+    {"no-offload", no_argument, NULL, 'o'},
+    {"no-shm", no_argument, NULL, 'm'},
+    {"impair", required_argument, NULL, 'i'},
+    {"relay", no_argument, NULL, 'r'},
+    {"config", required_argument, NULL, 'c'},
+    {"control", required_argument, NULL, 'C'},
+    {"rcvbuf", required_argument, NULL, 't'},
+    {"sndbuf", required_argument, NULL, 't'},
+    {"batch", required_argument, NULL, 't'},
+    {"rate", required_argument, NULL, 't'},
+    {"send-queue", required_argument, NULL, 't'},
+    {"receive-queue", required_argument, NULL, 't'},
+    {"peer-rate", required_argument, NULL, 't'},
+    {"peer-share", required_argument, NULL, 't'},
+    {"max-file", required_argument, NULL, 't'},
+    {"report", required_argument, NULL, 't'},
+    {"log", required_argument, NULL, 'l'},
+    {"log-level", required_argument, NULL, 'L'},
+    {"trace", required_argument, NULL, 'T'},
+    {NULL, 0, NULL, 0}
+};
+
+// Applies the option with the given short code and long name, with value NULL for options
+// without one
+// Returns 0 on success, -1 if value is invalid
+static int applyOption(int code, const char* name, const char* value)
+{
+    if (code == 'p') {
+        return Scheduler_setAffinity(value);
+    }
+    if (code == 'f') {
+        return Scheduler_setPriority(value);
+    }
+    if (code == 'q') {
+        return Scheduler_pinToInterfaceIrq(THREAD_RECEIVER, value);
+    }
+    if (code == 'b') {
+        Receiver_enableBusyPoll();
+        return 0;
+    }
+    if (code == 'o') {
+        offload = false;
+        return 0;
+    }
+    if (code == 'm') {
+        Shm_disable();
+        return 0;
+    }
+    if (code == 'i') {
+        return Impair_configure(value);
+    }
+    if (code == 'r') {
+        Relay_enable();
+        return 0;
+    }
+    if (code == 'C') {
+        free(controlPath);
+        controlPath = strdup(value);
+        return 0;
+    }
+    if (code == 'l') {
+        return Log_open(value);
+    }
+    if (code == 'L') {
+        return Log_setLevel(value);
+    }
+    if (code == 'T') {
+        Trace_enable(value);
+        return 0;
+    }
+    if (code == 't') {
+        return (Config_set(name, value) == 0) ? 0 : -1;
+    }
+    return -1;
+}
+
+// Applies an option read from the configuration file
+// Returns 0 on success, -1 if it is unknown or invalid
+static int applyConfigOption(const char* name, const char* value)
+{
+    for (struct option* pOption = options; pOption->name != NULL; pOption++) {
+        if (strcmp(pOption->name, name) != 0) {
+            continue;
+        }
+        if ((pOption->val == 'c') || ((pOption->has_arg == required_argument) != (value != NULL))) {
+            return -1;
+        }
+        return applyOption(pOption->val, name, value);
+    }
+    return -1;
+}
+
+// Applies the configuration file, if one is given, then the command-line options, and
+// returns the index of the first positional argument
+static int parseOptions(int argc, char** args)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* path = NULL;
+        if ((strcmp(args[i], "--config") == 0) && (i + 1 < argc)) {
+            path = args[i + 1];
+        }
+        else if (strncmp(args[i], "--config=", strlen("--config=")) == 0) {
+            path = &args[i][strlen("--config=")];
+        }
+        if ((path != NULL) && (Config_load(path, applyConfigOption) != 0)) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int option;
+    int index;
+    while ((option = getopt_long(argc, args, "", options, &index)) != -1) {
+        if ((option != 'c') && ((option == '?') || (applyOption(option, options[index].name, optarg) != 0))) {
+            printUsage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    return optind;
+}
 
 int main(int argc, char** args)
 {
-    char* port = args[1];
-    char* remoteMachineName = args[2];
-    char* remotePort = args[3];
+    int first = parseOptions(argc, args);
+    if (argc - first != 3) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    char* port = args[first];
+    char* remoteMachineName = args[first + 1];
+    char* remotePort = args[first + 2];
     General_print("WELCOME TO S-TALK\n");
     General_print("===============================================================\n");
     General_print("Your port number: ");
@@ -20,19 +204,52 @@ int main(int argc, char** args)
     General_print(remotePort);
     General_print("\n\n");
 
+    // Everything is set up before the first thread starts, and consumers start before producers
+    Log_start();
+    General_shutdownInit();
     General_socketInit(port);
     Input_init();
     Sender_init(remoteMachineName, remotePort);
+    Transfer_init(remoteMachineName, remotePort, offload);
+    Config_applySocketBuffers();
     Receiver_init();
-    Printer_init();
+    Shm_init(port);
+
+    Resolver_start();
+    Timer_start();
+    Flow_start();
+    Impair_start();
+    Shm_start();
+    if (controlPath != NULL) {
+        Control_start(controlPath);
+    }
+    Printer_start();
+    Sender_start();
+    Receiver_start();
+    Input_start();
 
     General_waitForTermination();
 
-    Printer_shutdown();
-    Receiver_shutdown();
+    // Producers wake up and close their lists; each consumer then flushes its list
+    // before the shutdown deadline, and is joined before the list it reads is freed
+    General_beginShutdown();
+    Timer_shutdown();
+    Control_shutdown();
     Sender_shutdown();
     Input_shutdown();
+    Printer_shutdown();
+    Receiver_shutdown();
+    Room_shutdown();
+    Transfer_shutdown();
+    Shm_shutdown();
+    Impair_shutdown();
+    Resolver_shutdown();
+    General_printStats();
+    Trace_shutdown();
     General_cleanup();
+    Arena_cleanup();
+    free(controlPath);
+    Log_shutdown();
 
     General_print("EXITING S-TALK\n");
     return 0;
@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "general.h"
+#include "impair.h"
+#include "packet.h"
+
+static bool segmentationEnabled = false;
+
+// Stores value in bytes big-endian bytes at buffer
+void Packet_writeBigEndian(uint8_t* buffer, uint64_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--) {
+        buffer[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+// Returns the value stored in bytes big-endian bytes at buffer
+uint64_t Packet_readBigEndian(const uint8_t* buffer, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value = (value << 8) | buffer[i];
+    }
+    return value;
+}
+
+// Write pHeader to the first PACKET_HEADER_LEN bytes of buffer
+void Packet_encodeHeader(const PacketHeader* pHeader, uint8_t* buffer)
+{
+    buffer[0] = PACKET_MAGIC;
+    buffer[1] = pHeader->type;
+    Packet_writeBigEndian(&buffer[2], pHeader->flags, 2);
+    Packet_writeBigEndian(&buffer[4], pHeader->sequence, 4);
+    Packet_writeBigEndian(&buffer[8], pHeader->timestamp, 8);
+}
+
+// Read the header of a datagram of length bytes into pHeader
+// Returns 0 on success, -1 if the datagram does not start with a valid header
+int Packet_decodeHeader(const uint8_t* buffer, size_t length, PacketHeader* pHeader)
+{
+    if ((length < PACKET_HEADER_LEN) || (buffer[0] != PACKET_MAGIC)) {
+        return -1;
+    }
+    pHeader->type = buffer[1];
+    if ((pHeader->type < PACKET_CHAT) || (pHeader->type > PACKET_ROOM)) {
+        return -1;
+    }
+    pHeader->flags = Packet_readBigEndian(&buffer[2], 2);
+    pHeader->sequence = Packet_readBigEndian(&buffer[4], 4);
+    pHeader->timestamp = Packet_readBigEndian(&buffer[8], 8);
+    return 0;
+}
+
+// Send pHeader followed by payloadLength bytes of pPayload to pAddress, without copying the
+// payload unless it has to go through the impairment simulator
+int Packet_send(const PacketHeader* pHeader, const void* pPayload, size_t payloadLength, const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    if (Impair_enabled() && (payloadLength <= PACKET_MAX_PAYLOAD_LEN)) {
+        uint8_t datagram[PACKET_MAX_LEN];
+        Packet_encodeHeader(pHeader, datagram);
+        memcpy(&datagram[PACKET_HEADER_LEN], pPayload, payloadLength);
+        return Impair_send(datagram, PACKET_HEADER_LEN + payloadLength, pAddress, addressLength);
+    }
+    uint8_t header[PACKET_HEADER_LEN];
+    Packet_encodeHeader(pHeader, header);
+    struct iovec parts[2] = {
+        {.iov_base = header, .iov_len = PACKET_HEADER_LEN},
+        {.iov_base = (void*)pPayload, .iov_len = payloadLength}
+    };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = (void*)pAddress;
+    message.msg_namelen = addressLength;
+    message.msg_iov = parts;
+    message.msg_iovlen = (payloadLength > 0) ? 2 : 1;
+    return sendmsg(socketDescriptor, &message, 0);
+}
+
+// Turn on segmentation and receive offload for the socket where the kernel supports them
+bool Packet_enableOffload()
+{
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+    int enable = 1;
+    setsockopt(socketDescriptor, IPPROTO_UDP, UDP_GRO, &enable, sizeof(enable));
+    // Reading the option only succeeds on kernels that can segment
+    int segmentLength;
+    socklen_t optionLength = sizeof(segmentLength);
+    segmentationEnabled = (getsockopt(socketDescriptor, IPPROTO_UDP, UDP_SEGMENT, &segmentLength, &optionLength) == 0);
+#endif
+    return segmentationEnabled;
+}
+
+// Returns true if Packet_sendSegments() hands its datagrams to the kernel in one send
+bool Packet_canSegment()
+{
+    return segmentationEnabled;
+}
+
+// Returns the MTU of the route to pAddress, read from a socket connected to it
+int Packet_pathMtu(const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    int mtu = -1;
+#if defined(IP_MTU) && defined(IPV6_MTU)
+    int probe = socket(pAddress->sa_family, SOCK_DGRAM, 0);
+    if (probe == -1) {
+        return -1;
+    }
+    socklen_t optionLength = sizeof(mtu);
+    if ((connect(probe, pAddress, addressLength) != 0)
+        || ((pAddress->sa_family == AF_INET6) && (getsockopt(probe, IPPROTO_IPV6, IPV6_MTU, &mtu, &optionLength) != 0))
+        || ((pAddress->sa_family == AF_INET) && (getsockopt(probe, IPPROTO_IP, IP_MTU, &mtu, &optionLength) != 0))) {
+        mtu = -1;
+    }
+    close(probe);
+#endif
+    return mtu;
+}
+
+// Send count datagrams to pAddress, in one call with segmentation offload
+int Packet_sendSegments(const PacketHeader* headers, const void* const* payloads, const size_t* lengths, int count, const struct sockaddr* pAddress, socklen_t addressLength)
+{
+#ifdef UDP_SEGMENT
+    if (segmentationEnabled && (count > 1) && !Impair_enabled()) {
+        uint8_t encoded[PACKET_MAX_SEGMENTS][PACKET_HEADER_LEN];
+        struct iovec parts[2 * PACKET_MAX_SEGMENTS];
+        for (int i = 0; i < count; i++) {
+            Packet_encodeHeader(&headers[i], encoded[i]);
+            parts[2 * i].iov_base = encoded[i];
+            parts[2 * i].iov_len = PACKET_HEADER_LEN;
+            parts[2 * i + 1].iov_base = (void*)payloads[i];
+            parts[2 * i + 1].iov_len = lengths[i];
+        }
+        union {
+            char buffer[CMSG_SPACE(sizeof(uint16_t))];
+            struct cmsghdr align;
+        } control;
+        memset(&control, 0, sizeof(control));
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_name = (void*)pAddress;
+        message.msg_namelen = addressLength;
+        message.msg_iov = parts;
+        message.msg_iovlen = 2 * count;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr* pControl = CMSG_FIRSTHDR(&message);
+        pControl->cmsg_level = IPPROTO_UDP;
+        pControl->cmsg_type = UDP_SEGMENT;
+        pControl->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t segmentLength = PACKET_HEADER_LEN + lengths[0];
+        memcpy(CMSG_DATA(pControl), &segmentLength, sizeof(segmentLength));
+
+        int bytesSent = sendmsg(socketDescriptor, &message, 0);
+        if ((bytesSent >= 0) || ((errno != EIO) && (errno != EINVAL) && (errno != ENOPROTOOPT) && (errno != EOPNOTSUPP))) {
+            return bytesSent;
+        }
+        // The route cannot segment (e.g. no checksum offload); stop trying
+        segmentationEnabled = false;
+    }
+#endif
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        int bytesSent = Packet_send(&headers[i], payloads[i], lengths[i], pAddress, addressLength);
+        if (bytesSent < 0) {
+            return -1;
+        }
+        total += bytesSent;
+    }
+    return total;
+}
+
+// Receive into buffer, noting the segment length if receive offload coalesced datagrams
+int Packet_receive(uint8_t* buffer, int maxLength, int flags, struct sockaddr_storage* pSource, socklen_t* pSourceLength, int* pSegmentLength)
+{
+    struct iovec part = {.iov_base = buffer, .iov_len = maxLength};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = pSource;
+    message.msg_namelen = sizeof(*pSource);
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    int bytesReceived = recvmsg(socketDescriptor, &message, flags);
+    if (bytesReceived < 0) {
+        return -1;
+    }
+    *pSourceLength = message.msg_namelen;
+    *pSegmentLength = bytesReceived;
+#ifdef UDP_GRO
+    for (struct cmsghdr* pControl = CMSG_FIRSTHDR(&message); pControl != NULL; pControl = CMSG_NXTHDR(&message, pControl)) {
+        if ((pControl->cmsg_level == IPPROTO_UDP) && (pControl->cmsg_type == UDP_GRO)) {
+            int segmentLength;
+            memcpy(&segmentLength, CMSG_DATA(pControl), sizeof(segmentLength));
+            if (segmentLength > 0) {
+                *pSegmentLength = segmentLength;
+            }
+        }
+    }
+#endif
+    return bytesReceived;
+}
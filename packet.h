@@ -0,0 +1,84 @@
+#ifndef _PACKET_H_
+#define _PACKET_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "general.h"
+
+// Every datagram starts with a fixed header, encoded in network byte order:
+// magic (1 byte), type (1), flags (2), sequence (4), timestamp (8)
+#define PACKET_MAGIC 0x53
+#define PACKET_HEADER_LEN 16
+
+// Largest payload, filled by file chunks; messages are at most MSG_MAX_LEN
+#define PACKET_MAX_PAYLOAD_LEN 32768
+#define PACKET_MAX_LEN (PACKET_HEADER_LEN + PACKET_MAX_PAYLOAD_LEN)
+
+// With segmentation offload (UDP GSO), one send hands the kernel up to PACKET_MAX_SEGMENTS
+// datagrams totalling at most PACKET_MAX_SEGMENTED_LEN bytes. With receive offload (UDP GRO),
+// one receive can return that many datagrams back to back, so receive buffers must hold
+// PACKET_RECEIVE_LEN bytes.
+#define PACKET_MAX_SEGMENTS 64
+#define PACKET_MAX_SEGMENTED_LEN 65000
+#define PACKET_RECEIVE_LEN 65536
+
+// Chat carries a message as its payload. Keepalive carries the sender's monotonic time in
+// microseconds, which the receiver echoes back in a keepalive ack, and the sender's epoch,
+// picked once per run, as its sequence number.
+// Chat and room packets carry a room id in the low 15 bits of flags; see room.h. A chat
+// packet with PACKET_FLAG_TRACED set has trace stamps after its message; see trace.h.
+// File packets carry the transfer number in flags; see transfer.h for the rest.
+enum PacketType {PACKET_CHAT = 1, PACKET_KEEPALIVE = 2, PACKET_KEEPALIVE_ACK = 3, PACKET_FILE_START = 4, PACKET_FILE_CHUNK = 5, PACKET_FILE_ACK = 6, PACKET_ROOM = 7};
+
+#define PACKET_FLAG_TRACED 0x8000
+
+typedef struct PacketHeader_s PacketHeader;
+struct PacketHeader_s {
+    uint8_t type;
+    uint16_t flags;
+    uint32_t sequence;
+    uint64_t timestamp;
+};
+
+// Stores value in bytes big-endian bytes at buffer
+void Packet_writeBigEndian(uint8_t* buffer, uint64_t value, int bytes);
+
+// Returns the value stored in bytes big-endian bytes at buffer
+uint64_t Packet_readBigEndian(const uint8_t* buffer, int bytes);
+
+// Write pHeader to the first PACKET_HEADER_LEN bytes of buffer
+void Packet_encodeHeader(const PacketHeader* pHeader, uint8_t* buffer);
+
+// Read the header of a datagram of length bytes into pHeader
+// Returns 0 on success, -1 if the datagram does not start with a valid header
+int Packet_decodeHeader(const uint8_t* buffer, size_t length, PacketHeader* pHeader);
+
+// Send pHeader followed by payloadLength bytes of pPayload to pAddress, without copying the payload
+// Returns the number of bytes sent, or -1 on failure
+int Packet_send(const PacketHeader* pHeader, const void* pPayload, size_t payloadLength, const struct sockaddr* pAddress, socklen_t addressLength);
+
+// Turn on segmentation and receive offload for the socket where the kernel supports them
+// Returns true if sends can be segmented
+bool Packet_enableOffload();
+
+// Returns true if Packet_sendSegments() hands its datagrams to the kernel in one send
+bool Packet_canSegment();
+
+// Returns the MTU of the route to pAddress, or -1 if it is unknown
+int Packet_pathMtu(const struct sockaddr* pAddress, socklen_t addressLength);
+
+// Send count datagrams to pAddress, datagram i being headers[i] followed by lengths[i] bytes
+// of payloads[i]. Every payload but the last must be lengths[0] bytes long. With
+// segmentation offload, they are sent in one call; without it, if the kernel refuses it, or
+// when impairment is simulated, one at a time.
+// Returns the number of bytes sent, or -1 on failure
+int Packet_sendSegments(const PacketHeader* headers, const void* const* payloads, const size_t* lengths, int count, const struct sockaddr* pAddress, socklen_t addressLength);
+
+// Receive into buffer, and the source address into pSource. If receive offload coalesced
+// several datagrams, all but the last are *pSegmentLength bytes long; otherwise
+// *pSegmentLength is the whole length.
+// Returns the number of bytes received, or -1 on failure
+int Packet_receive(uint8_t* buffer, int maxLength, int flags, struct sockaddr_storage* pSource, socklen_t* pSourceLength, int* pSegmentLength);
+
+#endif
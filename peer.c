@@ -0,0 +1,510 @@
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "general.h"
+#include "log.h"
+#include "packet.h"
+#include "peer.h"
+#include "timer.h"
+
+// Peers are kept in an array by registration index, found through an open-addressing hash
+// table of indices, at most half full, keyed by address. Evicting a peer shifts the entries
+// after it in its cluster back, so lookups still stop at the first empty slot, while the peer
+// itself, and its keepalive timer, never move.
+#define PEER_TABLE_SIZE (2 * PEER_MAX_PEERS)
+
+// Bounds of the retransmission timeout, in microseconds (RFC 6298 2.4 and 2.5)
+#define PEER_MIN_TIMEOUT 1000000
+#define PEER_MAX_TIMEOUT 60000000
+#define PEER_CLOCK_GRANULARITY (TIMER_TICK_MS * 1000)
+
+// Anti-replay window (RFC 6479): bit (sequence % PEER_DEDUP_WINDOW_BITS) is set once that
+// sequence number is accepted. Advancing the window clears the words it moves into, so
+// every check is O(1) and the window takes PEER_DEDUP_WINDOW_BITS / 8 bytes.
+#define DEDUP_WORDS (PEER_DEDUP_WINDOW_BITS / 64)
+typedef struct DedupWindow_s DedupWindow;
+struct DedupWindow_s {
+    bool started;
+    uint32_t highest;
+    uint64_t bitmap[DEDUP_WORDS];
+};
+
+typedef struct Peer_s Peer;
+struct Peer_s {
+    bool used;
+    int index;
+    // Counts the peers that held this index, so snapshots can tell it was reused
+    uint32_t generation;
+    // Registered as the remote user, rather than by the relay
+    bool remote;
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+    enum PeerState state;
+    uint64_t lastHeard;
+    // Keepalive intervals until the next keepalive, doubled while the peer is dead
+    int backoff;
+    bool hasRtt;
+    uint64_t smoothedRtt;
+    uint64_t rttVariation;
+    Timer keepaliveTimer;
+    // The epoch from the peer's last keepalive
+    bool hasEpoch;
+    uint32_t epoch;
+    DedupWindow dedup;
+};
+
+// A change of a peer's state, reported once peerMutex is released
+typedef struct StateChange_s StateChange;
+struct StateChange_s {
+    bool changed;
+    bool evicted;
+    bool remote;
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+    enum PeerState state;
+    bool hasRtt;
+    uint64_t smoothedRtt;
+};
+
+static Peer peers[PEER_MAX_PEERS];
+
+// Slots of the hash table hold a registration index plus one, or 0 when empty
+static uint16_t table[PEER_TABLE_SIZE];
+
+// Registration indices handed out so far, and those freed by evictions, which are reused first
+static int peerCount = 0;
+static int freeIndices[PEER_MAX_PEERS];
+static int freeCount = 0;
+static pthread_mutex_t peerMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Picked once per run and sent in every keepalive, so peers can tell that this end restarted
+static bool epochPicked = false;
+static uint32_t localEpoch;
+
+static const char* stateNames[] = {"unknown", "alive", "suspect", "dead"};
+
+// Returns true if two addresses are the same host and port
+bool Peer_sameAddress(const struct sockaddr* pA, const struct sockaddr* pB)
+{
+    if (pA->sa_family != pB->sa_family) {
+        return false;
+    }
+    if (pA->sa_family == AF_INET6) {
+        const struct sockaddr_in6* pA6 = (const struct sockaddr_in6*)pA;
+        const struct sockaddr_in6* pB6 = (const struct sockaddr_in6*)pB;
+        return (pA6->sin6_port == pB6->sin6_port) && (memcmp(&pA6->sin6_addr, &pB6->sin6_addr, sizeof(pA6->sin6_addr)) == 0);
+    }
+    const struct sockaddr_in* pA4 = (const struct sockaddr_in*)pA;
+    const struct sockaddr_in* pB4 = (const struct sockaddr_in*)pB;
+    return (pA4->sin_port == pB4->sin_port) && (pA4->sin_addr.s_addr == pB4->sin_addr.s_addr);
+}
+
+// FNV-1a over bytes
+static uint32_t hashBytes(uint32_t hash, const void* pBytes, size_t length)
+{
+    const uint8_t* pByte = pBytes;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ pByte[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns a hash of the host and port of an address
+uint32_t Peer_hashAddress(const struct sockaddr* pAddress)
+{
+    uint32_t hash = 2166136261u;
+    if (pAddress->sa_family == AF_INET6) {
+        const struct sockaddr_in6* pSin6 = (const struct sockaddr_in6*)pAddress;
+        hash = hashBytes(hash, &pSin6->sin6_addr, sizeof(pSin6->sin6_addr));
+        return hashBytes(hash, &pSin6->sin6_port, sizeof(pSin6->sin6_port));
+    }
+    const struct sockaddr_in* pSin = (const struct sockaddr_in*)pAddress;
+    hash = hashBytes(hash, &pSin->sin_addr, sizeof(pSin->sin_addr));
+    return hashBytes(hash, &pSin->sin_port, sizeof(pSin->sin_port));
+}
+
+// Returns the hash table slot of pAddress, or the empty slot it would be stored in
+// Must be called with peerMutex held
+static uint16_t* findSlot(const struct sockaddr* pAddress)
+{
+    uint32_t slot = Peer_hashAddress(pAddress) % PEER_TABLE_SIZE;
+    while ((table[slot] != 0) && !Peer_sameAddress((struct sockaddr*)&peers[table[slot] - 1].address, pAddress)) {
+        slot = (slot + 1) % PEER_TABLE_SIZE;
+    }
+    return &table[slot];
+}
+
+// Returns the registered peer at pAddress, or NULL
+// Must be called with peerMutex held
+static Peer* findPeer(const struct sockaddr* pAddress)
+{
+    uint16_t* pSlot = findSlot(pAddress);
+    return (*pSlot != 0) ? &peers[*pSlot - 1] : NULL;
+}
+
+// Remove pPeer from the hash table and free its registration index. Each entry after it in
+// its cluster moves back into the gap unless its home slot lies after the gap, so no lookup
+// stops short of it (Knuth, Algorithm 6.4R).
+// Must be called with peerMutex held, from pPeer's keepalive, so its timer is not scheduled
+static void evict(Peer* pPeer)
+{
+    uint32_t empty = findSlot((struct sockaddr*)&pPeer->address) - table;
+    table[empty] = 0;
+    for (uint32_t slot = (empty + 1) % PEER_TABLE_SIZE; table[slot] != 0; slot = (slot + 1) % PEER_TABLE_SIZE) {
+        uint32_t home = Peer_hashAddress((struct sockaddr*)&peers[table[slot] - 1].address) % PEER_TABLE_SIZE;
+        bool afterGap = (empty < slot) ? ((empty < home) && (home <= slot)) : ((empty < home) || (home <= slot));
+        if (!afterGap) {
+            table[empty] = table[slot];
+            table[slot] = 0;
+            empty = slot;
+        }
+    }
+    pPeer->used = false;
+    freeIndices[freeCount++] = pPeer->index;
+}
+
+// Change pPeer's state, copying the change to pChange for reportChange()
+// Must be called with peerMutex held
+static void setState(Peer* pPeer, enum PeerState state, StateChange* pChange)
+{
+    if (pPeer->state == state) {
+        return;
+    }
+    pPeer->state = state;
+    pChange->changed = true;
+    pChange->remote = pPeer->remote;
+    pChange->address = pPeer->address;
+    pChange->addressLength = pPeer->addressLength;
+    pChange->state = state;
+    pChange->hasRtt = pPeer->hasRtt;
+    pChange->smoothedRtt = pPeer->smoothedRtt;
+}
+
+// Display a change of the remote user's state, and log those of other peers
+// Must be called without peerMutex held, since formatting and printing may block
+static void reportChange(const StateChange* pChange)
+{
+    if (!pChange->changed) {
+        return;
+    }
+    char host[INET6_ADDRSTRLEN];
+    char port[8];
+    if (getnameinfo((struct sockaddr*)&pChange->address, pChange->addressLength, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+        strcpy(host, "?");
+        strcpy(port, "?");
+    }
+    char report[INET6_ADDRSTRLEN + 64];
+    if (pChange->evicted) {
+        snprintf(report, sizeof(report), "[Peer %s port %s is forgotten]\n", host, port);
+    }
+    else if ((pChange->state == PEER_ALIVE) && pChange->hasRtt) {
+        snprintf(report, sizeof(report), "[Peer %s port %s is %s, rtt %.1f ms]\n", host, port, stateNames[pChange->state], pChange->smoothedRtt / 1000.0);
+    }
+    else {
+        snprintf(report, sizeof(report), "[Peer %s port %s is %s]\n", host, port, stateNames[pChange->state]);
+    }
+    if (pChange->remote) {
+        General_print(report);
+    }
+    else {
+        Log_write(LOG_INFO, report);
+    }
+}
+
+// Runs on the timer thread every keepalive interval: ages the peer, then sends it a keepalive.
+// A dead peer is sent one after twice as long each time, up to PEER_MAX_BACKOFF intervals,
+// and a peer that joined a relay is evicted instead once silent for PEER_EVICT_INTERVALS.
+static void keepalive(Timer* pTimer, void* pArg)
+{
+    Peer* pPeer = pArg;
+    PacketHeader header = {.type = PACKET_KEEPALIVE, .flags = 0};
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+    StateChange change = {.changed = false};
+    int backoff;
+    pthread_mutex_lock(&peerMutex);
+    {
+        uint64_t silence = General_monotonicMicros() - pPeer->lastHeard;
+        if (!pPeer->remote && (silence >= (uint64_t)PEER_EVICT_INTERVALS * KEEPALIVE_INTERVAL_MS * 1000)) {
+            change.changed = true;
+            change.evicted = true;
+            change.address = pPeer->address;
+            change.addressLength = pPeer->addressLength;
+            evict(pPeer);
+        }
+        else if (silence >= (uint64_t)PEER_DEAD_INTERVALS * KEEPALIVE_INTERVAL_MS * 1000) {
+            // Whatever the peer sends once it is back starts a new window
+            pPeer->dedup.started = false;
+            setState(pPeer, PEER_DEAD, &change);
+        }
+        else if ((silence >= (uint64_t)PEER_SUSPECT_INTERVALS * KEEPALIVE_INTERVAL_MS * 1000) && (pPeer->state == PEER_ALIVE)) {
+            setState(pPeer, PEER_SUSPECT, &change);
+        }
+        backoff = pPeer->backoff;
+        if ((pPeer->state == PEER_DEAD) && (pPeer->backoff < PEER_MAX_BACKOFF)) {
+            pPeer->backoff *= 2;
+        }
+        header.sequence = localEpoch;
+        address = pPeer->address;
+        addressLength = pPeer->addressLength;
+    }
+    pthread_mutex_unlock(&peerMutex);
+
+    reportChange(&change);
+    if (change.evicted) {
+        // Not scheduled again; the record may already belong to a new peer
+        return;
+    }
+    header.timestamp = General_monotonicMicros();
+    Packet_send(&header, NULL, 0, (struct sockaddr*)&address, addressLength);
+    Timer_schedule(pTimer, KEEPALIVE_INTERVAL_MS * backoff, keepalive, pPeer);
+}
+
+// Start sending keepalives to pAddress, if it is not already registered. The first goes out
+// at once, so that it reaches the peer before any chat message does.
+int Peer_register(const struct sockaddr* pAddress, socklen_t addressLength, bool remote)
+{
+    int result = 0;
+    Peer* pAdded = NULL;
+    pthread_mutex_lock(&peerMutex);
+    {
+        uint16_t* pSlot = findSlot(pAddress);
+        if (!epochPicked) {
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            localEpoch = (uint32_t)(now.tv_nsec ^ (now.tv_sec << 12) ^ ((long)getpid() << 16));
+            epochPicked = true;
+        }
+        if (*pSlot != 0) {
+            // Already registered
+            peers[*pSlot - 1].remote |= remote;
+        }
+        else if ((freeCount == 0) && (peerCount == PEER_MAX_PEERS)) {
+            result = -1;
+        }
+        else {
+            int index = (freeCount > 0) ? freeIndices[--freeCount] : peerCount++;
+            Peer* pPeer = &peers[index];
+            uint32_t generation = pPeer->generation;
+            memset(pPeer, 0, sizeof(*pPeer));
+            pPeer->generation = generation + 1;
+            pPeer->used = true;
+            pPeer->remote = remote;
+            pPeer->backoff = 1;
+            memcpy(&pPeer->address, pAddress, addressLength);
+            pPeer->addressLength = addressLength;
+            pPeer->state = PEER_UNKNOWN;
+            pPeer->lastHeard = General_monotonicMicros();
+            pPeer->index = index;
+            *pSlot = index + 1;
+            pAdded = pPeer;
+        }
+    }
+    pthread_mutex_unlock(&peerMutex);
+    if (pAdded != NULL) {
+        keepalive(&pAdded->keepaliveTimer, pAdded);
+    }
+    return result;
+}
+
+// Record that a datagram arrived from pAddress
+bool Peer_heardFrom(const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    bool known = false;
+    StateChange change = {.changed = false};
+    pthread_mutex_lock(&peerMutex);
+    {
+        Peer* pPeer = findPeer(pAddress);
+        if (pPeer != NULL) {
+            pPeer->lastHeard = General_monotonicMicros();
+            pPeer->backoff = 1;
+            setState(pPeer, PEER_ALIVE, &change);
+            known = true;
+        }
+    }
+    pthread_mutex_unlock(&peerMutex);
+    reportChange(&change);
+    return known;
+}
+
+// Start the window over at sequence
+static void resetWindow(DedupWindow* pWindow, uint32_t sequence)
+{
+    memset(pWindow->bitmap, 0, sizeof(pWindow->bitmap));
+    pWindow->started = true;
+    pWindow->highest = sequence;
+}
+
+// Returns false if sequence was already in the window or is too old for it, and adds it
+// otherwise
+static bool acceptIntoWindow(DedupWindow* pWindow, uint32_t sequence)
+{
+    int32_t ahead = (int32_t)(sequence - pWindow->highest);
+    if (!pWindow->started) {
+        resetWindow(pWindow, sequence);
+    }
+    else if (ahead <= -(PEER_DEDUP_WINDOW_BITS - 64)) {
+        // Behind the window, so it cannot be told apart from a replay
+        return false;
+    }
+    else if (ahead > 0) {
+        // Word numbers are 26 bits wide, so the difference wraps with the sequence numbers
+        uint32_t words = ((sequence >> 6) - (pWindow->highest >> 6)) & (UINT32_MAX >> 6);
+        if (words > DEDUP_WORDS) {
+            words = DEDUP_WORDS;
+        }
+        for (uint32_t i = 1; i <= words; i++) {
+            pWindow->bitmap[((pWindow->highest >> 6) + i) % DEDUP_WORDS] = 0;
+        }
+        pWindow->highest = sequence;
+    }
+    uint64_t* pWord = &pWindow->bitmap[(sequence >> 6) % DEDUP_WORDS];
+    uint64_t bit = 1ULL << (sequence & 63);
+    if (*pWord & bit) {
+        return false;
+    }
+    *pWord |= bit;
+    return true;
+}
+
+// Returns false if a chat message with sequence number from pAddress was already accepted
+bool Peer_acceptSequence(const struct sockaddr* pAddress, socklen_t addressLength, uint32_t sequence)
+{
+    bool accepted = true;
+    pthread_mutex_lock(&peerMutex);
+    {
+        Peer* pPeer = findPeer(pAddress);
+        if (pPeer != NULL) {
+            accepted = acceptIntoWindow(&pPeer->dedup, sequence);
+        }
+    }
+    pthread_mutex_unlock(&peerMutex);
+    return accepted;
+}
+
+// Record the epoch of a keepalive from pAddress, starting a new window if it changed
+void Peer_heardEpoch(const struct sockaddr* pAddress, socklen_t addressLength, uint32_t epoch)
+{
+    pthread_mutex_lock(&peerMutex);
+    {
+        Peer* pPeer = findPeer(pAddress);
+        if ((pPeer != NULL) && (!pPeer->hasEpoch || (pPeer->epoch != epoch))) {
+            if (pPeer->hasEpoch) {
+                pPeer->dedup.started = false;
+            }
+            pPeer->hasEpoch = true;
+            pPeer->epoch = epoch;
+        }
+    }
+    pthread_mutex_unlock(&peerMutex);
+}
+
+// Add a round-trip time sample for pAddress (RFC 6298 2.2 and 2.3)
+void Peer_recordRttSample(const struct sockaddr* pAddress, socklen_t addressLength, uint64_t sentMicros)
+{
+    uint64_t now = General_monotonicMicros();
+    if (sentMicros > now) {
+        return;
+    }
+    uint64_t sample = now - sentMicros;
+    pthread_mutex_lock(&peerMutex);
+    {
+        Peer* pPeer = findPeer(pAddress);
+        if ((pPeer != NULL) && !pPeer->hasRtt) {
+            pPeer->smoothedRtt = sample;
+            pPeer->rttVariation = sample / 2;
+            pPeer->hasRtt = true;
+        }
+        else if (pPeer != NULL) {
+            uint64_t deviation = (pPeer->smoothedRtt > sample) ? (pPeer->smoothedRtt - sample) : (sample - pPeer->smoothedRtt);
+            pPeer->rttVariation = (3 * pPeer->rttVariation + deviation) / 4;
+            pPeer->smoothedRtt = (7 * pPeer->smoothedRtt + sample) / 8;
+        }
+    }
+    pthread_mutex_unlock(&peerMutex);
+}
+
+// Copy the smoothed round-trip time of pAddress, its variation and the retransmission timeout
+int Peer_getRtt(const struct sockaddr* pAddress, socklen_t addressLength, uint64_t* pSmoothedRtt, uint64_t* pRttVariation, uint64_t* pTimeout)
+{
+    int result = -1;
+    pthread_mutex_lock(&peerMutex);
+    {
+        Peer* pPeer = findPeer(pAddress);
+        if ((pPeer != NULL) && pPeer->hasRtt) {
+            uint64_t margin = 4 * pPeer->rttVariation;
+            if (margin < PEER_CLOCK_GRANULARITY) {
+                margin = PEER_CLOCK_GRANULARITY;
+            }
+            uint64_t timeout = pPeer->smoothedRtt + margin;
+            if (timeout < PEER_MIN_TIMEOUT) {
+                timeout = PEER_MIN_TIMEOUT;
+            }
+            if (timeout > PEER_MAX_TIMEOUT) {
+                timeout = PEER_MAX_TIMEOUT;
+            }
+            *pSmoothedRtt = pPeer->smoothedRtt;
+            *pRttVariation = pPeer->rttVariation;
+            *pTimeout = timeout;
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(&peerMutex);
+    return result;
+}
+
+// Returns the liveness state of pAddress
+enum PeerState Peer_getState(const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    enum PeerState state = PEER_UNKNOWN;
+    pthread_mutex_lock(&peerMutex);
+    {
+        Peer* pPeer = findPeer(pAddress);
+        if (pPeer != NULL) {
+            state = pPeer->state;
+        }
+    }
+    pthread_mutex_unlock(&peerMutex);
+    return state;
+}
+
+// Returns the registration index of pAddress
+int Peer_indexOf(const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    int index = -1;
+    pthread_mutex_lock(&peerMutex);
+    {
+        Peer* pPeer = findPeer(pAddress);
+        if (pPeer != NULL) {
+            index = pPeer->index;
+        }
+    }
+    pthread_mutex_unlock(&peerMutex);
+    return index;
+}
+
+// Copy the state of every registration index, and the address of each whose peer is not the
+// one in generations
+int Peer_snapshot(uint32_t* generations, struct sockaddr_storage* addresses, socklen_t* addressLengths, enum PeerState* states)
+{
+    int count;
+    pthread_mutex_lock(&peerMutex);
+    {
+        count = peerCount;
+        for (int i = 0; i < count; i++) {
+            if (generations[i] != peers[i].generation) {
+                generations[i] = peers[i].generation;
+                addresses[i] = peers[i].address;
+                addressLengths[i] = peers[i].addressLength;
+            }
+            states[i] = peers[i].used ? peers[i].state : PEER_DEAD;
+        }
+    }
+    pthread_mutex_unlock(&peerMutex);
+    return count;
+}
@@ -0,0 +1,83 @@
+#ifndef _PEER_H_
+#define _PEER_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Every registered peer is sent a keepalive each interval, on a timer wheel, and answers it
+// with an ack echoing its timestamp. The acks feed a smoothed round-trip time estimator
+// (RFC 6298); silence moves a peer to suspect, then dead, after which its keepalives back off.
+// State changes of the remote user are displayed, and those of other peers logged. Peers that
+// joined a relay are evicted once silent for PEER_EVICT_INTERVALS, and their registration
+// index freed for the next peer to join.
+
+// Milliseconds between keepalives, and the number of silent intervals before a peer is
+// suspected, then declared dead
+#define KEEPALIVE_INTERVAL_MS 1000
+#define PEER_SUSPECT_INTERVALS 3
+#define PEER_DEAD_INTERVALS 6
+
+// Most keepalive intervals between keepalives to a dead peer, and the number of silent
+// intervals before a peer that joined a relay is evicted
+#define PEER_MAX_BACKOFF 16
+#define PEER_EVICT_INTERVALS 60
+
+// Chat sequence numbers are checked against a sliding window of this many bits per peer,
+// of which the last 64 are a margin for advancing the window
+#define PEER_DEDUP_WINDOW_BITS 1024
+
+// Maximum number of peers that can be registered
+#define PEER_MAX_PEERS 4096
+
+enum PeerState {PEER_UNKNOWN, PEER_ALIVE, PEER_SUSPECT, PEER_DEAD};
+
+// Returns true if two addresses are the same host and port
+bool Peer_sameAddress(const struct sockaddr* pA, const struct sockaddr* pB);
+
+// Returns a hash of the host and port of an address, for tables keyed by address
+uint32_t Peer_hashAddress(const struct sockaddr* pAddress);
+
+// Start sending keepalives to pAddress, if it is not already registered. remote is true for
+// the remote user, false for peers that joined a relay.
+// Returns 0 on success, -1 if the peer table is full
+int Peer_register(const struct sockaddr* pAddress, socklen_t addressLength, bool remote);
+
+// Record that a datagram arrived from pAddress; ignored for unregistered peers
+// Returns true if pAddress is registered
+bool Peer_heardFrom(const struct sockaddr* pAddress, socklen_t addressLength);
+
+// Returns false if a chat message with sequence number from pAddress was already accepted or
+// is too old for the window, and records it otherwise. Unregistered peers are always accepted.
+// The window starts over when the peer restarts, which its keepalives tell by a new epoch, and
+// when it is declared dead.
+bool Peer_acceptSequence(const struct sockaddr* pAddress, socklen_t addressLength, uint32_t sequence);
+
+// Record the epoch carried in the sequence number of a keepalive from pAddress; ignored for
+// unregistered peers
+void Peer_heardEpoch(const struct sockaddr* pAddress, socklen_t addressLength, uint32_t epoch);
+
+// Add a round-trip time sample for pAddress, from a keepalive sent at sentMicros on the
+// General_monotonicMicros() clock
+void Peer_recordRttSample(const struct sockaddr* pAddress, socklen_t addressLength, uint64_t sentMicros);
+
+// Copy the smoothed round-trip time of pAddress and its variation, in microseconds, to
+// pSmoothedRtt and pRttVariation, and the retransmission timeout derived from them to pTimeout
+// Returns 0 on success, -1 if the peer is not registered or has no sample yet
+int Peer_getRtt(const struct sockaddr* pAddress, socklen_t addressLength, uint64_t* pSmoothedRtt, uint64_t* pRttVariation, uint64_t* pTimeout);
+
+// Returns the liveness state of pAddress, PEER_UNKNOWN if it is not registered
+enum PeerState Peer_getState(const struct sockaddr* pAddress, socklen_t addressLength);
+
+// Returns the registration index of pAddress, below PEER_MAX_PEERS, or -1 if it is not
+// registered. The index of an evicted peer is given to a later one.
+int Peer_indexOf(const struct sockaddr* pAddress, socklen_t addressLength);
+
+// Copy the state of the peer at every registration index to states, PEER_DEAD for a freed
+// index. Where the index is held by a peer other than the one recorded in generations, copy
+// its address to addresses and addressLengths, and record it in generations. Each array must
+// hold PEER_MAX_PEERS entries, and generations starts zeroed, so a caller can keep the
+// addresses it copied and only be given the changed ones.
+// Returns the number of registration indices handed out
+int Peer_snapshot(uint32_t* generations, struct sockaddr_storage* addresses, socklen_t* addressLengths, enum PeerState* states);
+
+#endif
@@ -1,42 +1,70 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include "arena.h"
+#include "config.h"
 #include "general.h"
+#include "log.h"
 #include "printer.h"
 #include "receiver.h"
+#include "scheduler.h"
+#include "trace.h"
 
 static pthread_t threadPID;
 
+// Prints received messages until "!" arrives or the receive list is closed and empty.
+// Once shutdown has begun, messages left when its deadline passes are dropped.
 void* printThread()
 {
 	while (1) {
-		char* pMessage = Receiver_getFromReceiveList();
-        if (strcmp(pMessage, "!\n") == 0) {
-            free(pMessage);
-            General_terminate();
+        char* messages[MSG_BATCH_SIZE];
+        int count = Receiver_getBatchFromReceiveList(messages, Config_settings.batchSize);
+        if (count == 0) {
             return NULL;
         }
+        for (int i = 0; i < count; i++) {
+            Trace_stamp(messages[i], TRACE_RECEIVE_DEQUEUED);
+        }
+        for (int i = 0; i < count; i++) {
+            char* pMessage = messages[i];
+            if (General_shutdownDeadlinePassed()) {
+                for (int j = i; j < count; j++) {
+                    Arena_free(messages[j]);
+                }
+                General_stats.receiveDropped += count - i;
+                return NULL;
+            }
+            if (strcmp(pMessage, "!\n") == 0) {
+                for (int j = i; j < count; j++) {
+                    Arena_free(messages[j]);
+                }
+                General_terminate();
+                return NULL;
+            }
 
-        General_printAndCheck(pMessage, "Print Thread Error: Failed to display received message\n");
-        free(pMessage);
+            General_printAndCheck(pMessage, "Print Thread Error: Failed to display received message\n");
+            General_stats.messagesPrinted++;
+            Trace_stamp(pMessage, TRACE_PRINTED);
+            Trace_record(pMessage);
+            Arena_free(pMessage);
+        }
 	}
 }
 
 // Create a thread that prints received message
-void Printer_init()
+void Printer_start()
 {
-    if (pthread_create(&threadPID, NULL, printThread, NULL) != 0) {
-        General_print("Print Thread Error: Failed to create the receive thread\n");
+    if (Scheduler_createThread(&threadPID, THREAD_PRINTER, printThread) != 0) {
+        Log_write(LOG_ERROR, "Print Thread Error: Failed to create the receive thread\n");
         exit(EXIT_FAILURE);
     }
 }
 
-// Cancel and wait for thread to finish
+// Wait for the thread to print queued messages and finish once shutdown has begun
 void Printer_shutdown()
 {
-    pthread_cancel(threadPID);
     int result = pthread_join(threadPID, NULL);
     if (result != 0) {
-        General_print("Print Thread Error: Failed to cancel and join thread\n");
+        Log_write(LOG_ERROR, "Print Thread Error: Failed to join thread\n");
     }
 }
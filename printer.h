@@ -2,9 +2,9 @@
 #define _PRINTER_H_
 
 // Start background print thread
-void Printer_init();
+void Printer_start();
 
-// Stop background print thread
+// Wait for background print thread to print queued messages once shutdown has begun
 void Printer_shutdown();
 
 #endif
@@ -1,110 +1,446 @@
+#include <errno.h>
 #include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "arena.h"
+#include "config.h"
+#include "flow.h"
 #include "general.h"
 #include "list.h"
+#include "log.h"
+#include "packet.h"
+#include "peer.h"
 #include "receiver.h"
+#include "relay.h"
+#include "room.h"
+#include "scheduler.h"
+#include "shm.h"
+#include "trace.h"
+#include "transfer.h"
 
 static List* pReceiveList;
 static pthread_t threadPID;
 static pthread_mutex_t receiveListMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t listNotEmptyCondVar = PTHREAD_COND_INITIALIZER;
 
+// Busy-poll mode: the receive thread spins on non-blocking receives and the print thread spins
+// on the receive list before either of them sleeps. The receive spin budget adapts between
+// the two limits: it grows when spinning catches a message and shrinks when it does not.
+#define BUSY_POLL_MIN_SPINS 64
+#define BUSY_POLL_MAX_SPINS (64 * 1024)
+#define BUSY_POLL_LIST_SPINS (64 * 1024)
+#define BUSY_POLL_SOCKET_USEC 50
+static bool busyPoll = false;
+static int spinLimit = BUSY_POLL_MIN_SPINS;
+static atomic_int receiveListCount = 0;
+static bool receiveListClosed = false;
+
+// The flow index of every message on the receive list, earliest first from queuedFirst, to
+// give back its source's share of the list when it is taken off
+static int queuedFlows[LIST_MAX_NUM_NODES];
+static int queuedFirst = 0;
+
+// Messages delivered from the receive being handled, with their flows, not yet on the
+// receive list. They are added in one step once the receive is handled.
+static char* stagedMessages[MSG_BATCH_SIZE];
+static int stagedFlows[MSG_BATCH_SIZE];
+static int stagedCount = 0;
+
+// When the receive being handled returned, for trace stamps
+static uint64_t receivedAt = 0;
+
+// Hints the CPU that this is a spin-wait loop
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Returned by receiveDatagram() once shutdown has begun
+#define RECEIVE_SHUTDOWN -2
+
+// Receive one datagram, or several coalesced ones of *pSegmentLength bytes, into buffer, and
+// their source address into pSource, from the shared-memory ring or the socket. In busy-poll
+// mode, spin before waiting on them.
+// Returns the number of bytes received, -1 on failure, or RECEIVE_SHUTDOWN
+static int receiveDatagram(uint8_t* buffer, int maxLength, struct sockaddr_storage* pSource, socklen_t* pSourceLength, int* pSegmentLength)
+{
+    int waited[2] = {socketDescriptor, Shm_eventDescriptor()};
+    int waitedCount = (waited[1] >= 0) ? 2 : 1;
+    int spins = 0;
+    while (1) {
+        if (General_isShuttingDown()) {
+            return RECEIVE_SHUTDOWN;
+        }
+        int bytesReceived = Shm_receive(buffer, maxLength, pSource, pSourceLength);
+        if (bytesReceived > 0) {
+            *pSegmentLength = bytesReceived;
+            return bytesReceived;
+        }
+        bytesReceived = Packet_receive(buffer, maxLength, MSG_DONTWAIT, pSource, pSourceLength, pSegmentLength);
+        if (bytesReceived >= 0) {
+            if (busyPoll && (spins > 0) && (spinLimit < BUSY_POLL_MAX_SPINS)) {
+                spinLimit *= 2;
+            }
+            return bytesReceived;
+        }
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+            return -1;
+        }
+        if (busyPoll && (spins < spinLimit)) {
+            spins++;
+            cpuRelax();
+            continue;
+        }
+        if (busyPoll && (spinLimit > BUSY_POLL_MIN_SPINS)) {
+            spinLimit /= 2;
+        }
+        if (Shm_prepareToWait()) {
+            int ready = General_waitForInputs(waited, waitedCount, -1);
+            Shm_finishWait();
+            if (ready < 0) {
+                return RECEIVE_SHUTDOWN;
+            }
+        }
+        spins = 0;
+    }
+}
+
+// Mark the receive list as complete, so the print thread stops once it has taken every message
+static void closeReceiveList()
+{
+    pthread_mutex_lock(&receiveListMutex);
+    {
+        receiveListClosed = true;
+        pthread_cond_broadcast(&listNotEmptyCondVar);
+    }
+    pthread_mutex_unlock(&receiveListMutex);
+}
+
+// Add the staged messages to the receive list
+static void flushStaged()
+{
+    if (stagedCount > 0) {
+        for (int i = 0; i < stagedCount; i++) {
+            Trace_stamp(stagedMessages[i], TRACE_RECEIVE_QUEUED);
+        }
+        Receiver_addBatchToReceiveList(stagedMessages, stagedFlows, stagedCount);
+        stagedCount = 0;
+    }
+}
+
+// Copy a received message of length bytes, admitted as from flow, for the receive list,
+// after the name of its room unless it is in the default room. A traced message is followed
+// by its 0 and trace stamps, which are kept if this end traces too.
+// Returns true if it is the "!" that ends the conversation
+static bool deliverMessage(const char* room, const uint8_t* message, int length, bool traced, int flow)
+{
+    int textLength = Trace_textLength(message, length, traced);
+    if (textLength < 0) {
+        General_stats.receiveDropped++;
+        Flow_dequeued(flow);
+        return false;
+    }
+    const uint8_t* block = traced ? &message[textLength + 1] : NULL;
+    length = textLength;
+    char prefix[ROOM_NAME_LEN + 4] = "";
+    if (room != NULL) {
+        snprintf(prefix, sizeof(prefix), "[%s] ", room);
+    }
+    int prefixLength = strlen(prefix);
+    if (prefixLength + length > MSG_MAX_LEN - 1) {
+        length = MSG_MAX_LEN - 1 - prefixLength;
+    }
+    int messageSize = prefixLength + length + 1;
+    char* pMessage = (char*)Arena_alloc(messageSize + Trace_blockLength());
+    if (pMessage == NULL) {
+        Log_write(LOG_ERROR, "Receive Thread Error: Failed to allocate a received message\n");
+        General_stats.receiveDropped++;
+        Flow_dequeued(flow);
+        return false;
+    }
+    memcpy(pMessage, prefix, prefixLength);
+    memcpy(&pMessage[prefixLength], message, length);
+    pMessage[prefixLength + length] = 0;
+    if (Trace_enabled()) {
+        if (block != NULL) {
+            memcpy(&pMessage[messageSize], block, TRACE_BLOCK_LEN);
+        }
+        else {
+            memset(&pMessage[messageSize], 0, TRACE_BLOCK_LEN);
+        }
+        Trace_stampAt(pMessage, TRACE_RECEIVED, receivedAt);
+    }
+    General_stats.messagesReceived++;
+    bool terminate = strcmp(pMessage, "!\n") == 0;
+    stagedMessages[stagedCount] = pMessage;
+    stagedFlows[stagedCount++] = flow;
+    if (stagedCount == MSG_BATCH_SIZE) {
+        flushStaged();
+    }
+    return terminate;
+}
+
+// Handle a datagram of length bytes from pSource: deliver chat messages, or forward them in
+// relay mode, record room subscriptions in relay mode, answer keepalives, time their acks and pass file packets on. Datagrams without
+// a valid header and duplicate chat messages are dropped before anything is copied.
+// Returns true if it is the "!" that ends the conversation
+static bool handleDatagram(uint8_t* datagram, int length, struct sockaddr_storage* pSource, socklen_t sourceLength)
+{
+    PacketHeader header;
+    if (Packet_decodeHeader(datagram, length, &header) != 0) {
+        General_stats.receiveDropped++;
+        return false;
+    }
+    if (header.type == PACKET_KEEPALIVE_ACK) {
+        Peer_recordRttSample((struct sockaddr*)pSource, sourceLength, header.timestamp);
+    }
+    if (!Peer_heardFrom((struct sockaddr*)pSource, sourceLength) && Relay_enabled() && !Relay_join((struct sockaddr*)pSource, sourceLength)) {
+        General_stats.receiveDropped++;
+        return false;
+    }
+    if (header.type == PACKET_KEEPALIVE) {
+        Peer_heardEpoch((struct sockaddr*)pSource, sourceLength, header.sequence);
+        PacketHeader ack = header;
+        ack.type = PACKET_KEEPALIVE_ACK;
+        Packet_send(&ack, NULL, 0, (struct sockaddr*)pSource, sourceLength);
+        return false;
+    }
+    if (header.type == PACKET_KEEPALIVE_ACK) {
+        return false;
+    }
+    if (header.type == PACKET_ROOM) {
+        if (Relay_enabled()) {
+            Room_subscribe(Peer_indexOf((struct sockaddr*)pSource, sourceLength), header.flags, &datagram[PACKET_HEADER_LEN], length - PACKET_HEADER_LEN, (struct sockaddr*)pSource, sourceLength);
+        }
+        else {
+            Room_handleRefusal(header.flags, &datagram[PACKET_HEADER_LEN], length - PACKET_HEADER_LEN, (struct sockaddr*)pSource, sourceLength);
+        }
+        return false;
+    }
+    if (header.type != PACKET_CHAT) {
+        Transfer_handlePacket(&header, &datagram[PACKET_HEADER_LEN], length - PACKET_HEADER_LEN, (struct sockaddr*)pSource, sourceLength);
+        return false;
+    }
+    if (!Peer_acceptSequence((struct sockaddr*)pSource, sourceLength, header.sequence)) {
+        General_stats.duplicatesDropped++;
+        return false;
+    }
+    uint16_t id = header.flags & ~PACKET_FLAG_TRACED;
+    bool traced = (header.flags & PACKET_FLAG_TRACED) != 0;
+    if (Relay_enabled()) {
+        if (Flow_admit((struct sockaddr*)pSource, sourceLength, false) < 0) {
+            General_stats.receiveDropped++;
+            return false;
+        }
+        Relay_forward(datagram, length, id, (struct sockaddr*)pSource, sourceLength);
+        return false;
+    }
+    char room[ROOM_NAME_LEN + 1];
+    if ((id != ROOM_DEFAULT) && (Room_name(id, room, sizeof(room)) != 0)) {
+        // From a room this end has left
+        General_stats.receiveDropped++;
+        return false;
+    }
+    int flow = Flow_admit((struct sockaddr*)pSource, sourceLength, true);
+    if (flow < 0) {
+        // The source is over its rate or its share of the receive list
+        General_stats.receiveDropped++;
+        return false;
+    }
+    return deliverMessage((id == ROOM_DEFAULT) ? NULL : room, &datagram[PACKET_HEADER_LEN], length - PACKET_HEADER_LEN, traced, flow);
+}
+
+// Handle the datagrams coalesced in a receive of length bytes, each segmentLength long
+// but the last, then write the file chunks among them. The datagrams, and those of them
+// dropped or duplicated, are counted against pSource.
+// Returns true if one is the "!" that ends the conversation
+bool Receiver_handleDatagrams(uint8_t* buffer, int length, int segmentLength, struct sockaddr_storage* pSource, socklen_t sourceLength)
+{
+    if ((segmentLength <= 0) || (segmentLength > length)) {
+        segmentLength = length;
+    }
+    // Only this thread counts drops and duplicates while messages flow
+    long dropped = General_stats.receiveDropped;
+    long duplicates = General_stats.duplicatesDropped;
+    bool terminate = false;
+    int offset = 0;
+    int datagrams = 0;
+    do {
+        int datagramLength = (length - offset < segmentLength) ? (length - offset) : segmentLength;
+        terminate = handleDatagram(&buffer[offset], datagramLength, pSource, sourceLength);
+        offset += segmentLength;
+        datagrams++;
+    } while (!terminate && (offset < length));
+    flushStaged();
+    Transfer_flushReceived();
+    Flow_record((struct sockaddr*)pSource, sourceLength, datagrams, length, General_stats.receiveDropped - dropped,
+        General_stats.duplicatesDropped - duplicates);
+    return terminate;
+}
+
+// Receives messages until "!" arrives or shutdown begins. On shutdown, the datagrams already
+// queued on the socket are still delivered, until the deadline passes.
 void* receiveThread()
 {
+    uint8_t datagram[PACKET_RECEIVE_LEN];
+    struct sockaddr_storage source;
+    socklen_t sourceLength;
+    int segmentLength;
 	while (1) {
-		char message[MSG_MAX_LEN];
-        int bytesReceived = recvfrom(socketDescriptor, message, MSG_MAX_LEN, 0, NULL, NULL);
+        int bytesReceived = receiveDatagram(datagram, PACKET_RECEIVE_LEN, &source, &sourceLength, &segmentLength);
+        receivedAt = Trace_now();
+        if (bytesReceived == RECEIVE_SHUTDOWN) {
+            break;
+        }
         if (bytesReceived < 0) {
-            General_print("Receive Thread Error: Failed to receive a message\n");
+            Log_write(LOG_ERROR, "Receive Thread Error: Failed to receive a message\n");
             continue;
         } 
-       
-        size_t messageSize;
-        int terminateIndex;
-        if (bytesReceived < MSG_MAX_LEN) {
-            terminateIndex = bytesReceived;
-            messageSize = bytesReceived + 1;
-        } else {
-            terminateIndex = MSG_MAX_LEN - 1;
-            messageSize = MSG_MAX_LEN;
-        }
-        message[terminateIndex] = 0;
-        char* pMessage = (char*)malloc(messageSize);
-        memcpy(pMessage, message, messageSize);
-        if (strcmp(pMessage, "!\n") == 0) {
-            Receiver_addToReceiveList(pMessage);
+        if (Receiver_handleDatagrams(datagram, bytesReceived, segmentLength, &source, sourceLength)) {
+            closeReceiveList();
             return NULL;
         }
-        Receiver_addToReceiveList(pMessage);
 	}
+
+    while (!General_shutdownDeadlinePassed()) {
+        int bytesReceived = Shm_receive(datagram, PACKET_RECEIVE_LEN, &source, &sourceLength);
+        if (bytesReceived > 0) {
+            segmentLength = bytesReceived;
+        }
+        else {
+            bytesReceived = Packet_receive(datagram, PACKET_RECEIVE_LEN, MSG_DONTWAIT, &source, &sourceLength, &segmentLength);
+        }
+        receivedAt = Trace_now();
+        if ((bytesReceived < 0) || Receiver_handleDatagrams(datagram, bytesReceived, segmentLength, &source, sourceLength)) {
+            break;
+        }
+    }
+    closeReceiveList();
+    return NULL;
 }
 
-// Create a empty list and a UDP input thread that puts received message onto the newly created list
+// Spin instead of sleeping while waiting for messages, trading CPU time for wakeup latency
+void Receiver_enableBusyPoll()
+{
+    busyPoll = true;
+}
+
+// Create a empty list for received messages
 void Receiver_init()
 {
+#ifdef SO_BUSY_POLL
+    if (busyPoll) {
+        // Needs CAP_NET_ADMIN to raise above the system default; spinning works without it
+        int busyPollUsec = BUSY_POLL_SOCKET_USEC;
+        setsockopt(socketDescriptor, SOL_SOCKET, SO_BUSY_POLL, &busyPollUsec, sizeof(busyPollUsec));
+    }
+#endif
     pReceiveList = List_create();
     if (pReceiveList == NULL) {
-        General_print("Receive Thread Error: Failed to create the receive list\n");
+        Log_write(LOG_ERROR, "Receive Thread Error: Failed to create the receive list\n");
         exit(EXIT_FAILURE);
     }
-    if (pthread_create(&threadPID, NULL, receiveThread, NULL) != 0) {
-        General_print("Receive Thread Error: Failed to create the receive thread\n");
+}
+
+// Create a UDP input thread that puts received message onto the receive list
+void Receiver_start()
+{
+    if (Scheduler_createThread(&threadPID, THREAD_RECEIVER, receiveThread) != 0) {
+        Log_write(LOG_ERROR, "Receive Thread Error: Failed to create the receive thread\n");
         exit(EXIT_FAILURE);
     }
 }
 
-// Add message to the receive list
-void Receiver_addToReceiveList(char* message)
+// Add count messages, admitted as from flows, to the receive list, earliest first, in one step
+void Receiver_addBatchToReceiveList(char** messages, const int* flows, int count)
 {
+    int added = 0;
     pthread_mutex_lock(&receiveListMutex);
     {
-        if (List_prepend(pReceiveList, message) == -1) {
-            General_print("Receive Thread Error: Failed to add a received message to the receive list\n");
-            free(message);
-        } else if (List_count(pReceiveList) == 1) {
+        bool wasEmpty = List_count(pReceiveList) == 0;
+        int room = Config_settings.receiveQueueCapacity - List_count(pReceiveList);
+        added = (count < room) ? count : ((room > 0) ? room : 0);
+        if ((added > 0) && (List_prependMany(pReceiveList, (void**)messages, added) == -1)) {
+            // Too few nodes left for all of them; add as many as there are
+            int fit = 0;
+            while ((fit < added) && (List_prepend(pReceiveList, messages[fit]) == 0)) {
+                fit++;
+            }
+            added = fit;
+        }
+        int first = queuedFirst + List_count(pReceiveList) - added;
+        for (int i = 0; i < added; i++) {
+            queuedFlows[(first + i) % LIST_MAX_NUM_NODES] = flows[i];
+        }
+        if (wasEmpty && (added > 0)) {
             pthread_cond_signal(&listNotEmptyCondVar);
         }
+        atomic_store_explicit(&receiveListCount, List_count(pReceiveList), memory_order_release);
     }
     pthread_mutex_unlock(&receiveListMutex);
+
+    if (added < count) {
+        Log_write(LOG_ERROR, "Receive Thread Error: Failed to add a received message to the receive list\n");
+        General_stats.receiveDropped += count - added;
+        for (int i = added; i < count; i++) {
+            Arena_free(messages[i]);
+            Flow_dequeued(flows[i]);
+        }
+    }
 }
 
-// Get the earliest received message from the receive list
-char* Receiver_getFromReceiveList()
+// Get up to maxMessages of the earliest received messages from the receive list, earliest first
+// Returns 0 once the list is closed and empty
+int Receiver_getBatchFromReceiveList(char** messages, int maxMessages)
 {
-    char* message;
+    if (busyPoll) {
+        for (int spins = 0; (spins < BUSY_POLL_LIST_SPINS) && (atomic_load_explicit(&receiveListCount, memory_order_acquire) == 0) && !General_isShuttingDown(); spins++) {
+            cpuRelax();
+        }
+    }
+    int count;
     pthread_mutex_lock(&receiveListMutex);
     {
-        if (List_count(pReceiveList) == 0) {
+        while ((List_count(pReceiveList) == 0) && !receiveListClosed) {
             pthread_cond_wait(&listNotEmptyCondVar, &receiveListMutex);
         }
-        message = (char*)List_trim(pReceiveList);
+        count = List_drain(pReceiveList, (void**)messages, maxMessages);
+        atomic_store_explicit(&receiveListCount, List_count(pReceiveList), memory_order_relaxed);
+        for (int i = 0; i < count; i++) {
+            Flow_dequeued(queuedFlows[queuedFirst]);
+            queuedFirst = (queuedFirst + 1) % LIST_MAX_NUM_NODES;
+        }
     }
     pthread_mutex_unlock(&receiveListMutex);
-    return message;
+    return count;
 }
 
-// Cancel and wait for thread to finish, then cleanup memory
+// Wait for the thread to finish once shutdown has begun, then cleanup memory.
+// Messages the print thread did not get to are counted as dropped.
 void Receiver_shutdown()
 {
-    pthread_cancel(threadPID);
     int result = pthread_join(threadPID, NULL);
     if (result != 0) {
-        General_print("Receive Thread Error: Failed to cancel and join thread\n");
+        Log_write(LOG_ERROR, "Receive Thread Error: Failed to join thread\n");
     }
 
-    pthread_mutex_trylock(&receiveListMutex);
-    pthread_mutex_unlock(&receiveListMutex);
     result = pthread_mutex_destroy(&receiveListMutex);
     if (result != 0) {
-		General_print("Receive Thread Error: Failed to destroy the mutex\n");
+		Log_write(LOG_ERROR, "Receive Thread Error: Failed to destroy the mutex\n");
 	}
 
     result = pthread_cond_destroy(&listNotEmptyCondVar);
     if (result != 0) {
-		General_print("Receive Thread Error: Failed to destroy the conditional variable\n");
+		Log_write(LOG_ERROR, "Receive Thread Error: Failed to destroy the conditional variable\n");
 	}
 
+    General_stats.receiveDropped += List_count(pReceiveList);
     List_free(pReceiveList, (*General_freeFunction));
 }
@@ -1,16 +1,35 @@
 #ifndef _RECEIVER_H_
 #define _RECEIVER_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
 
-// Start background receive thread
+// Spin instead of sleeping while waiting for messages; call before Receiver_init()
+void Receiver_enableBusyPoll();
+
+// Create the receive list
 void Receiver_init();
 
-// Add message to the receive list
-void Receiver_addToReceiveList(char* receivedMessage);
+// Start background receive thread
+void Receiver_start();
+
+// Add count messages to the receive list, earliest first, in one step, message i counted
+// against the share of flows[i], an index returned by Flow_admit(). Messages beyond the receive
+// queue capacity are dropped.
+void Receiver_addBatchToReceiveList(char** messages, const int* flows, int count);
+
+// Handle the datagrams coalesced in a receive of length bytes from pSource, each
+// segmentLength long but the last
+// Called from the receive thread, and by the fuzz harness
+// Returns true if one is the "!" that ends the conversation
+bool Receiver_handleDatagrams(uint8_t* buffer, int length, int segmentLength, struct sockaddr_storage* pSource, socklen_t sourceLength);
 
-// Retrieve the earliest message from the receive list
-char* Receiver_getFromReceiveList();
+// Retrieve up to maxMessages of the earliest messages from the receive list, earliest first.
+// Waits until there is at least one. Returns the number of messages, or 0 once
+// the receive thread has finished and every message has been taken.
+int Receiver_getBatchFromReceiveList(char** messages, int maxMessages);
 
-// Stop background receive thread and cleanup
+// Wait for background receive thread to finish once shutdown has begun, and cleanup
 void Receiver_shutdown();
 
 #endif
@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "general.h"
+#include "impair.h"
+#include "log.h"
+#include "packet.h"
+#include "peer.h"
+#include "relay.h"
+#include "room.h"
+#include "sender.h"
+#include "trace.h"
+
+static bool enabled = false;
+
+// The receive thread's copy of the peer table, by registration index
+static uint32_t generations[PEER_MAX_PEERS];
+static struct sockaddr_storage addresses[PEER_MAX_PEERS];
+static socklen_t addressLengths[PEER_MAX_PEERS];
+static enum PeerState states[PEER_MAX_PEERS];
+static int peerCount = 0;
+static uint64_t lastRefresh = 0;
+
+// The generation of the peer at each index when its room subscriptions were last cleared
+static uint32_t roomGenerations[PEER_MAX_PEERS];
+
+// Token bucket of joins, in millionths of a join, refilled at RELAY_JOIN_RATE per second up
+// to RELAY_JOIN_BURST joins
+#define RELAY_JOIN_TOKEN 1000000
+static uint64_t joinTokens = 0;
+static uint64_t joinsFilledAt = 0;
+
+static struct mmsghdr batch[RELAY_BATCH_SIZE];
+
+// Copy the addresses of new peers and the states of all of them from the peer table. A peer
+// given the index of an evicted one starts in no room.
+static void refresh()
+{
+    peerCount = Peer_snapshot(generations, addresses, addressLengths, states);
+    for (int i = 0; i < peerCount; i++) {
+        if (roomGenerations[i] != generations[i]) {
+            if (generations[i] > 1) {
+                Room_unsubscribeAll(i);
+            }
+            roomGenerations[i] = generations[i];
+        }
+    }
+    lastRefresh = General_monotonicMicros();
+}
+
+// Take a token from the bucket of joins
+// Returns false if joins are over their rate
+static bool admitJoin()
+{
+    uint64_t now = General_monotonicMicros();
+    uint64_t capacity = (uint64_t)RELAY_JOIN_BURST * RELAY_JOIN_TOKEN;
+    uint64_t elapsed = now - joinsFilledAt;
+    joinsFilledAt = now;
+    if ((joinTokens >= capacity) || (elapsed >= (capacity - joinTokens) / RELAY_JOIN_RATE)) {
+        joinTokens = capacity;
+    }
+    else {
+        joinTokens += elapsed * RELAY_JOIN_RATE;
+    }
+    if (joinTokens < RELAY_JOIN_TOKEN) {
+        return false;
+    }
+    joinTokens -= RELAY_JOIN_TOKEN;
+    return true;
+}
+
+// Send the first count datagrams of the batch, retrying the ones a call did not get to
+static void sendBatch(int count)
+{
+    int first = 0;
+    while (first < count) {
+        int sent = sendmmsg(socketDescriptor, &batch[first], count - first, 0);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Skip the datagram that failed and carry on with the rest
+            General_stats.sendFailures++;
+            sent = 1;
+        }
+        else {
+            General_stats.messagesRelayed += sent;
+        }
+        first += sent;
+    }
+}
+
+// Forward chat messages instead of displaying them
+void Relay_enable()
+{
+    enabled = true;
+}
+
+// Returns true in relay mode
+bool Relay_enabled()
+{
+    return enabled;
+}
+
+// Register pSource as a peer, unless joins are over their rate, and refresh the addresses to
+// forward to
+bool Relay_join(const struct sockaddr* pSource, socklen_t sourceLength)
+{
+    if (!admitJoin()) {
+        Log_write(LOG_WARN, "Receive Thread Error: Peers joining too fast, refused one\n");
+        return false;
+    }
+    if (Peer_register(pSource, sourceLength, false) != 0) {
+        Log_write(LOG_ERROR, "Receive Thread Error: Too many peers to relay to\n");
+        return false;
+    }
+    Peer_heardFrom(pSource, sourceLength);
+    refresh();
+    return true;
+}
+
+// Add peer i to the batch of destinations of the datagram described by pPart, sending the
+// batch once it is full; with impairment, send to it at once
+static void addDestination(int i, struct iovec* pPart, int* pCount)
+{
+    if (Impair_enabled()) {
+        if (Impair_send(pPart->iov_base, pPart->iov_len, (struct sockaddr*)&addresses[i], addressLengths[i]) < 0) {
+            General_stats.sendFailures++;
+        }
+        else {
+            General_stats.messagesRelayed++;
+        }
+        return;
+    }
+    struct msghdr* pMessage = &batch[*pCount].msg_hdr;
+    memset(pMessage, 0, sizeof(*pMessage));
+    pMessage->msg_name = &addresses[i];
+    pMessage->msg_namelen = addressLengths[i];
+    pMessage->msg_iov = pPart;
+    pMessage->msg_iovlen = 1;
+    if (++*pCount == RELAY_BATCH_SIZE) {
+        sendBatch(*pCount);
+        *pCount = 0;
+    }
+}
+
+// Send the chat datagram of length bytes to every peer in room but pSource that is not dead,
+// a batch of datagrams per call, all pointing at the same buffer. The default room goes to
+// every peer; other rooms go to the bits set in their subscriber sets, and only if pSource is
+// one of them. A "!", traced or not, only ends its sender's conversation, so it is not
+// forwarded.
+void Relay_forward(uint8_t* datagram, int length, uint16_t room, const struct sockaddr* pSource, socklen_t sourceLength)
+{
+    PacketHeader header;
+    if (Packet_decodeHeader(datagram, length, &header) != 0) {
+        return;
+    }
+    int textLength = Trace_textLength(&datagram[PACKET_HEADER_LEN], length - PACKET_HEADER_LEN, (header.flags & PACKET_FLAG_TRACED) != 0);
+    if ((textLength == 2) && (memcmp(&datagram[PACKET_HEADER_LEN], "!\n", 2) == 0)) {
+        return;
+    }
+    const uint64_t* subscribers = NULL;
+    if (room != ROOM_DEFAULT) {
+        subscribers = Room_subscribers(room);
+        int source = Peer_indexOf(pSource, sourceLength);
+        if ((subscribers == NULL) || (source < 0) || ((subscribers[source >> 6] & (1ULL << (source & 63))) == 0)) {
+            return;
+        }
+    }
+    if (General_monotonicMicros() - lastRefresh >= RELAY_REFRESH_MS * 1000) {
+        refresh();
+    }
+    Packet_writeBigEndian(&datagram[4], Sender_nextSequence(), 4);
+    struct iovec part = {.iov_base = datagram, .iov_len = length};
+    int count = 0;
+    if (subscribers == NULL) {
+        for (int i = 0; i < peerCount; i++) {
+            if ((states[i] != PEER_DEAD) && !Peer_sameAddress((struct sockaddr*)&addresses[i], pSource)) {
+                addDestination(i, &part, &count);
+            }
+        }
+    }
+    else {
+        for (int word = 0; word < (peerCount + 63) / 64; word++) {
+            for (uint64_t bits = subscribers[word]; bits != 0; bits &= bits - 1) {
+                int i = word * 64 + __builtin_ctzll(bits);
+                if ((i < peerCount) && (states[i] != PEER_DEAD) && !Peer_sameAddress((struct sockaddr*)&addresses[i], pSource)) {
+                    addDestination(i, &part, &count);
+                }
+            }
+        }
+    }
+    if (count > 0) {
+        sendBatch(count);
+    }
+}
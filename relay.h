@@ -0,0 +1,45 @@
+#ifndef _RELAY_H_
+#define _RELAY_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Relay mode turns s-talk into a hub. Any address that sends a datagram is registered as a
+// peer, at most RELAY_JOIN_RATE new ones per second, and evicted once it has been silent for
+// PEER_EVICT_INTERVALS. Every chat message is forwarded to all other peers that are not dead, straight
+// from the receive buffer, instead of being displayed. The forwarded datagram keeps its
+// timestamp and payload; only its sequence number is rewritten, since every copy now comes
+// from this socket.
+//
+// Forwarding runs on the receive thread, which keeps its own copy of the peer addresses in
+// one contiguous array, and sends to up to RELAY_BATCH_SIZE of them per system call.
+
+// Most datagrams handed to the kernel in one call
+#define RELAY_BATCH_SIZE 64
+
+// Milliseconds between refreshes of the peer addresses and states the receive thread uses
+#define RELAY_REFRESH_MS 100
+
+// Peers that may join per second, and at once after a quiet spell. Over the time it takes to
+// evict a silent peer, a flood of joins from spoofed addresses fills less than the peer table.
+#define RELAY_JOIN_RATE 32
+#define RELAY_JOIN_BURST 256
+
+// Forward chat messages instead of displaying them; call before Receiver_start()
+void Relay_enable();
+
+// Returns true in relay mode
+bool Relay_enabled();
+
+// Register pSource as a peer, unless joins are over their rate, and refresh the addresses to
+// forward to
+// Called from the receive thread for datagrams from unregistered addresses
+// Returns false if pSource was not registered, and its datagram must be dropped
+bool Relay_join(const struct sockaddr* pSource, socklen_t sourceLength);
+
+// Send the chat datagram of length bytes to every peer in room but pSource that is not dead,
+// if pSource is in the room, unless it is the "!" that ends its sender's conversation
+// Called from the receive thread
+void Relay_forward(uint8_t* datagram, int length, uint16_t room, const struct sockaddr* pSource, socklen_t sourceLength);
+
+#endif
@@ -0,0 +1,277 @@
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "general.h"
+#include "log.h"
+#include "resolver.h"
+
+#define RESOLVER_CACHE_SIZE 16
+#define RESOLVER_MAX_NAME_LEN 256
+#define RESOLVER_MAX_PORT_LEN 32
+
+// Milliseconds between checks for shutdown while waiting for a resolution
+#define RESOLVER_WAIT_SLICE_MS 50
+
+// Field refreshing is set while the entry waits for or undergoes resolution.
+// Field expiry is when the entry should be resolved again, in monotonic seconds.
+typedef struct CacheEntry_s CacheEntry;
+struct CacheEntry_s {
+    bool used;
+    char machineName[RESOLVER_MAX_NAME_LEN];
+    char port[RESOLVER_MAX_PORT_LEN];
+    bool resolved;
+    bool refreshing;
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+    time_t expiry;
+};
+
+static CacheEntry cache[RESOLVER_CACHE_SIZE];
+static pthread_t threadPID;
+static bool stopping = false;
+static bool finished = false;
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workCondVar = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t resolvedCondVar;
+
+// Returns the current monotonic time in seconds
+static time_t now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec;
+}
+
+// Set pDeadline to one wait slice from now, in monotonic time
+static void sliceDeadline(struct timespec* pDeadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, pDeadline);
+    pDeadline->tv_nsec += RESOLVER_WAIT_SLICE_MS * 1000000L;
+    if (pDeadline->tv_nsec >= 1000000000L) {
+        pDeadline->tv_sec++;
+        pDeadline->tv_nsec -= 1000000000L;
+    }
+}
+
+// Resolves machineName and port to an address in the family of the local socket.
+// IPv4 addresses are mapped into IPv6 for a dual-stack socket.
+// Returns 0 on success, -1 on failure
+static int resolve(const char* machineName, const char* port, struct sockaddr_storage* pAddress, socklen_t* pAddressLength)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = (socketFamily == AF_INET6) ? AF_UNSPEC : AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo* pResults;
+    if (getaddrinfo(machineName, port, &hints, &pResults) != 0) {
+        return -1;
+    }
+
+    int result = -1;
+    for (struct addrinfo* p = pResults; (p != NULL) && (result != 0); p = p->ai_next) {
+        memset(pAddress, 0, sizeof(*pAddress));
+        if (p->ai_family == socketFamily) {
+            memcpy(pAddress, p->ai_addr, p->ai_addrlen);
+            *pAddressLength = p->ai_addrlen;
+            result = 0;
+        }
+        else if ((p->ai_family == AF_INET) && (socketFamily == AF_INET6)) {
+            struct sockaddr_in* pIPv4 = (struct sockaddr_in*)p->ai_addr;
+            struct sockaddr_in6* pIPv6 = (struct sockaddr_in6*)pAddress;
+            pIPv6->sin6_family = AF_INET6;
+            pIPv6->sin6_port = pIPv4->sin_port;
+            pIPv6->sin6_addr.s6_addr[10] = 0xff;
+            pIPv6->sin6_addr.s6_addr[11] = 0xff;
+            memcpy(&pIPv6->sin6_addr.s6_addr[12], &pIPv4->sin_addr, sizeof(pIPv4->sin_addr));
+            *pAddressLength = sizeof(struct sockaddr_in6);
+            result = 0;
+        }
+    }
+    freeaddrinfo(pResults);
+    return result;
+}
+
+// Returns the cache entry of machineName and port, or NULL if there is none
+// Must be called with cacheMutex held
+static CacheEntry* findEntry(const char* machineName, const char* port)
+{
+    for (int i = 0; i < RESOLVER_CACHE_SIZE; i++) {
+        if (cache[i].used && (strcmp(cache[i].machineName, machineName) == 0) && (strcmp(cache[i].port, port) == 0)) {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+// Returns the cache entry of machineName and port, adding it (in place of an unused entry or the
+// one expiring first) if needed. Returns NULL if the names are too long or every entry is busy.
+// Must be called with cacheMutex held
+static CacheEntry* findOrAddEntry(const char* machineName, const char* port)
+{
+    CacheEntry* pEntry = findEntry(machineName, port);
+    if (pEntry != NULL) {
+        return pEntry;
+    }
+    if ((strlen(machineName) >= RESOLVER_MAX_NAME_LEN) || (strlen(port) >= RESOLVER_MAX_PORT_LEN)) {
+        return NULL;
+    }
+    for (int i = 0; i < RESOLVER_CACHE_SIZE; i++) {
+        if (!cache[i].refreshing && ((pEntry == NULL) || !cache[i].used || (pEntry->used && (cache[i].expiry < pEntry->expiry)))) {
+            pEntry = &cache[i];
+        }
+    }
+    if (pEntry == NULL) {
+        return NULL;
+    }
+    memset(pEntry, 0, sizeof(*pEntry));
+    pEntry->used = true;
+    strcpy(pEntry->machineName, machineName);
+    strcpy(pEntry->port, port);
+    return pEntry;
+}
+
+// Queues pEntry for resolution if it was never resolved or has expired
+// Must be called with cacheMutex held
+static void refreshIfNeeded(CacheEntry* pEntry)
+{
+    if (!pEntry->refreshing && (now() >= pEntry->expiry)) {
+        pEntry->refreshing = true;
+        pthread_cond_signal(&workCondVar);
+    }
+}
+
+// Resolves queued cache entries one at a time, without holding the cache lock while resolving
+void* resolverThread()
+{
+    pthread_mutex_lock(&cacheMutex);
+    while (!stopping) {
+        CacheEntry* pEntry = NULL;
+        for (int i = 0; (i < RESOLVER_CACHE_SIZE) && (pEntry == NULL); i++) {
+            if (cache[i].used && cache[i].refreshing) {
+                pEntry = &cache[i];
+            }
+        }
+        if (pEntry == NULL) {
+            pthread_cond_wait(&workCondVar, &cacheMutex);
+            continue;
+        }
+
+        char machineName[RESOLVER_MAX_NAME_LEN];
+        char port[RESOLVER_MAX_PORT_LEN];
+        strcpy(machineName, pEntry->machineName);
+        strcpy(port, pEntry->port);
+        struct sockaddr_storage address;
+        socklen_t addressLength;
+        pthread_mutex_unlock(&cacheMutex);
+        int result = resolve(machineName, port, &address, &addressLength);
+        pthread_mutex_lock(&cacheMutex);
+
+        if (result == 0) {
+            pEntry->address = address;
+            pEntry->addressLength = addressLength;
+            pEntry->resolved = true;
+            pEntry->expiry = now() + RESOLVER_TTL_SECONDS;
+        }
+        else {
+            // A previously resolved address stays in use until a resolution succeeds
+            pEntry->expiry = now() + RESOLVER_RETRY_SECONDS;
+        }
+        pEntry->refreshing = false;
+        pthread_cond_broadcast(&resolvedCondVar);
+    }
+    finished = true;
+    pthread_cond_broadcast(&resolvedCondVar);
+    pthread_mutex_unlock(&cacheMutex);
+    return NULL;
+}
+
+// Create the thread that resolves cache entries
+void Resolver_start()
+{
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&resolvedCondVar, &attributes);
+    pthread_condattr_destroy(&attributes);
+    if (pthread_create(&threadPID, NULL, resolverThread, NULL) != 0) {
+        Log_write(LOG_ERROR, "Resolver Thread Error: Failed to create the resolver thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Start resolving machineName and port, without waiting for the result
+void Resolver_prefetch(const char* machineName, const char* port)
+{
+    pthread_mutex_lock(&cacheMutex);
+    {
+        CacheEntry* pEntry = findOrAddEntry(machineName, port);
+        if (pEntry != NULL) {
+            refreshIfNeeded(pEntry);
+        }
+    }
+    pthread_mutex_unlock(&cacheMutex);
+}
+
+// Copy the address of machineName and port to pAddress, resolving it again in the background
+// if it has expired. Waits for the first resolution if wait is true, until shutdown begins.
+int Resolver_lookup(const char* machineName, const char* port, struct sockaddr_storage* pAddress, socklen_t* pAddressLength, bool wait)
+{
+    int result = -1;
+    pthread_mutex_lock(&cacheMutex);
+    {
+        CacheEntry* pEntry = findOrAddEntry(machineName, port);
+        if (pEntry != NULL) {
+            refreshIfNeeded(pEntry);
+            while (wait && !stopping && !General_isShuttingDown() && (pEntry != NULL) && !pEntry->resolved && pEntry->refreshing) {
+                // getaddrinfo() cannot be interrupted, so shutdown is noticed between timeouts
+                struct timespec deadline;
+                sliceDeadline(&deadline);
+                pthread_cond_timedwait(&resolvedCondVar, &cacheMutex, &deadline);
+                pEntry = findEntry(machineName, port);
+            }
+        }
+        if ((pEntry != NULL) && pEntry->resolved) {
+            memcpy(pAddress, &pEntry->address, sizeof(*pAddress));
+            *pAddressLength = pEntry->addressLength;
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(&cacheMutex);
+    return result;
+}
+
+// Wake and wait for the resolver thread to finish, then cleanup. A thread still inside
+// getaddrinfo() when the shutdown deadline passes is left behind, with the lock it will take.
+void Resolver_shutdown()
+{
+    bool detach;
+    pthread_mutex_lock(&cacheMutex);
+    {
+        stopping = true;
+        pthread_cond_signal(&workCondVar);
+        pthread_cond_broadcast(&resolvedCondVar);
+        while (!finished && !General_shutdownDeadlinePassed()) {
+            struct timespec deadline;
+            sliceDeadline(&deadline);
+            pthread_cond_timedwait(&resolvedCondVar, &cacheMutex, &deadline);
+        }
+        detach = !finished;
+    }
+    pthread_mutex_unlock(&cacheMutex);
+
+    if (detach) {
+        Log_write(LOG_WARN, "Resolver Thread Error: Left the thread waiting on a resolution\n");
+        pthread_detach(threadPID);
+        return;
+    }
+    int result = pthread_join(threadPID, NULL);
+    if (result != 0) {
+        Log_write(LOG_ERROR, "Resolver Thread Error: Failed to join thread\n");
+    }
+    pthread_mutex_destroy(&cacheMutex);
+    pthread_cond_destroy(&workCondVar);
+    pthread_cond_destroy(&resolvedCondVar);
+}
@@ -0,0 +1,32 @@
+#ifndef _RESOLVER_H_
+#define _RESOLVER_H_
+#include <stdbool.h>
+#include <sys/socket.h>
+
+// Host names are resolved with getaddrinfo() on a background thread and cached. An expired
+// address keeps being returned while it is resolved again, so senders never wait on DNS
+// for a peer they have already reached once.
+
+// Seconds a resolved address is used before it is resolved again
+#define RESOLVER_TTL_SECONDS 60
+
+// Seconds before a failed resolution is attempted again
+#define RESOLVER_RETRY_SECONDS 5
+
+// Start background resolver thread
+void Resolver_start();
+
+// Start resolving machineName and port, without waiting for the result
+void Resolver_prefetch(const char* machineName, const char* port);
+
+// Copy the address of machineName and port, in the family of the local socket, to pAddress.
+// If it has not been resolved yet, waits for the resolution if wait is true, but not past the
+// start of shutdown.
+// Returns 0 on success, -1 if no address is available
+int Resolver_lookup(const char* machineName, const char* port, struct sockaddr_storage* pAddress, socklen_t* pAddressLength, bool wait);
+
+// Stop background resolver thread, waiting no later than the shutdown deadline for a
+// resolution in progress
+void Resolver_shutdown();
+
+#endif
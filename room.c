@@ -0,0 +1,345 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "general.h"
+#include "log.h"
+#include "packet.h"
+#include "peer.h"
+#include "room.h"
+#include "timer.h"
+
+#define ROOM_BITSET_WORDS (PEER_MAX_PEERS / 64)
+
+// A room this end joined
+typedef struct JoinedRoom_s JoinedRoom;
+struct JoinedRoom_s {
+    uint16_t id;
+    char name[ROOM_NAME_LEN + 1];
+};
+
+// Rooms this end joined, shared by the send thread, the tick thread resending them and the
+// receive thread filtering messages
+static JoinedRoom joined[ROOM_MAX_JOINED];
+static int joinedCount = 0;
+static struct sockaddr_storage remote;
+static socklen_t remoteLength = 0;
+static Timer refreshTimer;
+static pthread_mutex_t roomMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Room messages are typed to, set by the send thread and reset by the receive thread when
+// the hub refuses a join
+static atomic_ushort currentRoom = ROOM_DEFAULT;
+
+// A room of the hub: the name it was joined under, kept while it has members, and who they are
+typedef struct HubRoom_s HubRoom;
+struct HubRoom_s {
+    char name[ROOM_NAME_LEN + 1];
+    int members;
+    uint64_t subscribers[ROOM_BITSET_WORDS];
+};
+
+// Rooms of the hub, allocated when a room gets its first subscriber and only used by the
+// receive thread
+static HubRoom* hubRooms[ROOM_ID_COUNT];
+
+// Returns the id of the room called name: its FNV-1a hash, never ROOM_DEFAULT
+uint16_t Room_idOf(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    for (const char* pChar = name; *pChar != 0; pChar++) {
+        hash = (hash ^ (uint8_t)*pChar) * 16777619u;
+    }
+    return 1 + hash % (ROOM_ID_COUNT - 1);
+}
+
+// Send a room packet with action for room id, called name, to pAddress
+// Returns 0 on success, -1 on failure
+static int sendRoomPacket(uint16_t id, enum RoomAction action, const char* name, const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    PacketHeader header = {.type = PACKET_ROOM, .flags = id, .sequence = 0, .timestamp = General_monotonicMicros()};
+    uint8_t payload[1 + ROOM_NAME_LEN];
+    size_t nameLength = strlen(name);
+    payload[0] = action;
+    memcpy(&payload[1], name, nameLength);
+    return Packet_send(&header, payload, 1 + nameLength, pAddress, addressLength);
+}
+
+// Send a subscription to room id, called name, to the remote user
+static void sendSubscription(uint16_t id, bool join, const char* name, const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    if (sendRoomPacket(id, join ? ROOM_JOIN : ROOM_LEAVE, name, pAddress, addressLength) < 0) {
+        Log_write(LOG_ERROR, "Send Thread Error: Failed to send a room subscription\n");
+    }
+}
+
+// Runs on the tick thread every keepalive interval: sends every joined room again, in case
+// the hub missed a subscription or restarted
+static void refreshSubscriptions(Timer* pTimer, void* pArg)
+{
+    JoinedRoom rooms[ROOM_MAX_JOINED];
+    int count;
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+    pthread_mutex_lock(&roomMutex);
+    {
+        count = joinedCount;
+        memcpy(rooms, joined, count * sizeof(JoinedRoom));
+        address = remote;
+        addressLength = remoteLength;
+    }
+    pthread_mutex_unlock(&roomMutex);
+
+    for (int i = 0; i < count; i++) {
+        sendSubscription(rooms[i].id, true, rooms[i].name, (struct sockaddr*)&address, addressLength);
+    }
+    Timer_schedule(pTimer, KEEPALIVE_INTERVAL_MS, refreshSubscriptions, NULL);
+}
+
+// Returns the index of room id in joined, or -1
+// Must be called with roomMutex held
+static int findJoined(uint16_t id)
+{
+    for (int i = 0; i < joinedCount; i++) {
+        if (joined[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Subscribe to the room called name and make it current
+static void join(const char* name, const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    uint16_t id = Room_idOf(name);
+    bool added = true;
+    bool first = false;
+    char clash[ROOM_NAME_LEN + 1] = "";
+    pthread_mutex_lock(&roomMutex);
+    {
+        int index = findJoined(id);
+        if ((index >= 0) && (strcmp(joined[index].name, name) != 0)) {
+            snprintf(clash, sizeof(clash), "%s", joined[index].name);
+            added = false;
+        }
+        else if (index >= 0) {
+            // Already joined
+        }
+        else if (joinedCount == ROOM_MAX_JOINED) {
+            added = false;
+        }
+        else {
+            joined[joinedCount].id = id;
+            snprintf(joined[joinedCount].name, sizeof(joined[joinedCount].name), "%s", name);
+            first = (joinedCount++ == 0);
+        }
+        memcpy(&remote, pAddress, addressLength);
+        remoteLength = addressLength;
+    }
+    pthread_mutex_unlock(&roomMutex);
+
+    if (clash[0] != 0) {
+        char report[2 * ROOM_NAME_LEN + 96];
+        snprintf(report, sizeof(report), "[Room %s has the same id as room %s, which you are in; pick another name]\n", name, clash);
+        General_print(report);
+        return;
+    }
+    if (!added) {
+        Log_write(LOG_WARN, "Send Thread Error: Too many rooms joined\n");
+        return;
+    }
+    currentRoom = id;
+    sendSubscription(id, true, name, pAddress, addressLength);
+    if (first) {
+        Timer_schedule(&refreshTimer, KEEPALIVE_INTERVAL_MS, refreshSubscriptions, NULL);
+    }
+}
+
+// Unsubscribe from the room called name, returning to the default room if it was current
+static void leave(const char* name, const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    uint16_t id = Room_idOf(name);
+    bool member = false;
+    pthread_mutex_lock(&roomMutex);
+    {
+        int index = findJoined(id);
+        if ((index >= 0) && (strcmp(joined[index].name, name) == 0)) {
+            joined[index] = joined[--joinedCount];
+            member = true;
+        }
+    }
+    pthread_mutex_unlock(&roomMutex);
+
+    if (!member) {
+        // Leaving a room that only shares its id would leave the one this end is in
+        return;
+    }
+    uint16_t expected = id;
+    atomic_compare_exchange_strong(&currentRoom, &expected, ROOM_DEFAULT);
+    sendSubscription(id, false, name, pAddress, addressLength);
+}
+
+// Apply line if it is a room command, sending the subscription to pRemote
+bool Room_handleCommand(const char* line, const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    bool joining = (strncmp(line, ROOM_JOIN_COMMAND, strlen(ROOM_JOIN_COMMAND)) == 0);
+    bool leaving = (strncmp(line, ROOM_LEAVE_COMMAND, strlen(ROOM_LEAVE_COMMAND)) == 0);
+    if (!joining && !leaving) {
+        return false;
+    }
+    const char* start = joining ? &line[strlen(ROOM_JOIN_COMMAND)] : &line[strlen(ROOM_LEAVE_COMMAND)];
+    char name[ROOM_NAME_LEN + 1];
+    size_t length = strcspn(start, "\n");
+    if ((length == 0) || (length > ROOM_NAME_LEN)) {
+        Log_write(LOG_WARN, "Send Thread Error: Room names are 1 to 32 characters long\n");
+        return true;
+    }
+    memcpy(name, start, length);
+    name[length] = 0;
+    if (joining) {
+        join(name, pAddress, addressLength);
+    }
+    else {
+        leave(name, pAddress, addressLength);
+    }
+    return true;
+}
+
+// Returns the room typed messages are sent to
+uint16_t Room_current()
+{
+    return currentRoom;
+}
+
+// Copy the name of room id, if this end joined it, to name
+int Room_name(uint16_t id, char* name, size_t size)
+{
+    int result = -1;
+    pthread_mutex_lock(&roomMutex);
+    {
+        int index = findJoined(id);
+        if (index >= 0) {
+            snprintf(name, size, "%s", joined[index].name);
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(&roomMutex);
+    return result;
+}
+
+// Apply a room packet for room id from the peer with registration index peerIndex, refusing
+// a join under a name other than the room's while it has members
+void Room_subscribe(int peerIndex, uint16_t id, const uint8_t* payload, int length, const struct sockaddr* pSource, socklen_t sourceLength)
+{
+    if ((length < 1) || (id == ROOM_DEFAULT) || (id >= ROOM_ID_COUNT) || (peerIndex < 0) || (peerIndex >= PEER_MAX_PEERS)) {
+        return;
+    }
+    bool join = (payload[0] == ROOM_JOIN);
+    if (!join && (payload[0] != ROOM_LEAVE)) {
+        return;
+    }
+    char name[ROOM_NAME_LEN + 1];
+    int nameLength = (length - 1 > ROOM_NAME_LEN) ? ROOM_NAME_LEN : length - 1;
+    memcpy(name, &payload[1], nameLength);
+    name[nameLength] = 0;
+
+    HubRoom* pRoom = hubRooms[id];
+    if (pRoom == NULL) {
+        if (!join) {
+            return;
+        }
+        pRoom = calloc(1, sizeof(HubRoom));
+        if (pRoom == NULL) {
+            Log_write(LOG_ERROR, "Receive Thread Error: Failed to allocate a room\n");
+            return;
+        }
+        hubRooms[id] = pRoom;
+    }
+    uint64_t* pWord = &pRoom->subscribers[peerIndex >> 6];
+    uint64_t bit = 1ULL << (peerIndex & 63);
+    bool member = (*pWord & bit) != 0;
+    if (!join) {
+        if (member) {
+            *pWord &= ~bit;
+            pRoom->members--;
+        }
+        return;
+    }
+    if ((pRoom->members == 0) || (pRoom->name[0] == 0)) {
+        snprintf(pRoom->name, sizeof(pRoom->name), "%s", name);
+    }
+    else if ((nameLength > 0) && (strcmp(pRoom->name, name) != 0)) {
+        // Another name with the same id; the room keeps the name it has
+        if (sendRoomPacket(id, ROOM_REFUSED, name, pSource, sourceLength) < 0) {
+            Log_write(LOG_ERROR, "Receive Thread Error: Failed to send a room refusal\n");
+        }
+        return;
+    }
+    if (!member) {
+        *pWord |= bit;
+        pRoom->members++;
+    }
+}
+
+// Leave room id if the hub refused the join, and tell the user
+void Room_handleRefusal(uint16_t id, const uint8_t* payload, int length, const struct sockaddr* pSource, socklen_t sourceLength)
+{
+    if ((length < 1) || (payload[0] != ROOM_REFUSED)) {
+        return;
+    }
+    char name[ROOM_NAME_LEN + 1];
+    bool left = false;
+    pthread_mutex_lock(&roomMutex);
+    {
+        int index = findJoined(id);
+        if ((remoteLength != 0) && Peer_sameAddress(pSource, (struct sockaddr*)&remote) && (index >= 0)) {
+            snprintf(name, sizeof(name), "%s", joined[index].name);
+            joined[index] = joined[--joinedCount];
+            left = true;
+        }
+    }
+    pthread_mutex_unlock(&roomMutex);
+
+    if (!left) {
+        return;
+    }
+    uint16_t expected = id;
+    atomic_compare_exchange_strong(&currentRoom, &expected, ROOM_DEFAULT);
+    char report[ROOM_NAME_LEN + 96];
+    snprintf(report, sizeof(report), "[The hub has another room with the id of %s; pick another name]\n", name);
+    General_print(report);
+}
+
+// Remove the peer with registration index peerIndex from every room
+void Room_unsubscribeAll(int peerIndex)
+{
+    if ((peerIndex < 0) || (peerIndex >= PEER_MAX_PEERS)) {
+        return;
+    }
+    uint64_t bit = 1ULL << (peerIndex & 63);
+    for (int id = 0; id < ROOM_ID_COUNT; id++) {
+        if ((hubRooms[id] != NULL) && (hubRooms[id]->subscribers[peerIndex >> 6] & bit)) {
+            hubRooms[id]->subscribers[peerIndex >> 6] &= ~bit;
+            hubRooms[id]->members--;
+        }
+    }
+}
+
+// Returns the subscribers of room id as a bitset indexed by registration index
+const uint64_t* Room_subscribers(uint16_t id)
+{
+    if ((id >= ROOM_ID_COUNT) || (hubRooms[id] == NULL) || (hubRooms[id]->members == 0)) {
+        return NULL;
+    }
+    return hubRooms[id]->subscribers;
+}
+
+// Free the rooms of the hub
+void Room_shutdown()
+{
+    for (int id = 0; id < ROOM_ID_COUNT; id++) {
+        free(hubRooms[id]);
+        hubRooms[id] = NULL;
+    }
+}
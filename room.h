@@ -0,0 +1,78 @@
+#ifndef _ROOM_H_
+#define _ROOM_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Named rooms, routed by a hub in relay mode. A chat message carries its room id in the low 15
+// bits of the flags of its header; room 0 is the default room, which every peer is in.
+//
+// Typing "/join NAME" subscribes to a room and sends the following messages to it, and
+// "/leave NAME" unsubscribes, returning to the default room. These lines go through the send
+// list, so they apply in order with the messages around them. Subscriptions are sent to the
+// remote user (the hub) as room packets, and sent again every keepalive interval in case one
+// was lost. Messages from rooms this end has not joined are dropped.
+//
+// The hub keeps a bitset per room, indexed by the registration index of each peer, so routing
+// a message to a room is a scan over PEER_MAX_PEERS / 8 contiguous bytes. Room ids are 15-bit
+// hashes, so two names can share one: the hub keeps the name a room was joined under, and
+// refuses joins under another name while the room has members, and the refused end leaves
+// the room. Messages from a peer to a room it is not in are not forwarded.
+//
+// Room packet: flags is the room id, payload is a RoomAction byte followed by the room name
+
+enum RoomAction {ROOM_LEAVE = 0, ROOM_JOIN = 1, ROOM_REFUSED = 2};
+
+#define ROOM_JOIN_COMMAND "/join "
+#define ROOM_LEAVE_COMMAND "/leave "
+
+// The default room, and the number of room ids; the others are hashes of room names
+#define ROOM_DEFAULT 0
+#define ROOM_ID_COUNT 32768
+
+// Longest room name, and most rooms one end can be subscribed to at once
+#define ROOM_NAME_LEN 32
+#define ROOM_MAX_JOINED 64
+
+// Returns the id of the room called name
+uint16_t Room_idOf(const char* name);
+
+// Apply line if it is a room command, sending the subscription to pRemote
+// Called from the send thread
+// Returns true if line is a room command
+bool Room_handleCommand(const char* line, const struct sockaddr* pRemote, socklen_t remoteLength);
+
+// Returns the room typed messages are sent to
+// Called from the send thread
+uint16_t Room_current();
+
+// Copy the name of room id, if this end joined it, to name
+// Returns 0 on success, -1 if this end is not in the room
+int Room_name(uint16_t id, char* name, size_t size);
+
+// Apply the payload of length bytes of a room packet for room id from the peer with
+// registration index peerIndex at pSource, adding it to the room or removing it. A join under
+// a name other than the room's is refused with a room packet back to pSource.
+// Called from the receive thread of the hub
+void Room_subscribe(int peerIndex, uint16_t id, const uint8_t* payload, int length, const struct sockaddr* pSource, socklen_t sourceLength);
+
+// Apply the payload of length bytes of a room packet for room id from pSource: if it is a
+// refusal from the hub, leave the room and tell the user
+// Called from the receive thread
+void Room_handleRefusal(uint16_t id, const uint8_t* payload, int length, const struct sockaddr* pSource, socklen_t sourceLength);
+
+// Remove the peer with registration index peerIndex from every room, when the index is given
+// to a new peer
+// Called from the receive thread
+void Room_unsubscribeAll(int peerIndex);
+
+// Returns the subscribers of room id as a bitset of PEER_MAX_PEERS bits indexed by
+// registration index, or NULL if the room has none
+// Called from the receive thread
+const uint64_t* Room_subscribers(uint16_t id);
+
+// Free the rooms of the hub, once the receive thread has finished
+void Room_shutdown();
+
+#endif
@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "general.h"
+#include "log.h"
+#include "scheduler.h"
+
+typedef struct ThreadSettings_s ThreadSettings;
+struct ThreadSettings_s {
+    bool pinned;
+    cpu_set_t cpus;
+    int priority;
+};
+
+static const char* roleNames[THREAD_NUM_ROLES] = {"input", "sender", "receiver", "printer"};
+static ThreadSettings settings[THREAD_NUM_ROLES];
+
+// Splits "role=value" into the role and a pointer to value
+// Returns 0 on success, -1 if the role is unknown or there is no value
+static int parseRole(const char* option, enum ThreadRole* pRole, const char** pValue)
+{
+    const char* pEquals = strchr(option, '=');
+    if ((pEquals == NULL) || (pEquals[1] == 0)) {
+        return -1;
+    }
+    for (int role = 0; role < THREAD_NUM_ROLES; role++) {
+        size_t length = strlen(roleNames[role]);
+        if (((size_t)(pEquals - option) == length) && (strncmp(option, roleNames[role], length) == 0)) {
+            *pRole = role;
+            *pValue = pEquals + 1;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Parses a CPU list such as "0,2-3" into pCpus
+// Returns 0 on success, -1 if the list is malformed
+static int parseCpuList(const char* cpuList, cpu_set_t* pCpus)
+{
+    CPU_ZERO(pCpus);
+    const char* p = cpuList;
+    while (*p != 0 && *p != '\n') {
+        char* pEnd;
+        long first = strtol(p, &pEnd, 10);
+        long last = first;
+        if ((pEnd == p) || (first < 0)) {
+            return -1;
+        }
+        if (*pEnd == '-') {
+            p = pEnd + 1;
+            last = strtol(p, &pEnd, 10);
+            if ((pEnd == p) || (last < first)) {
+                return -1;
+            }
+        }
+        if (last >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, pCpus);
+        }
+        p = (*pEnd == ',') ? pEnd + 1 : pEnd;
+        if ((*pEnd != ',') && (*pEnd != 0) && (*pEnd != '\n')) {
+            return -1;
+        }
+    }
+    return (CPU_COUNT(pCpus) > 0) ? 0 : -1;
+}
+
+// Pin a thread to CPUs, given as "role=cpulist"
+int Scheduler_setAffinity(const char* option)
+{
+    enum ThreadRole role;
+    const char* cpuList;
+    if (parseRole(option, &role, &cpuList) != 0) {
+        return -1;
+    }
+    if (parseCpuList(cpuList, &settings[role].cpus) != 0) {
+        return -1;
+    }
+    settings[role].pinned = true;
+    return 0;
+}
+
+// Run a thread under SCHED_FIFO, given as "role=priority"
+int Scheduler_setPriority(const char* option)
+{
+    enum ThreadRole role;
+    const char* value;
+    if (parseRole(option, &role, &value) != 0) {
+        return -1;
+    }
+    char* pEnd;
+    long priority = strtol(value, &pEnd, 10);
+    if ((*pEnd != 0) || (priority < sched_get_priority_min(SCHED_FIFO)) || (priority > sched_get_priority_max(SCHED_FIFO))) {
+        return -1;
+    }
+    settings[role].priority = priority;
+    return 0;
+}
+
+// Pin the thread of role to the CPUs serving the first interrupt listed for interfaceName
+// in /proc/interrupts
+int Scheduler_pinToInterfaceIrq(enum ThreadRole role, const char* interfaceName)
+{
+    FILE* pInterrupts = fopen("/proc/interrupts", "r");
+    if (pInterrupts == NULL) {
+        return -1;
+    }
+    int irq = -1;
+    char line[1024];
+    while ((irq < 0) && (fgets(line, sizeof(line), pInterrupts) != NULL)) {
+        if (strstr(line, interfaceName) != NULL) {
+            sscanf(line, " %d:", &irq);
+        }
+    }
+    fclose(pInterrupts);
+    if (irq < 0) {
+        return -1;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+    FILE* pAffinity = fopen(path, "r");
+    if (pAffinity == NULL) {
+        return -1;
+    }
+    char cpuList[256];
+    int result = -1;
+    if (fgets(cpuList, sizeof(cpuList), pAffinity) != NULL) {
+        result = parseCpuList(cpuList, &settings[role].cpus);
+    }
+    fclose(pAffinity);
+    if (result == 0) {
+        settings[role].pinned = true;
+    }
+    return result;
+}
+
+// Create a thread of role running start, with the CPUs and priority configured for role.
+// Falls back to default scheduling if the process may not use SCHED_FIFO.
+int Scheduler_createThread(pthread_t* pThread, enum ThreadRole role, void* (*start)(void*))
+{
+    ThreadSettings* pSettings = &settings[role];
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    if (pSettings->pinned) {
+        pthread_attr_setaffinity_np(&attributes, sizeof(cpu_set_t), &pSettings->cpus);
+    }
+    if (pSettings->priority > 0) {
+        struct sched_param parameters = {.sched_priority = pSettings->priority};
+        pthread_attr_setinheritsched(&attributes, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attributes, SCHED_FIFO);
+        pthread_attr_setschedparam(&attributes, &parameters);
+    }
+
+    int result = pthread_create(pThread, &attributes, start, NULL);
+    if ((result == EPERM) && (pSettings->priority > 0)) {
+        Log_write(LOG_WARN, "Scheduler Error: Not permitted to use SCHED_FIFO, using default scheduling\n");
+        pthread_attr_setinheritsched(&attributes, PTHREAD_INHERIT_SCHED);
+        result = pthread_create(pThread, &attributes, start, NULL);
+    }
+    pthread_attr_destroy(&attributes);
+    return result;
+}
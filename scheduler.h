@@ -0,0 +1,24 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+#include <pthread.h>
+
+// Threads of the message pipeline, each of which can be given its own CPUs and priority
+enum ThreadRole {THREAD_INPUT, THREAD_SENDER, THREAD_RECEIVER, THREAD_PRINTER, THREAD_NUM_ROLES};
+
+// Pin a thread to CPUs, given as "role=cpulist" (e.g. "receiver=2" or "sender=0,2-3")
+// Returns 0 on success, -1 if the option is malformed
+int Scheduler_setAffinity(const char* option);
+
+// Run a thread under SCHED_FIFO, given as "role=priority" (e.g. "receiver=50")
+// Returns 0 on success, -1 if the option is malformed
+int Scheduler_setPriority(const char* option);
+
+// Pin the thread of role to the CPUs serving the interrupts of network interface interfaceName
+// Returns 0 on success, -1 if no interrupt of the interface is found
+int Scheduler_pinToInterfaceIrq(enum ThreadRole role, const char* interfaceName);
+
+// Create a thread of role running start, with the CPUs and priority configured for role
+// Returns 0 on success, or an error number like pthread_create()
+int Scheduler_createThread(pthread_t* pThread, enum ThreadRole role, void* (*start)(void*));
+
+#endif
@@ -1,71 +1,187 @@
-#include <arpa/inet.h>
 #include <netdb.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+#include "config.h"
 #include "general.h"
 #include "input.h"
+#include "log.h"
+#include "packet.h"
+#include "peer.h"
+#include "resolver.h"
+#include "room.h"
+#include "scheduler.h"
 #include "sender.h"
+#include "shm.h"
+#include "trace.h"
 
 static pthread_t threadPID;
-static struct sockaddr_in sinRemote;
+static char* remoteMachineName;
+static char* remotePort;
 
+// Shared with relayed messages, which go out from the same socket and so must not reuse
+// numbers the receivers' duplicate windows have seen
+static atomic_uint nextSequence = 0;
+
+// Copy the remote machine's address to pRemote, waiting if it has not been resolved yet. Whenever
+// it differs from the address already in pRemote, start keepalives to it and point the
+// shared-memory transport at it.
+// Returns true if pRemote holds its address
+static bool resolveRemote(struct sockaddr_storage* pRemote, socklen_t* pRemoteLength)
+{
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+    if (Resolver_lookup(remoteMachineName, remotePort, &address, &addressLength, true) != 0) {
+        return false;
+    }
+    if ((addressLength != *pRemoteLength) || !Peer_sameAddress((struct sockaddr*)&address, (struct sockaddr*)pRemote)) {
+        memcpy(pRemote, &address, addressLength);
+        *pRemoteLength = addressLength;
+        Peer_register((struct sockaddr*)pRemote, *pRemoteLength, true);
+        Shm_setRemote((struct sockaddr*)pRemote, *pRemoteLength);
+    }
+    return true;
+}
+
+// Wait until the next message may be sent under the configured rate, pNextSend holding when
+// that is; after an idle spell, sending resumes at once rather than in a burst
+static void pace(uint64_t* pNextSend)
+{
+    int rate = Config_settings.sendRate;
+    if (rate <= 0) {
+        return;
+    }
+    uint64_t now = General_monotonicMicros();
+    if (*pNextSend > now) {
+        uint64_t wait = *pNextSend - now;
+        struct timespec delay = {.tv_sec = wait / 1000000, .tv_nsec = (wait % 1000000) * 1000};
+        nanosleep(&delay, NULL);
+    }
+    else {
+        *pNextSend = now;
+    }
+    *pNextSend += 1000000 / rate;
+}
+
+// Sends queued messages until "!" is sent or the send list is closed and empty.
+// Once shutdown has begun, messages left when its deadline passes are dropped.
 void* sendThread()
 {
+    // Start keepalives before the first message
+    struct sockaddr_storage remote;
+    socklen_t remoteLength = 0;
+    memset(&remote, 0, sizeof(remote));
+    resolveRemote(&remote, &remoteLength);
+    uint64_t nextSend = 0;
+
 	while (1) {
-		char* pMessage = Input_getFromSendList();
-		int bytesSent = sendto(socketDescriptor, pMessage, strlen(pMessage), 0, (struct sockaddr *)&sinRemote, sizeof(sinRemote));
-        if (bytesSent < 0) {
-            General_print("Send Thread Error: Failed to send a message\n");
+        char* messages[MSG_BATCH_SIZE];
+        int count = Input_getBatchFromSendList(messages, Config_settings.batchSize);
+        if (count == 0) {
+            return NULL;
+        }
+        for (int i = 0; i < count; i++) {
+            Trace_stamp(messages[i], TRACE_SEND_DEQUEUED);
         }
 
-        if (strcmp(pMessage, "!\n") == 0) {
-            free(pMessage);
-            General_terminate();
-            return NULL;
+        // Waits on DNS only if the lookup at the start failed; otherwise this takes the cached
+        // address, which the resolver refreshes in the background
+        bool resolved = resolveRemote(&remote, &remoteLength);
+        if (!resolved) {
+            Log_write(LOG_ERROR, "Send Thread Error: Failed to resolve the remote machine name\n");
+        }
+
+        for (int i = 0; i < count; i++) {
+            char* pMessage = messages[i];
+            pace(&nextSend);
+            if (General_shutdownDeadlinePassed()) {
+                for (int j = i; j < count; j++) {
+                    Arena_free(messages[j]);
+                }
+                General_stats.sendDropped += count - i;
+                return NULL;
+            }
+            if (resolved && Room_handleCommand(pMessage, (struct sockaddr*)&remote, remoteLength)) {
+                // Room commands apply here, in order with the messages around them
+            }
+            else if (resolved) {
+                PacketHeader header = {.type = PACKET_CHAT, .flags = Room_current(), .sequence = Sender_nextSequence(), .timestamp = General_monotonicMicros()};
+                size_t length = strlen(pMessage);
+                uint64_t sendStart = 0;
+                if (Trace_enabled()) {
+                    // The stamps follow the message's terminating 0
+                    header.flags |= PACKET_FLAG_TRACED;
+                    length += 1 + TRACE_BLOCK_LEN;
+                    sendStart = Trace_now();
+                    Trace_stampAt(pMessage, TRACE_SEND_START, sendStart);
+                }
+                int bytesSent = Shm_send(&header, pMessage, length, (struct sockaddr *)&remote, remoteLength);
+                if (bytesSent < 0) {
+                    bytesSent = Packet_send(&header, pMessage, length, (struct sockaddr *)&remote, remoteLength);
+                }
+                Trace_recordSend(sendStart);
+                if (bytesSent < 0) {
+                    Log_write(LOG_ERROR, "Send Thread Error: Failed to send a message\n");
+                    General_stats.sendFailures++;
+                }
+                else {
+                    General_stats.messagesSent++;
+                }
+            }
+            else {
+                General_stats.sendFailures++;
+            }
+
+            if (strcmp(pMessage, "!\n") == 0) {
+                for (int j = i; j < count; j++) {
+                    Arena_free(messages[j]);
+                }
+                return NULL;
+            }
+            Arena_free(pMessage);
         }
-        free(pMessage);
 	}
 }
 
-// Create a thread that sends message to the remote user
-void Sender_init(char* machineName, char* port)
+// Returns the next sequence number of chat messages sent from this socket
+uint32_t Sender_nextSequence()
 {
-    if (pthread_create(&threadPID, NULL, sendThread, NULL) != 0) {
-        General_print("Send Thread Error: Failed to create the send thread\n");
-        exit(EXIT_FAILURE);
-    }
-
-    memset(&sinRemote, 0, sizeof(sinRemote));
-    sinRemote.sin_family = AF_INET;
-    sinRemote.sin_port = htons(atoi(port));
+    return atomic_fetch_add_explicit(&nextSequence, 1, memory_order_relaxed);
+}
 
-    // IPv4 address
-    struct hostent *host_entry = gethostbyname(machineName);
-    if (host_entry == NULL) {
-        General_print("Send Thread Error: Failed to get host by name\n");
-        exit(EXIT_FAILURE);
-    }
+// Start resolving the remote machine name in the background, and pick the first sequence number
+void Sender_init(char* machineName, char* port)
+{
+    remoteMachineName = machineName;
+    remotePort = port;
 
-    const char* ip = inet_ntoa(*((struct in_addr*) host_entry->h_addr_list[0]));
-    if (ip == NULL) {
-        General_print("Send Thread Error: Failed to convert the host address to a string in the Internet standard dot notation\n");
-        exit(EXIT_FAILURE);
-    }
+    // Start the sequence numbers somewhere new each run, so the receiver's duplicate window
+    // does not mistake a restarted sender's messages for ones it has already seen
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    nextSequence = (uint32_t)(now.tv_nsec ^ (now.tv_sec << 20) ^ ((long)getpid() << 8));
+    Resolver_prefetch(remoteMachineName, remotePort);
+}
 
-    int result = inet_pton(AF_INET, ip, &sinRemote.sin_addr.s_addr);
-    if (result != 1) {
-        General_print("Send Thread Error: Failed to store binary form of host's IPv4 address\n");
+// Create a thread that sends message to the remote user
+void Sender_start()
+{
+    if (Scheduler_createThread(&threadPID, THREAD_SENDER, sendThread) != 0) {
+        Log_write(LOG_ERROR, "Send Thread Error: Failed to create the send thread\n");
         exit(EXIT_FAILURE);
     }
 }
 
-// Cancel and wait for thread to finish
+// Wait for the thread to flush the send list and finish once shutdown has begun
 void Sender_shutdown()
 {    
-    pthread_cancel(threadPID);
     int result = pthread_join(threadPID, NULL);
     if (result != 0) {
-        General_print("Send Thread Error: Failed to cancel and join thread\n");
+        Log_write(LOG_ERROR, "Send Thread Error: Failed to join thread\n");
     }
 }
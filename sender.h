@@ -1,10 +1,18 @@
 #ifndef _SENDER_H_
 #define _SENDER_H_
+#include <stdint.h>
+
+// Start resolving the remote machine name, and pick the first sequence number
+void Sender_init(char* machineName, char* port);
+
+// Returns the next sequence number of chat messages sent from this socket
+// Called from any thread
+uint32_t Sender_nextSequence();
 
 // Start background send thread
-void Sender_init(char* port, char* machineName);
+void Sender_start();
 
-// Stop background send thread
+// Wait for background send thread to flush queued messages once shutdown has begun
 void Sender_shutdown();
 
 #endif
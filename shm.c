@@ -0,0 +1,564 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "general.h"
+#include "impair.h"
+#include "log.h"
+#include "packet.h"
+#include "peer.h"
+#include "relay.h"
+#include "shm.h"
+
+// Identifies an offer of a ring on the link socket
+#define SHM_OFFER_MAGIC 0x5354534d
+
+typedef struct Ring_s Ring;
+struct Ring_s {
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    _Alignas(64) atomic_uint sleeping;
+    _Alignas(64) uint8_t data[SHM_RING_BYTES];
+};
+
+// Sent with the ring's memfd and eventfd when two ends link
+typedef struct Offer_s Offer;
+struct Offer_s {
+    uint32_t magic;
+    uint32_t pid;
+    uint32_t ringBytes;
+    uint32_t port;
+};
+
+static bool disabled = false;
+static bool enabled = false;
+static pthread_t threadPID;
+static bool started = false;
+
+// This end's ring, read by the receive thread only
+static Ring* pInbound = NULL;
+static int inboundMemory = -1;
+static int inboundEvent = -1;
+static uint16_t localPort;
+static int listenDescriptor = -1;
+
+// The remote user and its ring, written under shmMutex
+static pthread_mutex_t shmMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct sockaddr_storage remote;
+static socklen_t remoteLength = 0;
+static bool remoteLocal = false;
+static Ring* pOutbound = NULL;
+static int outboundEvent = -1;
+static pid_t outboundPid = 0;
+
+// Returns the length of a record holding a datagram of length bytes
+static uint32_t recordLength(uint32_t length)
+{
+    return (4 + length + 7) & ~7u;
+}
+
+// Returns the port of pAddress
+static uint16_t portOf(const struct sockaddr* pAddress)
+{
+    if (pAddress->sa_family == AF_INET6) {
+        return ntohs(((const struct sockaddr_in6*)pAddress)->sin6_port);
+    }
+    return ntohs(((const struct sockaddr_in*)pAddress)->sin_port);
+}
+
+// Returns true if pAddress belongs to this host: a socket can be bound to it
+static bool isLocal(const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    int descriptor = socket(pAddress->sa_family, SOCK_DGRAM, 0);
+    if (descriptor == -1) {
+        return false;
+    }
+    int ipv6Only = 0;
+    setsockopt(descriptor, IPPROTO_IPV6, IPV6_V6ONLY, &ipv6Only, sizeof(ipv6Only));
+    struct sockaddr_storage address;
+    memcpy(&address, pAddress, addressLength);
+    if (address.ss_family == AF_INET6) {
+        ((struct sockaddr_in6*)&address)->sin6_port = 0;
+    }
+    else {
+        ((struct sockaddr_in*)&address)->sin_port = 0;
+    }
+    bool local = bind(descriptor, (struct sockaddr*)&address, addressLength) == 0;
+    close(descriptor);
+    return local;
+}
+
+// Fill pAddress with the abstract socket name of the end on port
+// Returns the length of the address
+static socklen_t socketAddress(uint16_t port, struct sockaddr_un* pAddress)
+{
+    memset(pAddress, 0, sizeof(*pAddress));
+    pAddress->sun_family = AF_UNIX;
+    // A leading 0 puts the name in the abstract namespace, which needs no file to clean up
+    int length = snprintf(&pAddress->sun_path[1], sizeof(pAddress->sun_path) - 1, "%s%u", SHM_SOCKET_PREFIX, port);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+}
+
+// Send this end's ring and eventfd over connection
+// Returns 0 on success, -1 on failure
+static int sendOffer(int connection)
+{
+    Offer offer = {.magic = SHM_OFFER_MAGIC, .pid = getpid(), .ringBytes = SHM_RING_BYTES, .port = localPort};
+    struct iovec part = {.iov_base = &offer, .iov_len = sizeof(offer)};
+    union {
+        char buffer[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr* pControl = CMSG_FIRSTHDR(&message);
+    pControl->cmsg_level = SOL_SOCKET;
+    pControl->cmsg_type = SCM_RIGHTS;
+    pControl->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    int descriptors[2] = {inboundMemory, inboundEvent};
+    memcpy(CMSG_DATA(pControl), descriptors, sizeof(descriptors));
+    return (sendmsg(connection, &message, MSG_NOSIGNAL) == sizeof(offer)) ? 0 : -1;
+}
+
+// Stop writing to the remote user's ring
+// Must be called with shmMutex held
+static void unlinkOutbound()
+{
+    if (pOutbound == NULL) {
+        return;
+    }
+    munmap(pOutbound, sizeof(Ring));
+    close(outboundEvent);
+    pOutbound = NULL;
+    outboundEvent = -1;
+    outboundPid = 0;
+}
+
+// Returns the inode of the UDP socket bound to port, or 0 if there is none
+static unsigned long udpSocketInode(uint16_t port)
+{
+    const char* tables[] = {"/proc/net/udp6", "/proc/net/udp"};
+    unsigned long inode = 0;
+    for (int i = 0; (i < 2) && (inode == 0); i++) {
+        FILE* pTable = fopen(tables[i], "r");
+        if (pTable == NULL) {
+            continue;
+        }
+        char line[512];
+        // The first line holds the column names
+        bool header = true;
+        while ((inode == 0) && (fgets(line, sizeof(line), pTable) != NULL)) {
+            unsigned int localPort;
+            unsigned long lineInode;
+            if (!header && (sscanf(line, " %*d: %*[0-9A-Fa-f]:%x %*s %*s %*s %*s %*s %*s %*s %lu", &localPort, &lineInode) == 2)
+                && (localPort == port)) {
+                inode = lineInode;
+            }
+            header = false;
+        }
+        fclose(pTable);
+    }
+    return inode;
+}
+
+// Returns true if process pid has the socket with inode open
+static bool holdsSocket(pid_t pid, unsigned long inode)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    DIR* pDirectory = opendir(path);
+    if (pDirectory == NULL) {
+        return false;
+    }
+    char expected[64];
+    snprintf(expected, sizeof(expected), "socket:[%lu]", inode);
+    bool held = false;
+    struct dirent* pEntry;
+    while (!held && ((pEntry = readdir(pDirectory)) != NULL)) {
+        char link[64];
+        snprintf(path, sizeof(path), "/proc/%d/fd/%.16s", (int)pid, pEntry->d_name);
+        ssize_t length = readlink(path, link, sizeof(link) - 1);
+        if (length > 0) {
+            link[length] = 0;
+            held = strcmp(link, expected) == 0;
+        }
+    }
+    closedir(pDirectory);
+    return held;
+}
+
+// Check with the kernel's credentials of the process on the other side of connection that it
+// runs as this user and owns the UDP socket of the remote user. The abstract socket has no
+// permissions, so any local process can connect to it, and the offer it sends is self-reported.
+// Returns the process's pid, or 0 if it is not the remote user
+static pid_t remoteUserProcess(int connection)
+{
+    struct ucred credentials;
+    socklen_t credentialsLength = sizeof(credentials);
+    if ((getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsLength) != 0)
+        || (credentials.uid != getuid())) {
+        return 0;
+    }
+    uint16_t port = 0;
+    pthread_mutex_lock(&shmMutex);
+    {
+        if (remoteLocal) {
+            port = portOf((struct sockaddr*)&remote);
+        }
+    }
+    pthread_mutex_unlock(&shmMutex);
+    unsigned long inode = (port != 0) ? udpSocketInode(port) : 0;
+    return ((inode != 0) && holdsSocket(credentials.pid, inode)) ? credentials.pid : 0;
+}
+
+// Receive the offer of the remote user's process pid over connection, and write to its ring
+// from now on
+// Returns 0 on success, 1 if it replaced a ring already in use, -1 on failure
+static int receiveOffer(int connection, pid_t pid)
+{
+    Offer offer;
+    struct iovec part = {.iov_base = &offer, .iov_len = sizeof(offer)};
+    union {
+        char buffer[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    if (recvmsg(connection, &message, MSG_CMSG_CLOEXEC) != sizeof(offer)) {
+        return -1;
+    }
+    struct cmsghdr* pControl = CMSG_FIRSTHDR(&message);
+    if ((pControl == NULL) || (pControl->cmsg_type != SCM_RIGHTS) || (pControl->cmsg_len != CMSG_LEN(2 * sizeof(int)))) {
+        return -1;
+    }
+    int descriptors[2];
+    memcpy(descriptors, CMSG_DATA(pControl), sizeof(descriptors));
+
+    int result = -1;
+    pthread_mutex_lock(&shmMutex);
+    {
+        // Only the remote user may link, with a ring of the same layout
+        if ((offer.magic == SHM_OFFER_MAGIC) && (offer.ringBytes == SHM_RING_BYTES) && remoteLocal
+            && (offer.port == portOf((struct sockaddr*)&remote)) && (offer.pid == (uint32_t)pid)) {
+            Ring* pRing = mmap(NULL, sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED, descriptors[0], 0);
+            if (pRing != MAP_FAILED) {
+                result = (pOutbound != NULL) ? 1 : 0;
+                unlinkOutbound();
+                pOutbound = pRing;
+                outboundEvent = descriptors[1];
+                outboundPid = offer.pid;
+            }
+        }
+    }
+    pthread_mutex_unlock(&shmMutex);
+    close(descriptors[0]);
+    if (result < 0) {
+        close(descriptors[1]);
+    }
+    return result;
+}
+
+// Trade rings with the end on the other side of connection, once it is known to be the
+// remote user; nothing is sent to any other process
+static void linkWith(int connection)
+{
+    pid_t pid = remoteUserProcess(connection);
+    if (pid == 0) {
+        Log_write(LOG_WARN, "Shm Thread Error: Refused to link with a process that is not the remote user\n");
+        return;
+    }
+    struct timeval timeout = {.tv_sec = SHM_RETRY_MS / 1000, .tv_usec = (SHM_RETRY_MS % 1000) * 1000};
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if ((sendOffer(connection) == 0) && (receiveOffer(connection, pid) == 0)) {
+        General_print("[Using shared memory with the remote user]\n");
+    }
+}
+
+// Connect to the remote user's socket, if it is on this host, and link with it
+static void connectToRemote()
+{
+    uint16_t port = 0;
+    pthread_mutex_lock(&shmMutex);
+    {
+        if (remoteLocal && (pOutbound == NULL)) {
+            port = portOf((struct sockaddr*)&remote);
+        }
+    }
+    pthread_mutex_unlock(&shmMutex);
+    if (port == 0) {
+        return;
+    }
+    struct sockaddr_un address;
+    socklen_t addressLength = socketAddress(port, &address);
+    int connection = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if ((connection != -1) && (connect(connection, (struct sockaddr*)&address, addressLength) == 0)) {
+        linkWith(connection);
+    }
+    if (connection != -1) {
+        close(connection);
+    }
+}
+
+// Go back to UDP if the remote process has exited
+static void checkRemote()
+{
+    pthread_mutex_lock(&shmMutex);
+    {
+        if ((pOutbound != NULL) && (kill(outboundPid, 0) == -1) && (errno == ESRCH)) {
+            unlinkOutbound();
+            General_print("[Stopped using shared memory with the remote user]\n");
+        }
+    }
+    pthread_mutex_unlock(&shmMutex);
+}
+
+// Answers link requests, and tries to link with the remote user, until shutdown begins
+void* shmThread()
+{
+    int ready;
+    while ((ready = General_waitForInputs(&listenDescriptor, 1, SHM_RETRY_MS)) >= 0) {
+        if (ready == 0) {
+            int connection = accept4(listenDescriptor, NULL, NULL, SOCK_CLOEXEC);
+            if (connection != -1) {
+                linkWith(connection);
+                close(connection);
+            }
+        }
+        checkRemote();
+        connectToRemote();
+    }
+    return NULL;
+}
+
+// Always use UDP
+void Shm_disable()
+{
+    disabled = true;
+}
+
+// Create the receive ring, its eventfd and the socket listening on port's name
+void Shm_init(const char* port)
+{
+    if (disabled || Relay_enabled() || Impair_enabled()) {
+        return;
+    }
+    localPort = atoi(port);
+    inboundMemory = memfd_create("s-talk-ring", MFD_CLOEXEC);
+    if ((inboundMemory == -1) || (ftruncate(inboundMemory, sizeof(Ring)) != 0)) {
+        Log_write(LOG_WARN, "Shm Thread Error: Failed to create the ring, using UDP only\n");
+        return;
+    }
+    pInbound = mmap(NULL, sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED, inboundMemory, 0);
+    inboundEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct sockaddr_un address;
+    socklen_t addressLength = socketAddress(localPort, &address);
+    listenDescriptor = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if ((pInbound == MAP_FAILED) || (inboundEvent == -1) || (listenDescriptor == -1)
+        || (bind(listenDescriptor, (struct sockaddr*)&address, addressLength) != 0) || (listen(listenDescriptor, 4) != 0)) {
+        Log_write(LOG_WARN, "Shm Thread Error: Failed to set up shared memory, using UDP only\n");
+        if (pInbound != MAP_FAILED) {
+            munmap(pInbound, sizeof(Ring));
+        }
+        pInbound = NULL;
+        close(inboundMemory);
+        close(inboundEvent);
+        close(listenDescriptor);
+        return;
+    }
+    enabled = true;
+}
+
+// Start background thread that links with the remote user once it is known to be local
+void Shm_start()
+{
+    if (!enabled) {
+        return;
+    }
+    if (pthread_create(&threadPID, NULL, shmThread, NULL) != 0) {
+        Log_write(LOG_ERROR, "Shm Thread Error: Failed to create the shared memory thread\n");
+        exit(EXIT_FAILURE);
+    }
+    started = true;
+}
+
+// Set the remote user's address; the transport is only used if it is on this host
+void Shm_setRemote(const struct sockaddr* pRemote, socklen_t addressLength)
+{
+    if (!enabled) {
+        return;
+    }
+    pthread_mutex_lock(&shmMutex);
+    {
+        if ((remoteLength == 0) || !Peer_sameAddress((struct sockaddr*)&remote, pRemote)) {
+            unlinkOutbound();
+            memcpy(&remote, pRemote, addressLength);
+            remoteLength = addressLength;
+            remoteLocal = isLocal(pRemote, addressLength);
+        }
+    }
+    pthread_mutex_unlock(&shmMutex);
+}
+
+// Write the datagram to the remote user's ring, if pAddress is the remote user and linked
+int Shm_send(const PacketHeader* pHeader, const void* pPayload, size_t payloadLength, const struct sockaddr* pAddress, socklen_t addressLength)
+{
+    if (!enabled || (payloadLength > PACKET_MAX_PAYLOAD_LEN)) {
+        return -1;
+    }
+    int result = -1;
+    pthread_mutex_lock(&shmMutex);
+    {
+        Ring* pRing = pOutbound;
+        if ((pRing != NULL) && Peer_sameAddress(pAddress, (struct sockaddr*)&remote)) {
+            uint32_t length = PACKET_HEADER_LEN + payloadLength;
+            uint32_t needed = recordLength(length);
+            uint32_t head = atomic_load_explicit(&pRing->head, memory_order_relaxed);
+            uint32_t tail = atomic_load_explicit(&pRing->tail, memory_order_acquire);
+            uint32_t position = head % SHM_RING_BYTES;
+            uint32_t skip = (SHM_RING_BYTES - position < needed) ? (SHM_RING_BYTES - position) : 0;
+            if (head - tail + skip + needed <= SHM_RING_BYTES) {
+                if (skip > 0) {
+                    uint32_t wrap = SHM_WRAP;
+                    memcpy(&pRing->data[position], &wrap, 4);
+                    head += skip;
+                    position = 0;
+                }
+                memcpy(&pRing->data[position], &length, 4);
+                Packet_encodeHeader(pHeader, &pRing->data[position + 4]);
+                memcpy(&pRing->data[position + 4 + PACKET_HEADER_LEN], pPayload, payloadLength);
+                atomic_store_explicit(&pRing->head, head + needed, memory_order_release);
+                // Pairs with the fence in Shm_prepareToWait(): either the receiver sees the new
+                // head, or this sees it sleeping
+                atomic_thread_fence(memory_order_seq_cst);
+                if (atomic_load_explicit(&pRing->sleeping, memory_order_relaxed)) {
+                    uint64_t one = 1;
+                    if (write(outboundEvent, &one, sizeof(one)) < 0) {
+                        // The counter is already set
+                    }
+                }
+                result = length;
+            }
+        }
+    }
+    pthread_mutex_unlock(&shmMutex);
+    return result;
+}
+
+// Take the next datagram off this end's ring. The remote process is not trusted: a record
+// that does not fit where it claims to be drops everything written so far.
+int Shm_receive(uint8_t* buffer, int maxLength, struct sockaddr_storage* pSource, socklen_t* pSourceLength)
+{
+    if (pInbound == NULL) {
+        return 0;
+    }
+    uint32_t tail = atomic_load_explicit(&pInbound->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&pInbound->head, memory_order_acquire);
+    int result = 0;
+    while ((tail != head) && (result == 0)) {
+        uint32_t position = tail % SHM_RING_BYTES;
+        uint32_t length;
+        memcpy(&length, &pInbound->data[position], 4);
+        if ((length == SHM_WRAP) && (head - tail <= SHM_RING_BYTES)) {
+            tail += SHM_RING_BYTES - position;
+            continue;
+        }
+        uint32_t needed = recordLength(length);
+        if ((head - tail > SHM_RING_BYTES) || (length < PACKET_HEADER_LEN) || (length > (uint32_t)maxLength)
+            || (needed > SHM_RING_BYTES - position) || (needed > head - tail)) {
+            General_stats.receiveDropped++;
+            tail = head;
+            break;
+        }
+        memcpy(buffer, &pInbound->data[position + 4], length);
+        tail += needed;
+        result = length;
+    }
+    atomic_store_explicit(&pInbound->tail, tail, memory_order_release);
+    if (result > 0) {
+        pthread_mutex_lock(&shmMutex);
+        {
+            memcpy(pSource, &remote, remoteLength);
+            *pSourceLength = remoteLength;
+        }
+        pthread_mutex_unlock(&shmMutex);
+    }
+    return result;
+}
+
+// Returns the eventfd that wakes a sleeping receiver
+int Shm_eventDescriptor()
+{
+    return enabled ? inboundEvent : -1;
+}
+
+// Tell the remote user to wake this end on its next write
+bool Shm_prepareToWait()
+{
+    if (pInbound == NULL) {
+        return true;
+    }
+    atomic_store_explicit(&pInbound->sleeping, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pInbound->head, memory_order_relaxed) != atomic_load_explicit(&pInbound->tail, memory_order_relaxed)) {
+        atomic_store_explicit(&pInbound->sleeping, 0, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+// Stop asking to be woken and clear the eventfd
+void Shm_finishWait()
+{
+    if (pInbound == NULL) {
+        return;
+    }
+    atomic_store_explicit(&pInbound->sleeping, 0, memory_order_relaxed);
+    uint64_t count;
+    if (read(inboundEvent, &count, sizeof(count)) < 0) {
+        // Nothing was written
+    }
+}
+
+// Stop background thread and release the rings
+void Shm_shutdown()
+{
+    if (!enabled) {
+        return;
+    }
+    if (started) {
+        pthread_join(threadPID, NULL);
+    }
+    pthread_mutex_lock(&shmMutex);
+    {
+        unlinkOutbound();
+    }
+    pthread_mutex_unlock(&shmMutex);
+    munmap(pInbound, sizeof(Ring));
+    pInbound = NULL;
+    close(inboundMemory);
+    close(inboundEvent);
+    close(listenDescriptor);
+    enabled = false;
+}
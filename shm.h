@@ -0,0 +1,71 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "packet.h"
+
+// Shared-memory transport for a remote user on the same host. Each end receives on a ring in
+// a memfd that it creates, with an eventfd to wake it, and listens on the abstract Unix socket
+// SHM_SOCKET_PREFIX followed by its port number. When the remote machine name resolves to an
+// address of this host, the ends connect and, once SO_PEERCRED shows the other side runs as
+// the same user and holds the UDP socket bound to the remote port, pass each other their ring
+// and eventfd with SCM_RIGHTS. From then on every chat message to the remote user is written
+// to its ring instead of sent with sendto(), and read back by its receive thread in place of
+// recvfrom(). The receiver sets a flag in its ring before sleeping, so the sender only writes
+// the eventfd when needed.
+//
+// Messages go back to UDP when the ring is full, and for good once the remote process exits.
+// Keepalives and file transfers stay on UDP. Relay mode, impairment and --no-shm turn the
+// transport off.
+//
+// Ring: the head (advanced by the sender), the tail (advanced by the receiver) and the
+// sleeping flag, each on its own cache line, then SHM_RING_BYTES of records: a 4-byte length
+// and the datagram, padded to 8 bytes. A record that would cross the end starts at 0 instead,
+// after a SHM_WRAP length.
+
+#define SHM_SOCKET_PREFIX "s-talk-shm-"
+#define SHM_RING_BYTES (256 * 1024)
+#define SHM_WRAP 0xFFFFFFFFu
+
+// Milliseconds between attempts to connect to the remote user, and checks that it is running
+#define SHM_RETRY_MS 1000
+
+// Always use UDP; call before Shm_init()
+void Shm_disable();
+
+// Create the receive ring, its eventfd and the socket listening on port's name
+void Shm_init(const char* port);
+
+// Start background thread that links with the remote user once it is known to be local
+void Shm_start();
+
+// Set the remote user's address; the transport is only used if it is on this host
+void Shm_setRemote(const struct sockaddr* pRemote, socklen_t remoteLength);
+
+// Write the datagram pHeader and payloadLength bytes of pPayload to the ring of the remote user,
+// if pAddress is the remote user and linked
+// Returns the number of bytes written, or -1 if it must be sent with UDP
+int Shm_send(const PacketHeader* pHeader, const void* pPayload, size_t payloadLength, const struct sockaddr* pAddress, socklen_t addressLength);
+
+// Take the next datagram off this end's ring into buffer, and the remote user's address into pSource
+// Called from the receive thread
+// Returns its length, or 0 if the ring is empty
+int Shm_receive(uint8_t* buffer, int maxLength, struct sockaddr_storage* pSource, socklen_t* pSourceLength);
+
+// Returns the eventfd that becomes readable when the ring is written to a sleeping receiver,
+// or -1 without the transport
+int Shm_eventDescriptor();
+
+// Tell the remote user to wake this end on its next write
+// Returns true if the ring is still empty, so the receive thread may sleep
+bool Shm_prepareToWait();
+
+// Stop asking to be woken and clear the eventfd
+void Shm_finishWait();
+
+// Stop background thread and release the rings, once every other thread has finished
+void Shm_shutdown();
+
+#endif
@@ -0,0 +1,190 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "general.h"
+#include "log.h"
+#include "timer.h"
+
+// Level n holds the timers due between TIMER_WHEEL_SLOTS^n and TIMER_WHEEL_SLOTS^(n+1) ticks
+// after currentTick, in the slot given by bits n * TIMER_WHEEL_BITS and up of their expiry.
+// Whenever the level below wraps around, the next slot of a level is cascaded: its timers are
+// stored again, each closer to level 0. Each slot holds a doubly linked list.
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_MAX_TICKS ((1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+static Timer* wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static uint64_t currentTick = 0;
+static pthread_t threadPID;
+static bool stopping = false;
+static pthread_mutex_t wheelMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stopCondVar;
+
+// Takes pTimer out of its slot
+// Must be called with wheelMutex held
+static void unlinkTimer(Timer* pTimer)
+{
+    if (pTimer->previous == NULL) {
+        *pTimer->pSlot = pTimer->next;
+    }
+    else {
+        pTimer->previous->next = pTimer->next;
+    }
+    if (pTimer->next != NULL) {
+        pTimer->next->previous = pTimer->previous;
+    }
+    pTimer->previous = NULL;
+    pTimer->next = NULL;
+    pTimer->pSlot = NULL;
+    pTimer->scheduled = false;
+}
+
+// Puts pTimer in the slot of the lowest level whose range covers its expiry
+// Must be called with wheelMutex held
+static void linkTimer(Timer* pTimer)
+{
+    uint64_t delta = pTimer->expiry - currentTick;
+    int level = 0;
+    while ((level < TIMER_WHEEL_LEVELS - 1) && (delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1))))) {
+        level++;
+    }
+    Timer** pSlot = &wheel[level][(pTimer->expiry >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK];
+    pTimer->pSlot = pSlot;
+    pTimer->scheduled = true;
+    pTimer->previous = NULL;
+    pTimer->next = *pSlot;
+    if (*pSlot != NULL) {
+        (*pSlot)->previous = pTimer;
+    }
+    *pSlot = pTimer;
+}
+
+// Moves the timers of the current slot of level one level closer to level 0
+// Returns true if that slot was at index 0, so the level above must cascade too
+// Must be called with wheelMutex held
+static bool cascade(int level)
+{
+    int index = (currentTick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    Timer* pTimer = wheel[level][index];
+    wheel[level][index] = NULL;
+    while (pTimer != NULL) {
+        Timer* pNext = pTimer->next;
+        linkTimer(pTimer);
+        pTimer = pNext;
+    }
+    return index == 0;
+}
+
+// Fires the timers due at currentTick, then advances it
+static void tick()
+{
+    Timer* pDue = NULL;
+    pthread_mutex_lock(&wheelMutex);
+    {
+        int index = currentTick & TIMER_WHEEL_MASK;
+        if (index == 0) {
+            for (int level = 1; (level < TIMER_WHEEL_LEVELS) && cascade(level); level++) {
+            }
+        }
+        while (wheel[0][index] != NULL) {
+            Timer* pTimer = wheel[0][index];
+            unlinkTimer(pTimer);
+            pTimer->nextDue = pDue;
+            pDue = pTimer;
+        }
+        currentTick++;
+    }
+    pthread_mutex_unlock(&wheelMutex);
+
+    while (pDue != NULL) {
+        Timer* pTimer = pDue;
+        pDue = pTimer->nextDue;
+        (*pTimer->callback)(pTimer, pTimer->pArg);
+    }
+}
+
+// Advances the wheel every TIMER_TICK_MS until shutdown, catching up on ticks it fell behind on
+void* timerThread()
+{
+    struct timespec nextTick;
+    clock_gettime(CLOCK_MONOTONIC, &nextTick);
+    pthread_mutex_lock(&wheelMutex);
+    while (!stopping) {
+        nextTick.tv_nsec += TIMER_TICK_MS * 1000000L;
+        if (nextTick.tv_nsec >= 1000000000L) {
+            nextTick.tv_sec++;
+            nextTick.tv_nsec -= 1000000000L;
+        }
+        while (!stopping && (pthread_cond_timedwait(&stopCondVar, &wheelMutex, &nextTick) == 0)) {
+        }
+        if (stopping) {
+            break;
+        }
+        pthread_mutex_unlock(&wheelMutex);
+        tick();
+        pthread_mutex_lock(&wheelMutex);
+    }
+    pthread_mutex_unlock(&wheelMutex);
+    return NULL;
+}
+
+// Create the tick thread, whose waits are measured on the monotonic clock
+void Timer_start()
+{
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&stopCondVar, &attributes);
+    pthread_condattr_destroy(&attributes);
+
+    if (pthread_create(&threadPID, NULL, timerThread, NULL) != 0) {
+        Log_write(LOG_ERROR, "Timer Thread Error: Failed to create the timer thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Run callback(pTimer, pArg) on the tick thread after delayMs milliseconds
+void Timer_schedule(Timer* pTimer, uint32_t delayMs, TIMER_FN callback, void* pArg)
+{
+    uint64_t ticks = (delayMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    if (ticks > TIMER_MAX_TICKS) {
+        ticks = TIMER_MAX_TICKS;
+    }
+    pthread_mutex_lock(&wheelMutex);
+    {
+        if (pTimer->scheduled) {
+            unlinkTimer(pTimer);
+        }
+        pTimer->expiry = currentTick + ticks - 1;
+        pTimer->callback = callback;
+        pTimer->pArg = pArg;
+        linkTimer(pTimer);
+    }
+    pthread_mutex_unlock(&wheelMutex);
+}
+
+// Stop pTimer from firing
+void Timer_cancel(Timer* pTimer)
+{
+    pthread_mutex_lock(&wheelMutex);
+    {
+        if (pTimer->scheduled) {
+            unlinkTimer(pTimer);
+        }
+    }
+    pthread_mutex_unlock(&wheelMutex);
+}
+
+// Stop background tick thread
+void Timer_shutdown()
+{
+    pthread_mutex_lock(&wheelMutex);
+    {
+        stopping = true;
+        pthread_cond_signal(&stopCondVar);
+    }
+    pthread_mutex_unlock(&wheelMutex);
+    pthread_join(threadPID, NULL);
+    pthread_cond_destroy(&stopCondVar);
+}
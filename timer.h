@@ -0,0 +1,48 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hierarchical timer wheel driven by a tick thread. Scheduling and cancelling are O(1), and a
+// tick only visits the timers due on it, plus one cascading slot every TIMER_WHEEL_SLOTS ticks.
+// Callbacks run on the tick thread, without the wheel lock held, so they may schedule timers
+// again.
+
+// Milliseconds per tick. Each level has TIMER_WHEEL_SLOTS slots and spans TIMER_WHEEL_SLOTS
+// times the range of the level below it; delays beyond the top level are clamped to it.
+#define TIMER_TICK_MS 10
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+typedef struct Timer_s Timer;
+typedef void (*TIMER_FN)(Timer* pTimer, void* pArg);
+
+// Fields are private to timer.c; a Timer must stay allocated while it is scheduled
+struct Timer_s {
+    uint64_t expiry;
+    Timer** pSlot;
+    TIMER_FN callback;
+    void* pArg;
+    bool scheduled;
+    Timer* previous;
+    Timer* next;
+    Timer* nextDue;
+};
+
+// Start background tick thread
+void Timer_start();
+
+// Run callback(pTimer, pArg) on the tick thread after delayMs milliseconds, replacing any
+// earlier schedule of pTimer
+void Timer_schedule(Timer* pTimer, uint32_t delayMs, TIMER_FN callback, void* pArg);
+
+// Stop pTimer from firing. This races with a tick that has already taken pTimer as due: its
+// callback may still run, once, after Timer_cancel() returns, and is not waited for. A caller
+// that frees pTimer or its argument afterwards must have the callback check for that itself.
+void Timer_cancel(Timer* pTimer);
+
+// Stop background tick thread; scheduled timers no longer fire
+void Timer_shutdown();
+
+#endif
@@ -0,0 +1,246 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "general.h"
+#include "log.h"
+#include "packet.h"
+#include "trace.h"
+
+// Histogram buckets: bucket b counts spans of 2^b to 2^(b+1) - 1 nanoseconds
+#define TRACE_BUCKETS 48
+
+// The spans between consecutive stages, then sendto() timed on its own
+#define TRACE_SPAN_SENDTO (TRACE_STAGE_COUNT - 1)
+#define TRACE_SPAN_COUNT TRACE_STAGE_COUNT
+
+typedef struct Histogram_s Histogram;
+struct Histogram_s {
+    uint64_t counts[TRACE_BUCKETS];
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+};
+
+static const char* spanNames[TRACE_SPAN_COUNT] = {
+    "stdin read", "send queue", "send wait", "wire", "receive", "receive queue", "stdout write", "sendto"
+};
+
+static bool enabled = false;
+static char* tracePath = NULL;
+
+// Each histogram is only added to by one thread: sendto by the send thread, the rest by the
+// print thread
+static Histogram histograms[TRACE_SPAN_COUNT];
+
+// Stamps of the first TRACE_MAX_RECORDS traced messages printed, TRACE_STAGE_COUNT each
+static uint64_t* records = NULL;
+static int recordCount = 0;
+
+// Returns the stamp block of pMessage
+static uint8_t* blockOf(const char* pMessage)
+{
+    return (uint8_t*)&pMessage[strlen(pMessage) + 1];
+}
+
+// Add a span of nanos nanoseconds to pHistogram
+static void addSpan(Histogram* pHistogram, uint64_t nanos)
+{
+    int bucket = 0;
+    while ((bucket < TRACE_BUCKETS - 1) && (nanos >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+    pHistogram->counts[bucket]++;
+    pHistogram->count++;
+    pHistogram->total += nanos;
+    if (nanos > pHistogram->max) {
+        pHistogram->max = nanos;
+    }
+}
+
+// Returns the upper bound, in nanoseconds, of the bucket holding the given fraction of spans
+static uint64_t percentile(const Histogram* pHistogram, double fraction)
+{
+    uint64_t wanted = (uint64_t)(pHistogram->count * fraction);
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < TRACE_BUCKETS; bucket++) {
+        seen += pHistogram->counts[bucket];
+        if (seen > wanted) {
+            uint64_t bound = ((uint64_t)2 << bucket) - 1;
+            return (bound < pHistogram->max) ? bound : pHistogram->max;
+        }
+    }
+    return pHistogram->max;
+}
+
+// Print a line per span with its count, mean, p50, p99 and max, and its non-empty buckets
+static void printHistograms()
+{
+    char line[256];
+    General_print("Trace spans (microseconds; p50 and p99 are bucket bounds):\n");
+    snprintf(line, sizeof(line), "  %-14s %8s %10s %10s %10s %10s\n", "span", "count", "mean", "p50", "p99", "max");
+    General_print(line);
+    for (int span = 0; span < TRACE_SPAN_COUNT; span++) {
+        const Histogram* pHistogram = &histograms[span];
+        if (pHistogram->count == 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "  %-14s %8llu %10.1f %10.1f %10.1f %10.1f\n", spanNames[span],
+            (unsigned long long)pHistogram->count, pHistogram->total / 1000.0 / pHistogram->count,
+            percentile(pHistogram, 0.5) / 1000.0, percentile(pHistogram, 0.99) / 1000.0, pHistogram->max / 1000.0);
+        General_print(line);
+        for (int bucket = 0; bucket < TRACE_BUCKETS; bucket++) {
+            if (pHistogram->counts[bucket] > 0) {
+                snprintf(line, sizeof(line), "    < %12.1f %8llu\n", ((uint64_t)2 << bucket) / 1000.0,
+                    (unsigned long long)pHistogram->counts[bucket]);
+                General_print(line);
+            }
+        }
+    }
+}
+
+// Write the kept stamps to the trace file as one complete event per span, each span on its
+// own track
+static void writeTraceFile()
+{
+    FILE* pFile = fopen(tracePath, "w");
+    if (pFile == NULL) {
+        Log_write(LOG_ERROR, "Trace Error: Failed to open the trace file\n");
+        return;
+    }
+    fprintf(pFile, "{\"traceEvents\":[\n");
+    for (int span = 0; span < TRACE_STAGE_COUNT - 1; span++) {
+        fprintf(pFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+            span + 1, spanNames[span]);
+    }
+    for (int i = 0; i < recordCount; i++) {
+        const uint64_t* stamps = &records[i * TRACE_STAGE_COUNT];
+        for (int span = 0; span < TRACE_STAGE_COUNT - 1; span++) {
+            if ((stamps[span] == 0) || (stamps[span + 1] < stamps[span])) {
+                continue;
+            }
+            fprintf(pFile, "{\"name\":\"%s\",\"cat\":\"message\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"message\":%d}},\n",
+                spanNames[span], stamps[span] / 1000.0, (stamps[span + 1] - stamps[span]) / 1000.0, span + 1, i);
+        }
+    }
+    // JSON allows no comma after the last event
+    fprintf(pFile, "{\"name\":\"end\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":1,\"tid\":1}\n]}\n", Trace_now() / 1000.0);
+    if (fclose(pFile) != 0) {
+        Log_write(LOG_ERROR, "Trace Error: Failed to write the trace file\n");
+    }
+}
+
+// Trace messages, writing the trace file to path at shutdown
+void Trace_enable(const char* path)
+{
+    free(tracePath);
+    tracePath = strdup(path);
+    if (records == NULL) {
+        records = malloc(sizeof(uint64_t) * TRACE_STAGE_COUNT * TRACE_MAX_RECORDS);
+        if (records == NULL) {
+            Log_write(LOG_ERROR, "Trace Error: Failed to allocate the trace records\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    enabled = true;
+}
+
+// Returns true if messages are traced
+bool Trace_enabled()
+{
+    return enabled;
+}
+
+// Returns the CLOCK_MONOTONIC time in nanoseconds
+uint64_t Trace_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Returns the bytes to allocate after a message's terminating 0 for its stamps
+int Trace_blockLength()
+{
+    return enabled ? TRACE_BLOCK_LEN : 0;
+}
+
+// Returns the length of the text of a chat payload, without the stamps of a traced one
+int Trace_textLength(const uint8_t* pPayload, int length, bool traced)
+{
+    if (!traced) {
+        return length;
+    }
+    if ((length < TRACE_BLOCK_LEN + 1) || (pPayload[length - TRACE_BLOCK_LEN - 1] != 0)) {
+        return -1;
+    }
+    return length - TRACE_BLOCK_LEN - 1;
+}
+
+// Record time as stage of pMessage, which has room for its stamps
+void Trace_stampAt(char* pMessage, enum TraceStage stage, uint64_t time)
+{
+    if (enabled) {
+        Packet_writeBigEndian(&blockOf(pMessage)[stage * 8], time, 8);
+    }
+}
+
+// Record the current time as stage of pMessage, which has room for its stamps
+void Trace_stamp(char* pMessage, enum TraceStage stage)
+{
+    if (enabled) {
+        Trace_stampAt(pMessage, stage, Trace_now());
+    }
+}
+
+// Time one sendto(), which began at start
+void Trace_recordSend(uint64_t start)
+{
+    if (enabled) {
+        addSpan(&histograms[TRACE_SPAN_SENDTO], Trace_now() - start);
+    }
+}
+
+// Add the spans of a printed message to the histograms and keep its stamps
+void Trace_record(const char* pMessage)
+{
+    if (!enabled) {
+        return;
+    }
+    uint64_t stamps[TRACE_STAGE_COUNT];
+    const uint8_t* block = blockOf(pMessage);
+    for (int stage = 0; stage < TRACE_STAGE_COUNT; stage++) {
+        stamps[stage] = Packet_readBigEndian(&block[stage * 8], 8);
+    }
+    if (stamps[TRACE_READ_START] == 0) {
+        // The remote user does not trace
+        return;
+    }
+    for (int span = 0; span < TRACE_STAGE_COUNT - 1; span++) {
+        // Clocks of different hosts can put a later stage first
+        if (stamps[span + 1] >= stamps[span]) {
+            addSpan(&histograms[span], stamps[span + 1] - stamps[span]);
+        }
+    }
+    if (recordCount < TRACE_MAX_RECORDS) {
+        memcpy(&records[recordCount * TRACE_STAGE_COUNT], stamps, sizeof(stamps));
+        recordCount++;
+    }
+}
+
+// Print the histograms and write the trace file, once every thread has finished
+void Trace_shutdown()
+{
+    if (!enabled) {
+        return;
+    }
+    printHistograms();
+    writeTraceFile();
+    free(records);
+    free(tracePath);
+    records = NULL;
+    tracePath = NULL;
+    enabled = false;
+}
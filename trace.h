@@ -0,0 +1,69 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+// Per-message latency tracing, turned on with --trace. Each typed message carries a block of
+// CLOCK_MONOTONIC nanosecond stamps, one per stage of its trip through inputThread, sendThread,
+// receiveThread and printThread. In memory the block follows the message's terminating 0; on
+// the wire the sender sends the message, its 0 and the block, and sets PACKET_FLAG_TRACED.
+// Stamps are big-endian in both places, so the block goes out without copying. The receiver
+// adds its own stamps and, once the message is printed, adds the time between each stage to
+// a histogram of that span and keeps the stamps for the trace file.
+//
+// The wire span compares the two ends' clocks, so it is only meaningful when both run on the
+// same host; the sender also times sendto() alone with its own clock.
+//
+// At shutdown the histograms are printed, and the kept stamps are written to the trace file
+// in Chrome's trace event format, for chrome://tracing or ui.perfetto.dev.
+
+enum TraceStage {
+    TRACE_READ_START,        // First byte of the line read from stdin
+    TRACE_READ_DONE,         // Whole line read
+    TRACE_SEND_DEQUEUED,     // Taken off the send list
+    TRACE_SEND_START,        // Handed to sendto()
+    TRACE_RECEIVED,          // Returned by recvfrom()
+    TRACE_RECEIVE_QUEUED,    // Added to the receive list
+    TRACE_RECEIVE_DEQUEUED,  // Taken off the receive list
+    TRACE_PRINTED,           // Written to stdout
+    TRACE_STAGE_COUNT
+};
+
+#define TRACE_BLOCK_LEN (TRACE_STAGE_COUNT * 8)
+
+// Most traced messages kept for the trace file; later ones still count in the histograms
+#define TRACE_MAX_RECORDS 65536
+
+// Trace messages, writing the trace file to path at shutdown
+void Trace_enable(const char* path);
+
+// Returns true if messages are traced
+bool Trace_enabled();
+
+// Returns the CLOCK_MONOTONIC time in nanoseconds
+uint64_t Trace_now();
+
+// Returns the bytes to allocate after a message's terminating 0 for its stamps
+int Trace_blockLength();
+
+// Returns the length of the text of a chat payload of length bytes, without the 0 and stamps
+// that follow it if traced, or -1 if a traced payload does not end with them
+int Trace_textLength(const uint8_t* pPayload, int length, bool traced);
+
+// Record time as stage of pMessage, which has room for its stamps
+void Trace_stampAt(char* pMessage, enum TraceStage stage, uint64_t time);
+
+// Record the current time as stage of pMessage, which has room for its stamps
+void Trace_stamp(char* pMessage, enum TraceStage stage);
+
+// Time one sendto(), which began at start
+void Trace_recordSend(uint64_t start);
+
+// Add the spans of a printed message to the histograms and keep its stamps
+// Called from the print thread
+void Trace_record(const char* pMessage);
+
+// Print the histograms and write the trace file, once every thread has finished
+void Trace_shutdown();
+
+#endif
@@ -0,0 +1,756 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "general.h"
+#include "log.h"
+#include "packet.h"
+#include "peer.h"
+#include "resolver.h"
+#include "transfer.h"
+
+// Attempts at starting a transfer, one second apart, before giving up
+#define TRANSFER_START_ATTEMPTS 5
+
+// Bounds of the wait for an ack before lost chunks are sent again, in microseconds, and the
+// wait used before there is a round-trip time sample
+#define TRANSFER_MIN_TIMEOUT 10000
+#define TRANSFER_MAX_TIMEOUT 1000000
+#define TRANSFER_DEFAULT_TIMEOUT 200000
+
+// Milliseconds without progress before a transfer is abandoned
+#define TRANSFER_STALL_MS 10000
+
+// Milliseconds between progress reports
+#define TRANSFER_REPORT_MS 1000
+
+// The receiver acks after this many bytes in order, and at once for anything else
+#define TRANSFER_ACK_EVERY_BYTES (256 * 1024)
+
+// Shortest chunk accepted, which bounds the received-chunk bitmap to a 2048th of the file
+#define TRANSFER_MIN_CHUNK_LEN 256
+
+// Numbered names tried when received_<name> already exists, before the file is refused
+#define TRANSFER_MAX_NAME_TRIES 100
+
+static char* remoteMachineName;
+static char* remotePort;
+
+// Outgoing transfer. Acks are recorded by the receive thread under transferMutex.
+// Field acked is the number of chunks received in order, and bit i of sacked is set when
+// chunk acked + 1 + i was received.
+static pthread_t threadPID;
+static bool threadCreated = false;
+static bool sending = false;
+static char* sendPath;
+static uint16_t sendId;
+static uint32_t acked;
+static uint8_t sacked[TRANSFER_ACK_BITS / 8];
+static uint64_t ackCount;
+static pthread_mutex_t transferMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ackCondVar;
+
+// Incoming transfer, only touched by the receive thread until it has finished
+static bool receiving = false;
+static uint16_t receiveId;
+static bool completedValid = false;
+static uint16_t completedId;
+static uint32_t completedChunks;
+static struct sockaddr_storage receiveSource;
+static socklen_t receiveSourceLength;
+static int receiveFd = -1;
+static char receiveName[256];
+static char receivePath[sizeof(TRANSFER_FILE_PREFIX) + sizeof(receiveName) + 12];
+static uint64_t receiveSize;
+static uint32_t receiveChunkLength;
+static uint32_t receiveChunks;
+static uint32_t receiveInOrder;
+static uint8_t* pReceived;
+static uint32_t receiveSinceAck;
+static uint8_t ackBitmap[TRANSFER_ACK_BITS / 8];
+static bool ackDue;
+
+// Chunks that follow each other in the file are gathered here while a receive is handled,
+// then written with one pwrite()
+static uint8_t staged[PACKET_RECEIVE_LEN];
+static uint64_t stagedOffset;
+static size_t stagedLength = 0;
+static uint64_t receiveBytes;
+static uint64_t receiveStart;
+
+// Returns the name of path without its directories
+static const char* baseName(const char* path)
+{
+    const char* pSlash = strrchr(path, '/');
+    return (pSlash == NULL) ? path : pSlash + 1;
+}
+
+// Display a progress line for a transfer of bytes out of total, started at startMicros
+static void report(const char* verb, const char* name, uint64_t bytes, uint64_t total, uint64_t startMicros)
+{
+    double seconds = (General_monotonicMicros() - startMicros) / 1e6;
+    double rate = (seconds > 0) ? (bytes / seconds / 1e6) : 0;
+    char line[512];
+    if (bytes < total) {
+        snprintf(line, sizeof(line), "[%s %s: %d%%, %.1f MB/s]\n", verb, name, (int)(bytes * 100 / total), rate);
+    }
+    else {
+        snprintf(line, sizeof(line), "[%s %s: %llu bytes in %.2f s, %.1f MB/s]\n", verb, name, (unsigned long long)bytes, seconds, rate);
+    }
+    General_print(line);
+}
+
+// Returns the absolute monotonic time timeoutMicros from now
+static struct timespec deadlineAfter(uint64_t timeoutMicros)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutMicros / 1000000;
+    deadline.tv_nsec += (timeoutMicros % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+// Wait until an ack newer than the lastCount-th arrives, or timeoutMicros pass
+// Returns the number of acks received so far
+static uint64_t waitForAck(uint64_t lastCount, uint64_t timeoutMicros)
+{
+    struct timespec deadline = deadlineAfter(timeoutMicros);
+    uint64_t count;
+    pthread_mutex_lock(&transferMutex);
+    {
+        while ((ackCount == lastCount) && !General_isShuttingDown()) {
+            if (pthread_cond_timedwait(&ackCondVar, &transferMutex, &deadline) != 0) {
+                break;
+            }
+        }
+        count = ackCount;
+    }
+    pthread_mutex_unlock(&transferMutex);
+    return count;
+}
+
+// Returns how long to wait for an ack before sending lost chunks again
+static uint64_t ackTimeout(const struct sockaddr_storage* pRemote, socklen_t remoteLength)
+{
+    uint64_t smoothedRtt;
+    uint64_t rttVariation;
+    uint64_t peerTimeout;
+    if (Peer_getRtt((struct sockaddr*)pRemote, remoteLength, &smoothedRtt, &rttVariation, &peerTimeout) != 0) {
+        return TRANSFER_DEFAULT_TIMEOUT;
+    }
+    uint64_t timeout = smoothedRtt + 4 * rttVariation;
+    if (timeout < TRANSFER_MIN_TIMEOUT) {
+        timeout = TRANSFER_MIN_TIMEOUT;
+    }
+    if (timeout > TRANSFER_MAX_TIMEOUT) {
+        timeout = TRANSFER_MAX_TIMEOUT;
+    }
+    return timeout;
+}
+
+// Outgoing file, mapped, and the chunks queued to be sent together
+typedef struct Outgoing_s Outgoing;
+struct Outgoing_s {
+    const char* name;
+    const uint8_t* pMapping;
+    uint64_t size;
+    uint32_t chunkLength;
+    uint32_t chunkCount;
+    struct sockaddr_storage remote;
+    socklen_t remoteLength;
+    int batchLimit;
+    int batchCount;
+    PacketHeader headers[PACKET_MAX_SEGMENTS];
+    const void* payloads[PACKET_MAX_SEGMENTS];
+    size_t lengths[PACKET_MAX_SEGMENTS];
+};
+
+// Send the queued chunks straight from the mapping, in one call where the kernel segments
+static void flushChunks(Outgoing* pOut)
+{
+    if (pOut->batchCount == 0) {
+        return;
+    }
+    if (Packet_sendSegments(pOut->headers, pOut->payloads, pOut->lengths, pOut->batchCount, (struct sockaddr*)&pOut->remote, pOut->remoteLength) < 0) {
+        Log_write(LOG_ERROR, "Transfer Thread Error: Failed to send file chunks\n");
+    }
+    pOut->batchCount = 0;
+}
+
+// Queue chunk number index to be sent. Chunks must be queued in increasing order between
+// flushes, so that only the last chunk of the file can end a batch short.
+static void queueChunk(Outgoing* pOut, uint32_t index)
+{
+    uint64_t offset = (uint64_t)index * pOut->chunkLength;
+    int i = pOut->batchCount++;
+    pOut->headers[i] = (PacketHeader){.type = PACKET_FILE_CHUNK, .flags = sendId, .sequence = index, .timestamp = 0};
+    pOut->payloads[i] = &pOut->pMapping[offset];
+    pOut->lengths[i] = (pOut->size - offset < pOut->chunkLength) ? (pOut->size - offset) : pOut->chunkLength;
+    if (pOut->batchCount == pOut->batchLimit) {
+        flushChunks(pOut);
+    }
+}
+
+// Returns true if bitmap reports the chunk bit places after the ones received in order
+static bool isAcked(const uint8_t* bitmap, uint32_t bit)
+{
+    return (bit < TRANSFER_ACK_BITS) && (bitmap[bit / 8] & (1 << (bit % 8)));
+}
+
+// Send the chunks up to next that the last ack did not report as received
+static void resendMissing(Outgoing* pOut, uint32_t inOrder, const uint8_t* bitmap, uint32_t next)
+{
+    for (uint32_t index = inOrder; index < next; index++) {
+        if ((index == inOrder) || !isAcked(bitmap, index - inOrder - 1)) {
+            queueChunk(pOut, index);
+        }
+    }
+    flushChunks(pOut);
+}
+
+// Pick the chunk length and how many chunks are sent per call. With segmentation, chunks
+// fit the route's MTU; without it, or on a route like loopback whose MTU holds the largest
+// chunk, each chunk is its own send.
+static void setChunking(Outgoing* pOut)
+{
+    pOut->chunkLength = TRANSFER_CHUNK_LEN;
+    int mtu = Packet_pathMtu((struct sockaddr*)&pOut->remote, pOut->remoteLength);
+    if (Packet_canSegment() && (mtu > TRANSFER_MTU_OVERHEAD) && (mtu - TRANSFER_MTU_OVERHEAD < TRANSFER_CHUNK_LEN)) {
+        pOut->chunkLength = mtu - TRANSFER_MTU_OVERHEAD;
+    }
+    pOut->chunkCount = (pOut->size + pOut->chunkLength - 1) / pOut->chunkLength;
+    pOut->batchLimit = PACKET_MAX_SEGMENTED_LEN / (PACKET_HEADER_LEN + pOut->chunkLength);
+    if (!Packet_canSegment() || (pOut->batchLimit < 1)) {
+        pOut->batchLimit = 1;
+    }
+    if (pOut->batchLimit > PACKET_MAX_SEGMENTS) {
+        pOut->batchLimit = PACKET_MAX_SEGMENTS;
+    }
+}
+
+// Pick the chunking, announce the transfer and wait for the receiver to acknowledge it
+// Returns true once the receiver is ready for chunks
+static bool startTransfer(Outgoing* pOut)
+{
+    setChunking(pOut);
+    uint8_t payload[12 + 255];
+    size_t nameLength = strlen(pOut->name);
+    if (nameLength > 255) {
+        nameLength = 255;
+    }
+    Packet_writeBigEndian(&payload[0], pOut->size, 8);
+    Packet_writeBigEndian(&payload[8], pOut->chunkLength, 4);
+    memcpy(&payload[12], pOut->name, nameLength);
+    PacketHeader header = {.type = PACKET_FILE_START, .flags = sendId, .sequence = 0, .timestamp = 0};
+
+    for (int attempt = 0; (attempt < TRANSFER_START_ATTEMPTS) && !General_isShuttingDown(); attempt++) {
+        if (Packet_send(&header, payload, 12 + nameLength, (struct sockaddr*)&pOut->remote, pOut->remoteLength) < 0) {
+            Log_write(LOG_ERROR, "Transfer Thread Error: Failed to send the file header\n");
+        }
+        if (waitForAck(0, 1000000) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Stream the mapped file, keeping at most a window of chunks beyond the ones received in
+// order, until every chunk is acknowledged
+// Returns true if the whole file was received
+static bool streamChunks(Outgoing* pOut)
+{
+    uint32_t maxWindow = TRANSFER_WINDOW_BYTES / pOut->chunkLength;
+    if (maxWindow > TRANSFER_ACK_BITS) {
+        maxWindow = TRANSFER_ACK_BITS;
+    }
+    uint32_t minWindow = TRANSFER_MIN_WINDOW_BYTES / pOut->chunkLength;
+    if (minWindow > maxWindow) {
+        minWindow = maxWindow;
+    }
+    uint32_t next = 0;
+    uint32_t window = maxWindow;
+    uint32_t windowStart = 0;
+    uint64_t lastCount = 0;
+    uint32_t lastInOrder = 0;
+    uint32_t fastResent = UINT32_MAX;
+    uint64_t start = General_monotonicMicros();
+    uint64_t lastProgress = start;
+    uint64_t lastReport = start;
+    while (1) {
+        uint32_t inOrder;
+        uint8_t bitmap[TRANSFER_ACK_BITS / 8];
+        pthread_mutex_lock(&transferMutex);
+        {
+            inOrder = acked;
+            memcpy(bitmap, sacked, sizeof(bitmap));
+        }
+        pthread_mutex_unlock(&transferMutex);
+        if (inOrder >= pOut->chunkCount) {
+            report("Sent", pOut->name, pOut->size, pOut->size, start);
+            return true;
+        }
+        if (General_isShuttingDown()) {
+            return false;
+        }
+
+        uint64_t now = General_monotonicMicros();
+        if (inOrder != lastInOrder) {
+            lastInOrder = inOrder;
+            lastProgress = now;
+        }
+        else if (now - lastProgress > TRANSFER_STALL_MS * 1000ULL) {
+            Log_write(LOG_ERROR, "Transfer Thread Error: The remote user stopped acknowledging the file\n");
+            return false;
+        }
+        if (now - lastReport >= TRANSFER_REPORT_MS * 1000ULL) {
+            report("Sending", pOut->name, (uint64_t)inOrder * pOut->chunkLength, pOut->size, start);
+            lastReport = now;
+        }
+
+        // A chunk acked beyond the first missing one means that one was lost: send it again
+        // once, without waiting for the timeout
+        bool gap = false;
+        for (int i = 0; (i < (int)sizeof(bitmap)) && !gap; i++) {
+            gap = (bitmap[i] != 0);
+        }
+        if (gap && (fastResent != inOrder)) {
+            queueChunk(pOut, inOrder);
+            fastResent = inOrder;
+        }
+        if ((inOrder >= windowStart + window) && (window < maxWindow)) {
+            window++;
+            windowStart = inOrder;
+        }
+        while ((next < pOut->chunkCount) && (next < inOrder + window)) {
+            queueChunk(pOut, next);
+            next++;
+        }
+        flushChunks(pOut);
+
+        uint64_t count = waitForAck(lastCount, ackTimeout(&pOut->remote, pOut->remoteLength));
+        if (count == lastCount) {
+            resendMissing(pOut, inOrder, bitmap, next);
+            window = (window / 2 > minWindow) ? (window / 2) : minWindow;
+            windowStart = inOrder;
+        }
+        lastCount = count;
+    }
+}
+
+// Sends the file at sendPath to the remote user
+void* transferThread()
+{
+    Outgoing outgoing;
+    outgoing.name = baseName(sendPath);
+    int fd = open(sendPath, O_RDONLY);
+    struct stat status;
+    if ((fd == -1) || (fstat(fd, &status) != 0) || !S_ISREG(status.st_mode)) {
+        Log_write(LOG_ERROR, "Transfer Thread Error: Failed to open the file\n");
+        if (fd != -1) {
+            close(fd);
+        }
+        goto done;
+    }
+    uint64_t size = status.st_size;
+    uint8_t* pMapping = NULL;
+    if (size > 0) {
+        pMapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pMapping == MAP_FAILED) {
+            Log_write(LOG_ERROR, "Transfer Thread Error: Failed to map the file\n");
+            close(fd);
+            goto done;
+        }
+        posix_madvise(pMapping, size, POSIX_MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    outgoing.pMapping = pMapping;
+    outgoing.size = size;
+    outgoing.batchCount = 0;
+    if (Resolver_lookup(remoteMachineName, remotePort, &outgoing.remote, &outgoing.remoteLength, true) != 0) {
+        Log_write(LOG_ERROR, "Transfer Thread Error: Failed to resolve the remote machine name\n");
+    }
+    else if (!startTransfer(&outgoing)) {
+        Log_write(LOG_ERROR, "Transfer Thread Error: The remote user did not accept the file\n");
+    }
+    else {
+        streamChunks(&outgoing);
+    }
+    if (pMapping != NULL) {
+        munmap(pMapping, size);
+    }
+
+done:
+    pthread_mutex_lock(&transferMutex);
+    {
+        sending = false;
+    }
+    pthread_mutex_unlock(&transferMutex);
+    return NULL;
+}
+
+// Remember where files are sent to, size the socket receive buffer for a window, and turn
+// on UDP offload unless segmentation is false
+void Transfer_init(char* machineName, char* port, bool segmentation)
+{
+    remoteMachineName = machineName;
+    remotePort = port;
+    // The kernel caps this at net.core.rmem_max
+    int bufferSize = 2 * TRANSFER_WINDOW_BYTES;
+    setsockopt(socketDescriptor, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    if (segmentation) {
+        Packet_enableOffload();
+    }
+    sendId = (uint16_t)getpid();
+
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&ackCondVar, &attributes);
+    pthread_condattr_destroy(&attributes);
+}
+
+// Start sending the file at path on a background thread
+int Transfer_sendFile(const char* path)
+{
+    pthread_mutex_lock(&transferMutex);
+    {
+        if (sending) {
+            pthread_mutex_unlock(&transferMutex);
+            return -1;
+        }
+        sending = true;
+        sendId++;
+        acked = 0;
+        memset(sacked, 0, sizeof(sacked));
+        ackCount = 0;
+    }
+    pthread_mutex_unlock(&transferMutex);
+
+    if (threadCreated) {
+        pthread_join(threadPID, NULL);
+        free(sendPath);
+    }
+    sendPath = strdup(path);
+    threadCreated = (pthread_create(&threadPID, NULL, transferThread, NULL) == 0);
+    if (!threadCreated) {
+        Log_write(LOG_ERROR, "Transfer Thread Error: Failed to create the transfer thread\n");
+        pthread_mutex_lock(&transferMutex);
+        {
+            sending = false;
+        }
+        pthread_mutex_unlock(&transferMutex);
+        return -1;
+    }
+    return 0;
+}
+
+// Acknowledge the chunks of the incoming transfer received so far
+static void sendAck(uint16_t id, uint32_t inOrder, const struct sockaddr* pDestination, socklen_t destinationLength)
+{
+    memset(ackBitmap, 0, sizeof(ackBitmap));
+    for (uint32_t i = 0; (i < TRANSFER_ACK_BITS) && receiving && (inOrder + 1 + i < receiveChunks); i++) {
+        uint32_t index = inOrder + 1 + i;
+        if (pReceived[index / 8] & (1 << (index % 8))) {
+            ackBitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+    PacketHeader header = {.type = PACKET_FILE_ACK, .flags = id, .sequence = inOrder, .timestamp = 0};
+    Packet_send(&header, ackBitmap, sizeof(ackBitmap), pDestination, destinationLength);
+}
+
+// Write the gathered chunks to the incoming file
+// Returns false on failure
+static bool writeStaged()
+{
+    bool written = (stagedLength == 0) || (pwrite(receiveFd, staged, stagedLength, stagedOffset) == (ssize_t)stagedLength);
+    stagedLength = 0;
+    return written;
+}
+
+// Close the incoming file, reporting it if it is incomplete
+static void finishReceiving()
+{
+    if (!writeStaged()) {
+        Log_write(LOG_ERROR, "Transfer Thread Error: Failed to write the received file\n");
+    }
+    if (receiveInOrder < receiveChunks) {
+        char line[512];
+        snprintf(line, sizeof(line), "[Incomplete file %s: %llu of %llu bytes]\n", receivePath,
+            (unsigned long long)receiveBytes, (unsigned long long)receiveSize);
+        General_print(line);
+    }
+    else {
+        report("Received", receiveName, receiveBytes, receiveSize, receiveStart);
+        completedValid = true;
+        completedId = receiveId;
+        completedChunks = receiveChunks;
+    }
+    close(receiveFd);
+    receiveFd = -1;
+    free(pReceived);
+    pReceived = NULL;
+    receiving = false;
+}
+
+// Create received_<name>, or received_<name>.N if that exists, without replacing any file
+// Returns the descriptor, or -1 on failure
+static int createReceivedFile()
+{
+    for (int attempt = 0; attempt < TRANSFER_MAX_NAME_TRIES; attempt++) {
+        if (attempt == 0) {
+            snprintf(receivePath, sizeof(receivePath), "%s%s", TRANSFER_FILE_PREFIX, receiveName);
+        }
+        else {
+            snprintf(receivePath, sizeof(receivePath), "%s%s.%d", TRANSFER_FILE_PREFIX, receiveName, attempt);
+        }
+        int fd = open(receivePath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if ((fd != -1) || (errno != EEXIST)) {
+            return fd;
+        }
+    }
+    return -1;
+}
+
+// Display that the file announced as name, of size bytes, was refused, and why
+static void refuse(const char* name, uint64_t size, const char* reason)
+{
+    char line[512];
+    snprintf(line, sizeof(line), "[Refused file %s, %llu bytes: %s]\n", name, (unsigned long long)size, reason);
+    General_print(line);
+}
+
+// Create and pre-allocate the destination file of a transfer announced by pSource, if it is
+// no larger than the max-file setting and fits on the disk
+static void beginReceiving(uint16_t id, const uint8_t* pPayload, int length, const struct sockaddr* pSource, socklen_t sourceLength)
+{
+    if (length < 12) {
+        return;
+    }
+    uint64_t size = Packet_readBigEndian(&pPayload[0], 8);
+    uint32_t chunkLength = Packet_readBigEndian(&pPayload[8], 4);
+    int nameLength = length - 12;
+    if ((chunkLength < TRANSFER_MIN_CHUNK_LEN) || (chunkLength > TRANSFER_CHUNK_LEN) || (nameLength == 0)
+        || (nameLength >= (int)sizeof(receiveName)) || ((size + chunkLength - 1) / chunkLength > UINT32_MAX)) {
+        return;
+    }
+    char name[sizeof(receiveName)];
+    memcpy(name, &pPayload[12], nameLength);
+    name[nameLength] = 0;
+    if ((name[0] == 0) || (strcmp(name, ".") == 0) || (strcmp(name, "..") == 0) || (strlen(name) != (size_t)nameLength)
+        || (strchr(name, '/') != NULL)) {
+        Log_write(LOG_ERROR, "Transfer Thread Error: Refused a file with an invalid name\n");
+        return;
+    }
+    if (size > (uint64_t)Config_settings.maxFileMegabytes * 1024 * 1024) {
+        refuse(name, size, "larger than max-file");
+        return;
+    }
+    struct statvfs disk;
+    if ((statvfs(".", &disk) == 0) && (size > (uint64_t)disk.f_bavail * disk.f_frsize)) {
+        refuse(name, size, "not enough free disk space");
+        return;
+    }
+    if (receiving) {
+        finishReceiving();
+    }
+
+    strcpy(receiveName, name);
+    receiveFd = createReceivedFile();
+    if (receiveFd == -1) {
+        Log_write(LOG_ERROR, "Transfer Thread Error: Failed to create the received file\n");
+        return;
+    }
+    if ((size > 0) && (posix_fallocate(receiveFd, 0, size) != 0) && (ftruncate(receiveFd, size) != 0)) {
+        Log_write(LOG_ERROR, "Transfer Thread Error: Failed to allocate the received file\n");
+        close(receiveFd);
+        unlink(receivePath);
+        receiveFd = -1;
+        return;
+    }
+    uint64_t chunks = (size + chunkLength - 1) / chunkLength;
+    pReceived = calloc(chunks / 8 + 1, 1);
+    if (pReceived == NULL) {
+        Log_write(LOG_ERROR, "Transfer Thread Error: Failed to allocate the received chunk map\n");
+        close(receiveFd);
+        unlink(receivePath);
+        receiveFd = -1;
+        return;
+    }
+
+    receiving = true;
+    receiveId = id;
+    memcpy(&receiveSource, pSource, sourceLength);
+    receiveSourceLength = sourceLength;
+    receiveSize = size;
+    receiveChunkLength = chunkLength;
+    receiveChunks = chunks;
+    receiveInOrder = 0;
+    receiveSinceAck = 0;
+    ackDue = false;
+    receiveBytes = 0;
+    receiveStart = General_monotonicMicros();
+
+    char line[512];
+    snprintf(line, sizeof(line), "[Receiving %s, %llu bytes]\n", receivePath, (unsigned long long)size);
+    General_print(line);
+    sendAck(id, 0, pSource, sourceLength);
+    if (receiveChunks == 0) {
+        finishReceiving();
+    }
+}
+
+// Gather a chunk of the incoming transfer to be written at its offset, and note whether
+// an ack is due
+static void receiveChunk(uint32_t index, const uint8_t* pPayload, int length)
+{
+    uint64_t offset = (uint64_t)index * receiveChunkLength;
+    uint64_t expected = (receiveSize - offset < receiveChunkLength) ? (receiveSize - offset) : receiveChunkLength;
+    if ((index >= receiveChunks) || ((uint64_t)length != expected)) {
+        return;
+    }
+    bool duplicate = (pReceived[index / 8] & (1 << (index % 8))) != 0;
+    if (!duplicate) {
+        if ((stagedLength > 0) && ((offset != stagedOffset + stagedLength) || (stagedLength + length > sizeof(staged)))) {
+            if (!writeStaged()) {
+                Log_write(LOG_ERROR, "Transfer Thread Error: Failed to write the received file\n");
+                finishReceiving();
+                return;
+            }
+        }
+        if (stagedLength == 0) {
+            stagedOffset = offset;
+        }
+        memcpy(&staged[stagedLength], pPayload, length);
+        stagedLength += length;
+        pReceived[index / 8] |= 1 << (index % 8);
+        receiveBytes += length;
+    }
+
+    // Ack at once when a chunk arrives out of order, again, or fills a gap
+    uint32_t previousInOrder = receiveInOrder;
+    while ((receiveInOrder < receiveChunks) && (pReceived[receiveInOrder / 8] & (1 << (receiveInOrder % 8)))) {
+        receiveInOrder++;
+    }
+    bool unusual = duplicate || (index != previousInOrder) || (receiveInOrder > previousInOrder + 1);
+    receiveSinceAck += length;
+    if (unusual || (receiveSinceAck >= TRANSFER_ACK_EVERY_BYTES) || (receiveInOrder == receiveChunks)) {
+        ackDue = true;
+    }
+}
+
+// Write the chunks gathered from the last receive, then send the ack if one is due
+void Transfer_flushReceived()
+{
+    if (!receiving) {
+        return;
+    }
+    if (!writeStaged()) {
+        Log_write(LOG_ERROR, "Transfer Thread Error: Failed to write the received file\n");
+        finishReceiving();
+        return;
+    }
+    if (ackDue) {
+        sendAck(receiveId, receiveInOrder, (struct sockaddr*)&receiveSource, receiveSourceLength);
+        ackDue = false;
+        receiveSinceAck = 0;
+    }
+    if (receiveInOrder == receiveChunks) {
+        finishReceiving();
+    }
+}
+
+// Returns true if pSource is the remote user, as last resolved
+static bool fromRemote(const struct sockaddr* pSource)
+{
+    struct sockaddr_storage remote;
+    socklen_t remoteLength;
+    return (Resolver_lookup(remoteMachineName, remotePort, &remote, &remoteLength, false) == 0)
+        && Peer_sameAddress((struct sockaddr*)&remote, pSource);
+}
+
+// Handle a file packet of the given type, with length bytes of pPayload, from pSource.
+// Only the remote user may send files or acknowledge them.
+void Transfer_handlePacket(const PacketHeader* pHeader, const uint8_t* pPayload, int length, const struct sockaddr* pSource, socklen_t sourceLength)
+{
+    if (!fromRemote(pSource)) {
+        General_stats.receiveDropped++;
+        return;
+    }
+    if (pHeader->type == PACKET_FILE_ACK) {
+        pthread_mutex_lock(&transferMutex);
+        {
+            if (sending && (pHeader->flags == sendId)) {
+                int bitmapLength = (length < (int)sizeof(sacked)) ? length : (int)sizeof(sacked);
+                if (pHeader->sequence > acked) {
+                    acked = pHeader->sequence;
+                    memset(sacked, 0, sizeof(sacked));
+                    memcpy(sacked, pPayload, bitmapLength);
+                }
+                else if (pHeader->sequence == acked) {
+                    for (int i = 0; i < bitmapLength; i++) {
+                        sacked[i] |= pPayload[i];
+                    }
+                }
+                ackCount++;
+                pthread_cond_signal(&ackCondVar);
+            }
+        }
+        pthread_mutex_unlock(&transferMutex);
+        return;
+    }
+
+    bool current = receiving && (pHeader->flags == receiveId) && (sourceLength == receiveSourceLength)
+        && (memcmp(pSource, &receiveSource, sourceLength) == 0);
+    if (pHeader->type == PACKET_FILE_START) {
+        if (current) {
+            sendAck(receiveId, receiveInOrder, pSource, sourceLength);
+        }
+        else if (completedValid && (pHeader->flags == completedId)) {
+            sendAck(completedId, completedChunks, pSource, sourceLength);
+        }
+        else if (!receiving || ((sourceLength == receiveSourceLength) && (memcmp(pSource, &receiveSource, sourceLength) == 0))) {
+            // A transfer in progress is only replaced by a new one from the same source
+            beginReceiving(pHeader->flags, pPayload, length, pSource, sourceLength);
+        }
+    }
+    else if (current) {
+        receiveChunk(pHeader->sequence, pPayload, length);
+    }
+    else if (completedValid && (pHeader->flags == completedId)) {
+        // The last ack of a finished transfer was lost
+        sendAck(completedId, completedChunks, pSource, sourceLength);
+    }
+}
+
+// Stop the outgoing transfer once shutdown has begun, and close an incomplete incoming file
+void Transfer_shutdown()
+{
+    if (threadCreated) {
+        pthread_mutex_lock(&transferMutex);
+        {
+            pthread_cond_broadcast(&ackCondVar);
+        }
+        pthread_mutex_unlock(&transferMutex);
+        pthread_join(threadPID, NULL);
+        free(sendPath);
+    }
+    if (receiving) {
+        finishReceiving();
+    }
+    pthread_cond_destroy(&ackCondVar);
+}
@@ -0,0 +1,59 @@
+#ifndef _TRANSFER_H_
+#define _TRANSFER_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "packet.h"
+
+// "/send <path>" streams a file to the remote user. The file is memory-mapped and every chunk
+// is sent straight from the mapping, behind a header, without being copied.
+// The receiver pre-allocates the destination file and writes each chunk at its offset with
+// pwrite(). It acknowledges the number of chunks received in order, plus a bitmap of the
+// TRANSFER_ACK_BITS chunks after those, so the sender only sends again what was lost.
+// Where the kernel can segment UDP (GSO), chunks are sized to fit the route's MTU and
+// handed to the kernel up to PACKET_MAX_SEGMENTED_LEN bytes per send, so a fast link
+// neither fragments datagrams nor makes a system call per frame.
+//
+// File start: sequence 0, payload of file size (8 bytes), chunk length (4) and file name
+// File chunk: sequence is the chunk number, payload is the chunk
+// File ack: sequence is the number of chunks received in order, payload is the bitmap
+
+// Line typed to start a transfer, followed by the path
+#define TRANSFER_COMMAND "/send "
+
+// Bytes per chunk. With segmentation, chunks are sized so each datagram fits the MTU of
+// the route, leaving room for IPv6 and UDP headers, up to the unsegmented size.
+#define TRANSFER_CHUNK_LEN PACKET_MAX_PAYLOAD_LEN
+#define TRANSFER_MTU_OVERHEAD (40 + 8 + PACKET_HEADER_LEN)
+
+// Most bytes sent beyond the chunks received in order, and no more chunks than an ack
+// covers. The window halves down to its minimum when chunks are lost, and grows back by
+// a chunk per window acked.
+#define TRANSFER_ACK_BITS 1024
+#define TRANSFER_WINDOW_BYTES (2 * 1024 * 1024)
+#define TRANSFER_MIN_WINDOW_BYTES (512 * 1024)
+
+// Received files are written to the working directory, with this prefix on the sent name
+#define TRANSFER_FILE_PREFIX "received_"
+
+// Remember where files are sent to, and ask for a socket receive buffer that holds two
+// windows; without one, most of a window is dropped on a fast link. With segmentation
+// false, file chunks are sent one datagram per call.
+void Transfer_init(char* machineName, char* port, bool segmentation);
+
+// Start sending the file at path on a background thread
+// Returns 0 on success, -1 if a transfer is already running
+int Transfer_sendFile(const char* path);
+
+// Handle a file packet of the given type, with length bytes of pPayload, from pSource
+// Called from the receive thread
+void Transfer_handlePacket(const PacketHeader* pHeader, const uint8_t* pPayload, int length, const struct sockaddr* pSource, socklen_t sourceLength);
+
+// Write the file chunks handled since the last call, and acknowledge them
+// Called from the receive thread after each receive
+void Transfer_flushReceived();
+
+// Stop the outgoing transfer once shutdown has begun, and close an incomplete incoming file
+void Transfer_shutdown();
+
+#endif